@@ -0,0 +1,433 @@
+/*
+ * Software License Agreement (Modified BSD License)
+ *
+ *  Copyright (c) 2013, PAL Robotics, S.L.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of PAL Robotics, S.L. nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** Benchmark of the hot paths of the motion pipeline.
+ * Motions and controllers are synthetic, and motions are handed to the library directly instead of through the
+ * parameter server, so no roscore is needed. Results are the median time per call, and can be written as CSV to
+ * compare runs over time.
+ *
+ * Usage: play_motion_benchmark [--quick] [--csv] [--filter <substring>]
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <ros/time.h>
+#include <XmlRpcValue.h>
+
+#include "play_motion/approach_planner.h"
+#include "play_motion/motion_library.h"
+#include "play_motion/packed_trajectory.h"
+#include "play_motion/play_motion_helpers.h"
+
+using namespace play_motion;
+
+namespace
+{
+  struct Options
+  {
+    Options() : quick(false), csv(false) {}
+    bool        quick;  ///< Smaller problem sizes, for a fast sanity check
+    bool        csv;
+    std::string filter; ///< Only run benchmarks whose name contains this
+  };
+
+  Options options;
+
+  /// \brief Time a function, calling it repeatedly for at least \p min_time seconds.
+  /// \return Median time per call, in seconds.
+  double measure(const boost::function<void()>& f, double min_time = 0.2)
+  {
+    std::vector<double> samples;
+    const ros::WallTime start = ros::WallTime::now();
+    while (samples.size() < 3 || ((ros::WallTime::now() - start).toSec() < min_time && samples.size() < 1000))
+    {
+      const ros::WallTime t0 = ros::WallTime::now();
+      f();
+      samples.push_back((ros::WallTime::now() - t0).toSec());
+    }
+    std::nth_element(samples.begin(), samples.begin() + samples.size() / 2, samples.end());
+    return samples[samples.size() / 2];
+  }
+
+  bool enabled(const std::string& name)
+  {
+    return options.filter.empty() || name.find(options.filter) != std::string::npos;
+  }
+
+  void report(const std::string& name, const std::string& config, double time)
+  {
+    if (options.csv)
+      std::printf("%s,%s,%.9f\n", name.c_str(), config.c_str(), time);
+    else
+      std::printf("%-22s %-36s %12.3f us\n", name.c_str(), config.c_str(), 1e6 * time);
+    std::fflush(stdout);
+  }
+
+  std::string config(std::size_t motions, std::size_t joints, std::size_t points)
+  {
+    std::ostringstream os;
+    if (motions > 0) {os << "motions=" << motions << " ";}
+    if (joints > 0)  {os << "joints=" << joints << " ";}
+    if (points > 0)  {os << "points=" << points;}
+    return os.str();
+  }
+
+  JointNames makeJoints(std::size_t num_joints, std::size_t first = 0)
+  {
+    JointNames joints;
+    for (std::size_t i = first; i < first + num_joints; ++i)
+    {
+      std::ostringstream os;
+      os << "joint_" << i;
+      joints.push_back(os.str());
+    }
+    return joints;
+  }
+
+  /// Smooth motion, with a waypoint every 10ms.
+  Trajectory makeTrajectory(std::size_t num_joints, std::size_t num_points, double phase = 0.0)
+  {
+    Trajectory traj(num_points);
+    for (std::size_t i = 0; i < num_points; ++i)
+    {
+      traj[i].time_from_start = ros::Duration(0.01 * i);
+      traj[i].positions.resize(num_joints);
+      for (std::size_t j = 0; j < num_joints; ++j)
+        traj[i].positions[j] = std::sin(0.01 * i + 0.1 * j + phase);
+    }
+    return traj;
+  }
+
+  /// Motion as found in the parameter server.
+  XmlRpc::XmlRpcValue makeMotionParam(const JointNames& joints, const Trajectory& traj)
+  {
+    XmlRpc::XmlRpcValue param;
+    param["joints"].setSize(joints.size());
+    for (std::size_t j = 0; j < joints.size(); ++j)
+      param["joints"][j] = joints[j];
+
+    XmlRpc::XmlRpcValue& points = param["points"];
+    points.setSize(traj.size());
+    for (std::size_t i = 0; i < traj.size(); ++i)
+    {
+      points[i]["time_from_start"] = traj[i].time_from_start.toSec();
+      XmlRpc::XmlRpcValue& positions = points[i]["positions"];
+      positions.setSize(traj[i].positions.size());
+      for (std::size_t j = 0; j < traj[i].positions.size(); ++j)
+        positions[j] = traj[i].positions[j];
+    }
+
+    param["meta"]["name"] = "Synthetic motion";
+    param["meta"]["usage"] = "benchmark";
+    param["meta"]["description"] = "Generated by play_motion_benchmark";
+    return param;
+  }
+
+  /// Library of motions using consecutive subsets of a pool of joints, like the arm, head or torso groups of a robot.
+  XmlRpc::XmlRpcValue makeLibraryParam(std::size_t num_motions, std::size_t num_joints, std::size_t num_points,
+                                       std::size_t joint_pool)
+  {
+    XmlRpc::XmlRpcValue motions;
+    for (std::size_t m = 0; m < num_motions; ++m)
+    {
+      std::ostringstream id;
+      id << (m % 2 ? "arm_" : "head_") << m;
+      const JointNames joints = makeJoints(num_joints, (m * num_joints) % (joint_pool - num_joints + 1));
+      motions[id.str()] = makeMotionParam(joints, makeTrajectory(num_joints, num_points, 0.1 * m));
+    }
+    return motions;
+  }
+
+  /// Copy the parameter on each run, since parsing may convert values in place.
+  void parseRun(const XmlRpc::XmlRpcValue& param)
+  {
+    XmlRpc::XmlRpcValue copy = param;
+    MotionInfo info;
+    parseMotion("motion", copy, info);
+  }
+
+  void benchParse(const std::vector<std::size_t>& joint_counts, const std::vector<std::size_t>& point_counts)
+  {
+    if (!enabled("parse_motion"))
+      return;
+    for (std::size_t j = 0; j < joint_counts.size(); ++j)
+    {
+      for (std::size_t p = 0; p < point_counts.size(); ++p)
+      {
+        const XmlRpc::XmlRpcValue param = makeMotionParam(makeJoints(joint_counts[j]),
+                                                          makeTrajectory(joint_counts[j], point_counts[p]));
+        report("parse_motion", config(0, joint_counts[j], point_counts[p]),
+               measure(boost::bind(parseRun, boost::cref(param))));
+      }
+    }
+  }
+
+  void populateRun(const Trajectory& traj_in, Trajectory& traj_out)
+  {
+    populateVelocities(traj_in, traj_out);
+  }
+
+  void benchPopulateVelocities(const std::vector<std::size_t>& joint_counts,
+                               const std::vector<std::size_t>& point_counts)
+  {
+    if (!enabled("populate_velocities"))
+      return;
+    for (std::size_t j = 0; j < joint_counts.size(); ++j)
+    {
+      for (std::size_t p = 0; p < point_counts.size(); ++p)
+      {
+        const Trajectory traj = makeTrajectory(joint_counts[j], point_counts[p]);
+        Trajectory traj_out;
+        report("populate_velocities", config(0, joint_counts[j], point_counts[p]),
+               measure(boost::bind(populateRun, boost::cref(traj), boost::ref(traj_out))));
+      }
+    }
+  }
+
+  /// Synthetic controller: its joints, and the index in the motion of each of them (-1 if not in the motion).
+  struct Controller
+  {
+    JointNames       joints;
+    std::vector<int> motion_indices;
+    std::vector<double> hold;   ///< Current position of the controller joints
+  };
+
+  /// Controllers of up to 7 joints spanning the motion joints, each with an extra joint not used by the motion.
+  std::vector<Controller> makeControllers(const JointNames& motion_joints)
+  {
+    std::vector<Controller> controllers;
+    for (std::size_t first = 0; first < motion_joints.size(); first += 7)
+    {
+      Controller ctrl;
+      for (std::size_t j = first; j < std::min(first + 7, motion_joints.size()); ++j)
+      {
+        ctrl.joints.push_back(motion_joints[j]);
+        ctrl.motion_indices.push_back(j);
+      }
+      ctrl.joints.push_back("extra_joint_" + motion_joints[first]);
+      ctrl.motion_indices.push_back(-1);
+      ctrl.hold.resize(ctrl.joints.size(), 0.5);
+      controllers.push_back(ctrl);
+    }
+    return controllers;
+  }
+
+  /// Same split as PlayMotion::getGroupTraj(), without the joint state lookup: the waypoints processed for the goal
+  /// are extracted straight from the trajectory, and the cached body is appended after them.
+  void splitRun(const Trajectory& head, const PackedTrajectory& body, const ros::Duration& body_offset,
+                const std::vector<Controller>& controllers)
+  {
+    std::vector<trajectory_msgs::JointTrajectory> goals(controllers.size());
+    for (std::size_t c = 0; c < controllers.size(); ++c)
+    {
+      goals[c].points.reserve(head.size() + body.size());
+      extractJoints(head, controllers[c].motion_indices, controllers[c].hold, goals[c]);
+      body.append(controllers[c].motion_indices, controllers[c].hold, body_offset, goals[c]);
+    }
+  }
+
+  void benchSplit(const std::vector<std::size_t>& joint_counts, const std::vector<std::size_t>& point_counts)
+  {
+    if (!enabled("split_goal"))
+      return;
+    for (std::size_t j = 0; j < joint_counts.size(); ++j)
+    {
+      const std::vector<Controller> controllers = makeControllers(makeJoints(joint_counts[j]));
+      for (std::size_t p = 0; p < point_counts.size(); ++p)
+      {
+        Trajectory traj = makeTrajectory(joint_counts[j], point_counts[p]);
+        populateVelocities(traj, traj);
+
+        // A few waypoints of approach and first motion segment, followed by the body, packed once like the cached one
+        const Trajectory head(traj.begin(), traj.begin() + std::min<std::size_t>(5, traj.size()));
+        const ros::Duration body_offset = head.back().time_from_start;
+        Trajectory body_traj(traj.begin() + head.size(), traj.end());
+        for (std::size_t i = 0; i < body_traj.size(); ++i)
+          body_traj[i].time_from_start -= body_offset;
+        const PackedTrajectory body(body_traj);
+
+        report("split_goal", config(0, joint_counts[j], point_counts[p]),
+               measure(boost::bind(splitRun, boost::cref(head), boost::cref(body), boost::cref(body_offset),
+                                   boost::cref(controllers))));
+      }
+    }
+  }
+
+  void combineRun(const JointNames& joints, const std::vector<double>& current_pos, const Trajectory& traj,
+                  const trajectory_msgs::JointTrajectory& approach)
+  {
+    trajectory_msgs::JointTrajectory approach_copy = approach;
+    Trajectory traj_out;
+    ApproachPlanner::combineTrajectories(joints, current_pos, traj, approach_copy, traj_out);
+  }
+
+  void benchCombine(const std::vector<std::size_t>& joint_counts, const std::vector<std::size_t>& point_counts)
+  {
+    if (!enabled("combine_trajectories"))
+      return;
+    for (std::size_t j = 0; j < joint_counts.size(); ++j)
+    {
+      // Planned approach of 50 waypoints covering half of the joints, the others are blended
+      const JointNames joints = makeJoints(joint_counts[j]);
+      const std::size_t num_planned = std::max(joint_counts[j] / 2, std::size_t(1));
+      trajectory_msgs::JointTrajectory approach;
+      approach.joint_names = JointNames(joints.begin(), joints.begin() + num_planned);
+      approach.points = makeTrajectory(num_planned, 50);
+      populateVelocities(approach.points, approach.points);
+      const std::vector<double> current_pos(joint_counts[j], 0.0);
+
+      for (std::size_t p = 0; p < point_counts.size(); ++p)
+      {
+        const Trajectory traj = makeTrajectory(joint_counts[j], point_counts[p]);
+        report("combine_trajectories", config(0, joint_counts[j], point_counts[p]),
+               measure(boost::bind(combineRun, boost::cref(joints), boost::cref(current_pos), boost::cref(traj),
+                                   boost::cref(approach))));
+      }
+    }
+  }
+
+  /// Check all the motions of a library against the same joint state, like the is_already_there_batch service.
+  void isAlreadyThereRun(const std::vector<MotionInfo>& motions, const JointNames& state_joints,
+                         const TrajPoint& state)
+  {
+    volatile std::size_t count = 0;
+    for (std::size_t m = 0; m < motions.size(); ++m)
+    {
+      if (isAlreadyThere(motions[m].joints, motions[m].traj.front(), state_joints, state, 0.1))
+        ++count;
+    }
+  }
+
+  void benchIsAlreadyThere(const std::vector<std::size_t>& motion_counts, const std::vector<std::size_t>& joint_counts)
+  {
+    if (!enabled("is_already_there"))
+      return;
+    const std::size_t joint_pool = 60;
+    for (std::size_t m = 0; m < motion_counts.size(); ++m)
+    {
+      for (std::size_t j = 0; j < joint_counts.size(); ++j)
+      {
+        XmlRpc::XmlRpcValue library = makeLibraryParam(motion_counts[m], joint_counts[j], 2, joint_pool);
+        std::vector<MotionInfo> motions(motion_counts[m]);
+        std::size_t i = 0;
+        for (XmlRpc::XmlRpcValue::iterator it = library.begin(); it != library.end(); ++it, ++i)
+          parseMotion(it->first, it->second, motions[i]);
+
+        // Joint states list all the robot joints
+        const JointNames state_joints = makeJoints(joint_pool);
+        const Trajectory state = makeTrajectory(joint_pool, 1);
+        report("is_already_there", config(motion_counts[m], joint_counts[j], 0),
+               measure(boost::bind(isAlreadyThereRun, boost::cref(motions), boost::cref(state_joints),
+                                   boost::cref(state.front()))));
+      }
+    }
+  }
+
+  void listRun(const MotionLibrary& library, const std::string& prefix, const JointNames& joints)
+  {
+    std::vector<MotionLibrary::MotionSummary> summaries;
+    library.getMotionSummaries(prefix, joints, summaries);
+  }
+
+  void benchListMotions(const std::vector<std::size_t>& motion_counts)
+  {
+    if (!enabled("list_motions"))
+      return;
+    const std::size_t joint_pool = 60;
+    for (std::size_t m = 0; m < motion_counts.size(); ++m)
+    {
+      MotionLibrary library;
+      XmlRpc::XmlRpcValue motions = makeLibraryParam(motion_counts[m], 7, 10, joint_pool);
+      MotionLibrary::ReloadReport report_unused;
+      library.update(motions, report_unused);
+
+      const std::string cfg = config(motion_counts[m], 7, 10);
+      const JointNames no_joints;
+      report("list_motions", cfg + " all", measure(boost::bind(listRun, boost::cref(library), "", no_joints)));
+      report("list_motions", cfg + " prefix", measure(boost::bind(listRun, boost::cref(library), "arm_", no_joints)));
+      const JointNames arm_joints = makeJoints(joint_pool / 2);
+      report("list_motions", cfg + " joints", measure(boost::bind(listRun, boost::cref(library), "", arm_joints)));
+    }
+  }
+}
+
+int main(int argc, char** argv)
+{
+  for (int i = 1; i < argc; ++i)
+  {
+    if (std::strcmp(argv[i], "--quick") == 0)
+      options.quick = true;
+    else if (std::strcmp(argv[i], "--csv") == 0)
+      options.csv = true;
+    else if (std::strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+      options.filter = argv[++i];
+    else
+    {
+      std::fprintf(stderr, "Usage: %s [--quick] [--csv] [--filter <substring>]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  std::vector<std::size_t> joint_counts, point_counts, motion_counts;
+  joint_counts.push_back(2);
+  joint_counts.push_back(7);
+  joint_counts.push_back(60);
+  point_counts.push_back(100);
+  point_counts.push_back(10000);
+  motion_counts.push_back(10);
+  motion_counts.push_back(1000);
+  if (!options.quick)
+  {
+    point_counts.push_back(100000);
+    motion_counts.push_back(10000);
+  }
+
+  if (options.csv)
+    std::printf("benchmark,config,seconds\n");
+  benchParse(joint_counts, point_counts);
+  benchPopulateVelocities(joint_counts, point_counts);
+  benchSplit(joint_counts, point_counts);
+  benchCombine(joint_counts, point_counts);
+  benchIsAlreadyThere(motion_counts, joint_counts);
+  benchListMotions(motion_counts);
+  return 0;
+}
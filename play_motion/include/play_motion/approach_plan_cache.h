@@ -0,0 +1,118 @@
+/*
+ * Software License Agreement (Modified BSD License)
+ *
+ *  Copyright (c) 2013, PAL Robotics, S.L.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of PAL Robotics, S.L. nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef PLAY_MOTION_APPROACH_PLAN_CACHE_H
+#define PLAY_MOTION_APPROACH_PLAN_CACHE_H
+
+#include <list>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/thread/mutex.hpp>
+#include <trajectory_msgs/JointTrajectory.h>
+
+namespace play_motion
+{
+  /** Least recently used cache of approach trajectories.
+   * Plans are keyed on the planning group, and on the start and goal joint positions quantised to a given resolution,
+   * so that approaches starting from nearly the same state can be reused.
+   */
+  class ApproachPlanCache
+  {
+  public:
+    struct Stats
+    {
+      Stats() : hits(0), misses(0), rejected(0), size(0) {}
+      unsigned long hits;     ///< Lookups that found a plan
+      unsigned long misses;   ///< Lookups that found no plan
+      unsigned long rejected; ///< Plans found, but discarded by the caller (e.g. no longer valid)
+      std::size_t   size;     ///< Number of cached plans
+    };
+
+    /// \param capacity Maximum number of cached plans. Zero disables the cache.
+    /// \param resolution Joint position quantisation step, in radians (or meters).
+    ApproachPlanCache(std::size_t capacity, double resolution);
+
+    bool isEnabled() const { return capacity_ > 0; }
+
+    /// \brief Look up an approach plan.
+    /// \param[out] traj Cached plan, if found.
+    /// \return True if a plan was found.
+    bool get(const std::string&          group,
+             const std::vector<double>&  start,
+             const std::vector<double>&  goal,
+             trajectory_msgs::JointTrajectory& traj);
+
+    /// \brief Store an approach plan, evicting the least recently used one if the cache is full.
+    void put(const std::string&                      group,
+             const std::vector<double>&              start,
+             const std::vector<double>&              goal,
+             const trajectory_msgs::JointTrajectory& traj);
+
+    /// \brief Discard a plan returned by get().
+    void reject(const std::string&         group,
+                const std::vector<double>& start,
+                const std::vector<double>& goal);
+
+    Stats getStats() const;
+
+  private:
+    struct Key
+    {
+      std::string       group;
+      std::vector<long> start;
+      std::vector<long> goal;
+
+      bool operator<(const Key& other) const;
+    };
+    typedef std::pair<Key, trajectory_msgs::JointTrajectory> Entry;
+    typedef std::list<Entry>                                 Entries;
+    typedef std::map<Key, Entries::iterator>                 Index;
+
+    Key makeKey(const std::string& group, const std::vector<double>& start, const std::vector<double>& goal) const;
+    long quantise(double value) const;
+
+    std::size_t          capacity_;
+    double               resolution_;
+    Entries              entries_;  ///< Most recently used first
+    Index                index_;
+    Stats                stats_;
+    mutable boost::mutex mutex_;
+  };
+}
+
+#endif
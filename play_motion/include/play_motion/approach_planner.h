@@ -37,14 +37,19 @@
 #ifndef PLAY_MOTION_APPROACH_PLANNER_H
 #define PLAY_MOTION_APPROACH_PLANNER_H
 
+#include <atomic>
 #include <map>
 #include <vector>
 
 #include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
 
 #include <ros/message_forward.h>
+#include <ros/time.h>
 
+#include <play_motion/approach_plan_cache.h>
 #include <play_motion/datatypes.h>
+#include <play_motion/joint_limits.h>
 
 namespace ros
 {
@@ -74,6 +79,7 @@ namespace play_motion
   public:
 
     ApproachPlanner(const ros::NodeHandle& nh);
+    ~ApproachPlanner();
 
     /// TODO
     bool prependApproach(const std::vector<std::string>& joint_names,
@@ -82,10 +88,40 @@ namespace play_motion
                          const std::vector<TrajPoint>&   traj_in,
                                std::vector<TrajPoint>&   traj_out);
 
+    /// \brief Compute ahead of time the approach from a predicted state, instead of from the current one.
+    ///
+    /// Useful for planning the approach of a motion while the motion preceding it is still being played.
+    /// \param start_pos Predicted position of the motion joints when the motion will be played.
+    bool prepareApproach(const std::vector<std::string>& joint_names,
+                         const std::vector<double>&      start_pos,
+                         const std::vector<TrajPoint>&   traj_in,
+                               std::vector<TrajPoint>&   traj_out);
+
+    /// \return True if motion planning is disabled, in which case only goals skipping planning can be served.
+    bool isPlanningDisabled() const {return planning_disabled_;}
+
+    /// \return Hit and miss counters of the approach plan cache.
+    ApproachPlanCache::Stats getPlanCacheStats() const {return plan_cache_->getStats();}
+
     /// TODO
     bool needsApproach(const std::vector<double>& current_pos,
                        const std::vector<double>& goal_pos);
 
+    /// \brief Slow down the segments of a trajectory that exceed the joint velocity limits, if motion retiming is
+    /// enabled.
+    void retimeTrajectory(const std::vector<std::string>& joint_names, std::vector<TrajPoint>& traj) const;
+
+    /// \brief Combine a planned approach with the motion trajectory.
+    ///
+    /// Joints not in the approach plan are blended into the motion with quintic polynomials, which start at rest and
+    /// match the position and velocity of the first motion waypoint. If that waypoint has no velocities, it gets the
+    /// ones the approach ends with.
+    static void combineTrajectories(const std::vector<std::string>&   joint_names,
+                                    const std::vector<double>&        current_pos,
+                                    const std::vector<TrajPoint>&     traj_in,
+                                    trajectory_msgs::JointTrajectory& approach,
+                                    std::vector<TrajPoint>&           traj_out);
+
   private:
     typedef moveit::planning_interface::MoveGroupInterface MoveGroupInterface;
     typedef boost::shared_ptr<MoveGroupInterface> MoveGroupInterfacePtr;
@@ -96,37 +132,98 @@ namespace play_motion
 
     struct PlanningData
     {
-      PlanningData(MoveGroupInterfacePtr move_group_ptr);
+      PlanningData(MoveGroupInterfacePtr move_group_ptr, CallbackQueuePtr cb_queue, AsyncSpinnerPtr spinner);
       MoveGroupInterfacePtr move_group;
       JointNames   sorted_joint_names;
+      boost::shared_ptr<boost::mutex> mutex; ///< Serializes planning requests from different executor threads
+      CallbackQueuePtr cb_queue;             ///< Callbacks of the move group instance
+      AsyncSpinnerPtr  spinner;
+      CallbackQueuePtr plan_queue;           ///< Planning requests run in parallel to the ones of other groups
+      AsyncSpinnerPtr  plan_spinner;
     };
 
+    struct ParallelPlanning;
+    struct SceneMonitor;
+
     std::vector<PlanningData> planning_data_;
     std::vector<std::string> no_plan_joints_;
     double joint_tol_; ///< Absolute tolerance used to determine if two joint positions are approximately equal.
     double skip_planning_vel_; ///< Maximum average velocity that any joint can have in a non-planned approach.
     double skip_planning_min_dur_; ///< Minimum duration that a non-planned approach can have
-    CallbackQueuePtr cb_queue_;
-    AsyncSpinnerPtr spinner_;
+    bool use_joint_limits_; ///< Time non-planned approaches from the joint limits, instead of a single max velocity
+    bool retime_motions_;   ///< Slow down motion segments that exceed the joint velocity limits
+    JointLimitsMap joint_limits_;
     bool planning_disabled_;
+    bool parallel_planning_; ///< Plan with all eligible groups at once, instead of one after the other
+    double planning_time_;   ///< Time budget for computing an approach, zero for no limit
+    boost::shared_ptr<ApproachPlanCache> plan_cache_;
+    bool validate_cached_plans_; ///< Check cached plans against the current planning scene before reusing them
+    boost::shared_ptr<SceneMonitor> scene_monitor_; ///< Planning scene cached plans are checked against
+
+    /// \param plan_from_current Plan from the current robot state, or from \p start_pos otherwise.
+    bool prependApproach(const JointNames&             joint_names,
+                         const std::vector<double>&    start_pos,
+                         bool                          skip_planning,
+                         bool                          plan_from_current,
+                         const std::vector<TrajPoint>& traj_in,
+                               std::vector<TrajPoint>& traj_out);
 
     /// TODO
     bool computeApproach(const JointNames&                 joint_names,
                          const std::vector<double>&        current_pos,
                          const std::vector<double>&        goal_pos,
+                         bool                              plan_from_current,
                          trajectory_msgs::JointTrajectory& traj);
 
-    /// TODO
+    /// \brief Plan an approach with a single planning group.
+    /// \param start_values Start position of the joints, empty to start from the current robot state.
+    /// \param deadline Time by which planning must be done. Unlimited if zero.
+    /// \param cancelled If set once the move group is free, planning is skipped. Optional.
     bool planApproach(const JointNames&                 joint_names,
                       const std::vector<double>&        joint_values,
+                      const std::vector<double>&        start_values,
                       MoveGroupInterfacePtr             move_group,
-                      trajectory_msgs::JointTrajectory& traj);
-    /// TODO
-    void combineTrajectories(const JointNames&                  joint_names,
-                             const std::vector<double>&         current_pos,
-                             const std::vector<TrajPoint>&      traj_in,
-                             trajectory_msgs::JointTrajectory&  approach,
-                             std::vector<TrajPoint>&            traj_out);
+                      const ros::WallTime&              deadline,
+                      trajectory_msgs::JointTrajectory& traj,
+                      const std::atomic<bool>*          cancelled = 0);
+
+    /// \brief Plan an approach with all the given planning groups at once.
+    ///
+    /// The result of the first group in order of preference that succeeds is returned as soon as all the groups
+    /// preferred to it have failed. When the deadline is reached, the most preferred successful result is returned,
+    /// and the results of the planning requests still running are discarded.
+    /// \param deadline Time by which planning must be done. Unlimited if zero.
+    /// \param[out] move_group Group that computed the returned approach.
+    bool planApproachParallel(const JointNames&                         joint_names,
+                              const std::vector<double>&                joint_values,
+                              const std::vector<double>&                start_values,
+                              const std::vector<MoveGroupInterfacePtr>& move_groups,
+                              const ros::WallTime&                      deadline,
+                              MoveGroupInterfacePtr&                    move_group,
+                              trajectory_msgs::JointTrajectory&         traj);
+
+    /// Planning job run in the planning thread of a group, as part of a parallel planning request.
+    void planJob(const boost::shared_ptr<ParallelPlanning>& state,
+                 unsigned int                               index,
+                 const JointNames&                          joint_names,
+                 const std::vector<double>&                 joint_values,
+                 const std::vector<double>&                 start_values,
+                 MoveGroupInterfacePtr                      move_group,
+                 const ros::WallTime&                       deadline);
+
+    /// \return Planning data of a move group instance.
+    const PlanningData& getPlanningData(const MoveGroupInterfacePtr& move_group) const;
+    /// \brief Get a previously computed approach from the plan cache.
+    /// \return True if a valid plan was found. Its first waypoint is set to the current joint positions.
+    bool getCachedApproach(const JointNames&                 joint_names,
+                           const std::vector<double>&        current_pos,
+                           const std::vector<double>&        goal_pos,
+                           MoveGroupInterfacePtr             move_group,
+                           trajectory_msgs::JointTrajectory& traj);
+
+    /// \return True if the whole path of an approach is valid in the current planning scene, checked locally in a
+    ///         single pass. False if the planning scene is not available.
+    bool isApproachValid(const std::string& group_name, const trajectory_msgs::JointTrajectory& traj);
 
     /// TODO
     std::vector<MoveGroupInterfacePtr> getValidMoveGroups(const JointNames& min_group,
@@ -135,6 +232,18 @@ namespace play_motion
     /// TODO
     bool isPlanningJoint(const std::string& joint_name) const;
 
+    /// \brief Prepend a non-planned approach to a trajectory whose first waypoint has zero time from start.
+    /// \param min_reach_time Approaches not longer than this are not prepended.
+    void prependUnplannedApproach(const JointNames&          joint_names,
+                                  const std::vector<double>& current_pos,
+                                  double                     min_reach_time,
+                                  std::vector<TrajPoint>&    traj);
+
+    /// \return Limits of the given joints.
+    /// \param approach_fallback Give joints without velocity limits the non-planned approach velocity, for timing
+    ///        approaches. Otherwise they are left unconstrained.
+    std::vector<JointLimits> getJointLimits(const JointNames& joint_names, bool approach_fallback) const;
+
     /// TODO
     double noPlanningReachTime(const std::vector<double>& curr_pos,
                                const std::vector<double>& goal_pos);
@@ -39,18 +39,27 @@
 
 #include <string>
 #include <map>
+#include <set>
 #include <boost/function.hpp>
 #include <boost/thread.hpp>
+#include <boost/thread/condition_variable.hpp>
 #include <ros/ros.h>
 #include <ros/timer.h>
 
 #include "play_motion/datatypes.h"
 
+namespace std_msgs
+{ ROS_DECLARE_MESSAGE(Empty); }
+
 namespace play_motion
 {
 
   /** Keeps track of controller statuses by polling the controller manager.
  * The service call happens in a separate thread to not disrupt the main code.
+ * Besides periodic polling, updates can be requested on demand (e.g. right after a controller switch), either
+ * through requestUpdate() and update(), or by publishing to the \c ~refresh_controllers topic.
+ * The controllers can be restricted to a whitelist, or to the ones whose name starts with a given namespace, so that
+ * several play_motion instances can share the controllers of a robot.
  */
   class ControllerUpdater
   {
@@ -72,17 +81,45 @@ namespace play_motion
     ControllerUpdater(ros::NodeHandle nh);
     virtual ~ControllerUpdater();
 
-    void registerUpdateCb(const Callback& cb) { update_cb_ = cb; }
+    /// \brief Register the callback to call when the controllers change.
+    /// \note The callback is called from the update thread.
+    void registerUpdateCb(const Callback& cb);
+
+    /// \brief Request an update of the controller list, without waiting for it.
+    void requestUpdate();
+
+    /// \brief Update the controller list, and wait until the update callback (if any) has been called.
+    /// \param timeout Maximum time to wait for the update.
+    /// \return False if the update timed out, or if the controller list could not be fetched.
+    bool update(const ros::WallDuration& timeout);
 
   private:
     void mainLoop();
+    bool fetchControllers();
+    void refreshCb(const std_msgs::EmptyConstPtr& msg);
+
+    /// \return True if the named controller passes the whitelist and the namespace filter.
+    bool isManaged(const std::string& controller_name) const;
 
     ros::NodeHandle    nh_;
-    ros::Timer         update_timer_;
-    boost::thread      main_thread_;
     Callback           update_cb_;
     ros::ServiceClient cm_client_;
+    ros::Subscriber    refresh_sub_;
     ControllerStates   last_cstates_;
+    ControllerJoints   last_cjoints_;
+
+    ros::WallDuration  poll_period_;      ///< Time between updates when the controller manager is reachable
+    ros::WallDuration  max_retry_period_; ///< Upper bound of the time between retries when it's not
+    std::set<std::string> whitelist_;     ///< Controllers to manage, all if empty
+    std::string        namespace_;        ///< Prefix of the names of the controllers to manage, all if empty
+
+    boost::mutex              mutex_;     ///< Protects the update callback, requests and stop flag
+    boost::condition_variable cond_;
+    unsigned int              requested_updates_;
+    unsigned int              served_updates_;
+    bool                      last_update_ok_;
+    bool                      stop_;
+    boost::thread             main_thread_;
   };
 
 }
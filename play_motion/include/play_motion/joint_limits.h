@@ -0,0 +1,107 @@
+/*
+ * Software License Agreement (Modified BSD License)
+ *
+ *  Copyright (c) 2013, PAL Robotics, S.L.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of PAL Robotics, S.L. nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PLAY_MOTION_JOINT_LIMITS_H
+#define PLAY_MOTION_JOINT_LIMITS_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "play_motion/datatypes.h"
+
+namespace ros
+{
+  class NodeHandle;
+}
+
+namespace play_motion
+{
+  /// Kinematic limits of a joint.
+  struct JointLimits
+  {
+    JointLimits()
+      : has_velocity_limits(false), max_velocity(0.0), has_acceleration_limits(false), max_acceleration(0.0) {}
+
+    bool   has_velocity_limits;
+    double max_velocity;
+    bool   has_acceleration_limits;
+    double max_acceleration;
+  };
+  typedef std::map<std::string, JointLimits> JointLimitsMap;
+
+  /// \brief Read the velocity limits of the joints in a URDF robot description.
+  /// URDF does not specify acceleration limits.
+  /// \return False if the robot description could not be parsed.
+  bool getJointLimitsFromUrdf(const std::string& urdf_xml, JointLimitsMap& limits);
+
+  /// \brief Read joint limits from the parameter server, overriding the ones already in \p limits.
+  ///
+  /// Parameters follow the layout of MoveIt's \c joint_limits.yaml, i.e. \c <joint>/has_velocity_limits,
+  /// \c <joint>/max_velocity, \c <joint>/has_acceleration_limits and \c <joint>/max_acceleration.
+  /// \param nh Namespace containing the limits of each joint.
+  void getJointLimitsFromParams(const ros::NodeHandle& nh, JointLimitsMap& limits);
+
+  /// \brief Compute the minimum time, rest to rest approach from a start to a goal position.
+  ///
+  /// Joints move along a straight line in joint space, so they all reach the goal at the same time. The motion
+  /// follows a trapezoidal velocity profile, with the joint closest to its limits dictating its shape.
+  /// Without acceleration limits, the approach consists of a single cubic segment, which is how the trajectory
+  /// controllers interpolate a waypoint reached from rest.
+  /// \param limits Limits of each joint. Joints without limits don't constrain the approach.
+  /// \param min_duration Minimum duration of the approach. Shorter approaches are slowed down.
+  /// \param[out] points Intermediate approach waypoints, i.e. the end of the acceleration phase and the start of the
+  ///                    deceleration phase. The goal is not included. Times are relative to the approach start.
+  /// \return Duration of the approach.
+  double getMinTimeApproach(const std::vector<double>&      start,
+                            const std::vector<double>&      goal,
+                            const std::vector<JointLimits>& limits,
+                            double                          min_duration,
+                            std::vector<TrajPoint>&         points);
+
+  /// \brief Slow down the segments of a trajectory in which some joint would exceed its velocity limit.
+  ///
+  /// Segments are stretched so that the average velocity of each joint stays within its limit, and later waypoints
+  /// are delayed accordingly. Segments within limits keep their timing. Specified waypoint velocities are clamped to
+  /// the limits. The segment leading to the first waypoint is left to the approach computation.
+  void enforceVelocityLimits(const std::vector<JointLimits>& limits, Trajectory& traj);
+
+  /// \brief Scale the duration of a trajectory, e.g. 2.0 plays it twice as slow.
+  ///
+  /// Times from start are multiplied by \p scale, velocities divided by it and accelerations divided by its square,
+  /// in a single pass over the trajectory.
+  void scaleTrajectory(double scale, Trajectory& traj);
+}
+
+#endif
@@ -0,0 +1,118 @@
+/*
+ * Software License Agreement (Modified BSD License)
+ *
+ *  Copyright (c) 2013, PAL Robotics, S.L.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of PAL Robotics, S.L. nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef PLAY_MOTION_JOINT_STATE_BUFFER_H
+#define PLAY_MOTION_JOINT_STATE_BUFFER_H
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <ros/ros.h>
+
+#include "play_motion/datatypes.h"
+
+namespace sensor_msgs
+{ ROS_DECLARE_MESSAGE(JointState); }
+
+namespace play_motion
+{
+  /** Latest joint state, readable from any thread without locking or allocating.
+   * Joint names are resolved to indices only when the joint layout of the joint state messages changes, and readers
+   * fetch the joints they are interested in by index. Updates are published through a sequence lock, so readers
+   * always get a consistent snapshot of the positions and velocities of a single message.
+   */
+  class JointStateBuffer
+  {
+  private:
+    struct Layout;
+    typedef boost::shared_ptr<Layout> LayoutPtr;
+
+  public:
+    /** Set of joints to read from the buffer.
+     * The indices of the joints are resolved on the first read, and again only if the joint layout changes.
+     * \note A selection must not be used from several threads at once.
+     */
+    class Selection
+    {
+    public:
+      Selection() {}
+      Selection(const JointNames& joints) : joints_(joints) {}
+
+      const JointNames& getJointNames() const { return joints_; }
+
+    private:
+      friend class JointStateBuffer;
+
+      JointNames               joints_;
+      LayoutPtr                layout_;  ///< Layout the indices were resolved against
+      std::vector<std::size_t> indices_; ///< Index of each joint in the layout, npos if not present
+    };
+
+    JointStateBuffer();
+
+    /// \brief Store a new joint state.
+    /// \note Updates must be done from a single thread.
+    void update(const sensor_msgs::JointState& msg);
+
+    /// \brief Read the latest state of a set of joints.
+    /// \param selection Joints to read.
+    /// \param[out] positions Joint positions, in the order of the selection.
+    /// \param[out] velocities Joint velocities, in the order of the selection. Zero if the joint state messages don't
+    ///             contain velocities.
+    /// \return False if the state of some of the joints is unknown, in which case the outputs are left unspecified.
+    bool read(Selection& selection, std::vector<double>& positions, std::vector<double>& velocities) const;
+
+    /// \overload
+    bool read(Selection& selection, std::vector<double>& positions) const;
+
+    /// \brief Read the latest positions of a set of joints, some of which may be unknown.
+    /// \param selection Joints to read.
+    /// \param[out] positions Joint positions, in the order of the selection. NaN for joints whose state is unknown.
+    void readAvailable(Selection& selection, std::vector<double>& positions) const;
+
+  private:
+    bool read(Selection& selection, std::vector<double>& positions, std::vector<double>* velocities,
+              bool allow_missing) const;
+    LayoutPtr getLayout() const;
+
+    LayoutPtr            layout_;       ///< Current layout, whose values are updated with every message
+    mutable boost::mutex layout_mutex_; ///< Protects the layout_ pointer, which only changes with the joint names
+  };
+}
+
+#endif
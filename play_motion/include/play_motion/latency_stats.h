@@ -0,0 +1,127 @@
+/*
+ * Software License Agreement (Modified BSD License)
+ *
+ *  Copyright (c) 2013, PAL Robotics, S.L.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of PAL Robotics, S.L. nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PLAY_MOTION_LATENCY_STATS_H
+#define PLAY_MOTION_LATENCY_STATS_H
+
+#include <cstddef>
+#include <vector>
+
+#include <boost/thread/mutex.hpp>
+#include <ros/time.h>
+
+namespace play_motion
+{
+  /** Rolling statistics of the time goals spend in each stage of their processing.
+   * Only the latest goals are kept, so that percentiles reflect the recent behavior.
+   */
+  class LatencyStats
+  {
+  public:
+    /// Goal processing stages, in order.
+    enum Stage
+    {
+      MOTION_FETCH,          ///< Getting the motion from the library, or building the sequence
+      CONTROLLER_LOOKUP,     ///< Mapping the motion joints to controllers and reserving them
+      QUEUED,                ///< Waiting for an executor thread
+      APPROACH_PLANNING,     ///< Reading the joint states and computing the approach
+      TRAJECTORY_PROCESSING, ///< Validation, resampling and velocity population
+      GOAL_SPLIT,            ///< Extracting the trajectory of each controller
+      GOAL_SEND,             ///< Sending the trajectories to the controller action servers
+      NUM_STAGES
+    };
+
+    /// Time spent by a goal in each stage, in seconds.
+    struct Timing
+    {
+      Timing() : durations(NUM_STAGES, 0.0) {}
+      double getTotal() const;
+      std::vector<double> durations;
+    };
+
+    /// Measures the time spent in consecutive stages.
+    class StageTimer
+    {
+    public:
+      StageTimer(Timing& timing, const ros::WallTime& start = ros::WallTime::now())
+        : timing_(timing), stage_start_(start) {}
+
+      /// \brief Add the time elapsed since the end of the previous stage to \p stage.
+      void stop(Stage stage)
+      {
+        const ros::WallTime now = ros::WallTime::now();
+        timing_.durations[stage] += (now - stage_start_).toSec();
+        stage_start_ = now;
+      }
+
+      /// \brief Time at which the last stage ended.
+      const ros::WallTime& getTime() const {return stage_start_;}
+
+    private:
+      Timing&       timing_;
+      ros::WallTime stage_start_;
+    };
+
+    struct Percentiles
+    {
+      Percentiles() : p50(0.0), p95(0.0), p99(0.0) {}
+      double p50;
+      double p95;
+      double p99;
+    };
+
+    /// \param window_size Number of latest goals the percentiles are computed from.
+    explicit LatencyStats(std::size_t window_size = 200);
+
+    static const char* getStageName(Stage stage);
+
+    void add(const Timing& timing);
+
+    /// \return Number of goals added so far.
+    std::size_t getCount() const;
+
+    /// \param[out] stages Percentiles of the time spent in each stage, in seconds.
+    /// \param[out] total Percentiles of the total time, in seconds.
+    /// \return False if no goals were added yet.
+    bool getPercentiles(std::vector<Percentiles>& stages, Percentiles& total) const;
+
+  private:
+    mutable boost::mutex mutex_;
+    std::size_t          window_size_;
+    std::size_t          count_;
+    std::vector<Timing>  samples_;     ///< Ring buffer of the latest goals
+  };
+}
+
+#endif
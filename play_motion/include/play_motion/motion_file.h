@@ -0,0 +1,116 @@
+/*
+ * Software License Agreement (Modified BSD License)
+ *
+ *  Copyright (c) 2013, PAL Robotics, S.L.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of PAL Robotics, S.L. nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PLAY_MOTION_MOTION_FILE_H
+#define PLAY_MOTION_MOTION_FILE_H
+
+#include <string>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <ros/duration.h>
+
+#include "play_motion/datatypes.h"
+#include "play_motion/play_motion_helpers.h"
+
+namespace play_motion
+{
+  /** Read-only motion library stored in a binary file.
+   * The file is memory mapped, and only its index (motion names, meta information, joints and durations) is parsed
+   * when it is opened. The waypoints of a motion are read from the mapped memory when the motion is requested.
+   *
+   * File layout, with all values little endian:
+   * - Header: 8 byte magic \c "PMLIB001", \c uint32 number of motions, \c uint32 reserved.
+   * - One index record per motion: identifier, name, usage, description, \c uint32 number of joints, joint names,
+   *   \c uint32 number of waypoints, \c uint32 flags, \c float64 duration, \c uint64 offset of the waypoints block.
+   *   Strings are stored as a \c uint32 length followed by their bytes.
+   * - Waypoint blocks, 8 byte aligned. Each waypoint is stored as its \c float64 time from start, positions, and
+   *   then velocities and accelerations, if the motion flags contain \c HAS_VELOCITIES and \c HAS_ACCELERATIONS
+   *   respectively. NaN velocities (accelerations) mark waypoints without velocities (accelerations).
+   *
+   * Files are written by the \c convert_poses.py script. An open file must be replaced by a new one, never modified in
+   * place: reading a mapped file that was truncated under it kills the process with \c SIGBUS, which can't be handled
+   * as an error.
+   */
+  class MotionFile : private boost::noncopyable
+  {
+  public:
+    enum Flags
+    {
+      HAS_VELOCITIES    = 1,
+      HAS_ACCELERATIONS = 2
+    };
+
+    /// Index record of a motion.
+    struct Record
+    {
+      std::string   id;
+      std::string   name;
+      std::string   usage;
+      std::string   description;
+      JointNames    joints;
+      unsigned int  num_points;
+      unsigned int  flags;
+      ros::Duration duration;
+      std::size_t   offset;     ///< Offset of the waypoints block in the file
+    };
+
+    /// \brief Map a motion file and read its index.
+    /// \throws ros::Exception if the file cannot be mapped, or if it is not a valid motion file. Other errors, like
+    ///         running out of memory, are let through as std::exception.
+    explicit MotionFile(const std::string& path);
+    ~MotionFile();
+
+    const std::string& getPath() const {return path_;}
+
+    /// \return Index records of all motions in the file, in file order.
+    const std::vector<Record>& getRecords() const {return records_;}
+
+    /// \brief Read a motion from the file.
+    /// \param record Position of the motion in getRecords().
+    /// \throws ros::Exception if the waypoints are corrupt.
+    void getMotion(std::size_t record, MotionInfo& motion) const;
+
+  private:
+    std::string         path_;
+    const char*         data_;
+    std::size_t         size_;
+    std::vector<Record> records_;
+  };
+
+  typedef boost::shared_ptr<const MotionFile> MotionFileConstPtr;
+}
+
+#endif
@@ -0,0 +1,173 @@
+/*
+ * Software License Agreement (Modified BSD License)
+ *
+ *  Copyright (c) 2013, PAL Robotics, S.L.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of PAL Robotics, S.L. nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PLAY_MOTION_MOTION_LIBRARY_H
+#define PLAY_MOTION_MOTION_LIBRARY_H
+
+#include <map>
+#include <string>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <ros/ros.h>
+
+#include "play_motion/datatypes.h"
+#include "play_motion/motion_file.h"
+#include "play_motion/play_motion_helpers.h"
+
+namespace play_motion
+{
+  typedef boost::shared_ptr<const MotionInfo> MotionInfoConstPtr;
+
+  /** In-memory store of the motions specified in the parameter server.
+   * Motions are fetched, parsed and validated once, so that goal requests don't need to go through the parameter
+   * server. The library can be reloaded at runtime: only motions whose definition changed are parsed again, and the
+   * new library contents are swapped in atomically, so motions handed out before a reload remain valid.
+   * Motions can also be served from a binary motion file, which is mapped when the library is loaded, and whose
+   * motions are only read when they are first requested. Motions in the parameter server take precedence over
+   * motions with the same identifier in the file.
+   */
+  class MotionLibrary
+  {
+  public:
+    /// Motions affected by a reload.
+    struct ReloadReport
+    {
+      MotionNames added;
+      MotionNames changed;
+      MotionNames removed;
+    };
+
+    /// Motion properties, precomputed when the motion is loaded.
+    struct MotionSummary
+    {
+      std::string   id;
+      JointNames    joints;
+      ros::Duration duration;
+    };
+
+    /// \param nh Nodehandle with the namespace containing the motions
+    MotionLibrary(const ros::NodeHandle& nh);
+
+    /// \brief Library not backed by the parameter server, whose motions are only set with update().
+    MotionLibrary();
+    virtual ~MotionLibrary();
+
+    /// \brief Fetch all motions from the parameter server, replacing the current library contents.
+    ///
+    /// The motion file in the \c motion_library/file parameter, if any, is also mapped.
+    void load();
+
+    /// \brief Fetch all motions from the parameter server, and update the ones that changed.
+    /// \param[out] report Motions that were added, changed or removed.
+    /// \return False if the motions could not be fetched, in which case the library is left untouched.
+    bool reload(ReloadReport& report);
+
+    /// \brief Update the library from already fetched motions, like reload() does with the parameter server ones.
+    /// \param motions Motions, with the layout of the \c motions parameter. If it is not a struct, only the motions of
+    ///                the motion file are kept.
+    /// \param[out] report Motions that were added, changed or removed.
+    void update(XmlRpc::XmlRpcValue& motions, ReloadReport& report);
+
+    /// \brief Periodically reload the motions in a background thread.
+    /// \param period Time between reloads.
+    void startWatching(const ros::WallDuration& period);
+
+    /// \brief Get a motion by its identifier.
+    ///
+    /// Motions not present in the library (e.g. loaded in the parameter server after startup) are fetched on demand.
+    /// \throws PMException with \c MOTION_NOT_FOUND if the motion does not exist or cannot be parsed, and with
+    ///         \c OTHER_ERROR if the motion is malformed.
+    MotionInfoConstPtr getMotion(const std::string& motion_id);
+
+    /// \brief Get the identifiers of all valid motions in the library.
+    void getMotionIds(MotionNames& motion_ids) const;
+
+    /// \brief Get the summaries of the valid motions in the library matching some criteria.
+    /// \param name_prefix Only motions whose identifier starts with this prefix are returned. Ignored if empty.
+    /// \param joints Only motions whose joints are a subset of these are returned. Ignored if empty.
+    /// \param[out] motions Summaries of the matching motions, sorted by identifier.
+    void getMotionSummaries(const std::string& name_prefix, const JointNames& joints,
+                            std::vector<MotionSummary>& motions) const;
+
+  private:
+    /// Motion of the motion file, read on first use.
+    struct FileMotion
+    {
+      FileMotion(const MotionFileConstPtr& motion_file, std::size_t motion_record)
+        : file(motion_file), record(motion_record), loaded(false), error_code(0)
+      {}
+      MotionFileConstPtr file;
+      std::size_t        record;     ///< Position of the motion in the file records
+      boost::mutex       mutex;      ///< Protects the members below
+      bool               loaded;
+      MotionInfoConstPtr motion;     ///< Null if the motion is not valid
+      int                error_code;
+      std::string        error;
+    };
+
+    struct Entry
+    {
+      Entry() : error_code(0), fingerprint(0) {}
+      bool isValid() const {return motion || file_motion;}
+      MotionInfoConstPtr motion;      ///< Parsed motion, null if the motion could not be parsed or validated
+      int                error_code;  ///< Goal result error code to report if the motion is not valid
+      std::string        error;       ///< Reason why the motion is not valid
+      std::size_t        fingerprint; ///< Hash of the motion joints, points and meta information
+      MotionSummary      summary;
+      JointNames         sorted_joints;
+      boost::shared_ptr<FileMotion> file_motion; ///< Set for motions of the motion file, which are read lazily
+    };
+    typedef std::map<std::string, Entry>     Entries;
+    typedef boost::shared_ptr<const Entries> EntriesConstPtr;
+
+    EntriesConstPtr getEntries() const;
+    void setEntries(const EntriesConstPtr& entries);
+    static Entry parseEntry(const std::string& motion_id, XmlRpc::XmlRpcValue& param);
+    static Entry makeFileEntry(const MotionFileConstPtr& file, std::size_t record);
+    static MotionInfoConstPtr readFileMotion(FileMotion& file_motion);
+    /// \note Must be called with update_mutex_ held.
+    void updateEntries(XmlRpc::XmlRpcValue& motions, ReloadReport& report);
+    void watchLoop(const ros::WallDuration& period);
+
+    boost::shared_ptr<ros::NodeHandle> nh_; ///< Null if the library is not backed by the parameter server
+    EntriesConstPtr      entries_;        ///< Current library contents. Never modified, only replaced
+    mutable boost::mutex entries_mutex_;  ///< Protects the entries_ pointer
+    boost::mutex         update_mutex_;   ///< Serializes library updates
+    MotionFileConstPtr   file_;           ///< Motion file, null if none
+    boost::thread        watch_thread_;
+  };
+}
+
+#endif
@@ -43,6 +43,7 @@
 #include <ros/ros.h>
 #include <ros/time.h>
 #include <actionlib/client/simple_action_client.h>
+#include <boost/thread/mutex.hpp>
 #include <control_msgs/FollowJointTrajectoryAction.h>
 
 #include "play_motion/datatypes.h"
@@ -60,6 +61,8 @@ namespace play_motion
     typedef control_msgs::FollowJointTrajectoryGoal   ActionGoal;
     typedef control_msgs::FollowJointTrajectoryResult ActionResult;
     typedef boost::shared_ptr<const ActionResult>     ActionResultPtr;
+    typedef control_msgs::FollowJointTrajectoryFeedback ActionFeedback;
+    typedef boost::shared_ptr<const ActionFeedback>     ActionFeedbackPtr;
     typedef boost::function<void(int)>                Callback;
 
   public:
@@ -68,8 +71,28 @@ namespace play_motion
     /**
      * \brief Send a trajectory goal to the associated controller.
      * \param traj The trajectory to send
+     * \param cb Callback to call when the goal finishes. Results of previously sent goals are not reported to it.
      */
-    bool sendGoal(const std::vector<TrajPoint>& traj);
+    bool sendGoal(const std::vector<TrajPoint>& traj, const Callback& cb);
+
+    /**
+     * \brief Send a trajectory goal to the associated controller, without copying the trajectory.
+     * \param traj The trajectory to send, with a position per controller joint. Its contents are moved into the goal,
+     *             so it is left empty. Joint names are set by this method. Its header stamp sets when the
+     *             trajectory starts, as soon as the controller gets it if zero.
+     * \param cb Callback to call when the goal finishes. Results of previously sent goals are not reported to it.
+     */
+    bool sendGoal(trajectory_msgs::JointTrajectory& traj, const Callback& cb);
+
+    /**
+     * \brief Stream long trajectories to the controller in windows of waypoints, instead of in a single goal.
+     *
+     * The first window is sent right away, and later ones are sent ahead of the execution of the previous window,
+     * relying on the trajectory replacement of the controller. All windows share the same start time.
+     * \param window_size Max number of waypoints to send at once, zero to send whole trajectories.
+     * \param lead_time Time before the last waypoint of a window is reached at which the next window is sent.
+     */
+    void setStreaming(std::size_t window_size, const ros::Duration& lead_time);
 
     /**
      * \brief Returns true if the specified joint is controlled by the controller.
@@ -78,16 +101,33 @@ namespace play_motion
     bool isControllingJoint(const std::string& joint_name);
 
     /**
-     * \brief Returns true if the MoveJointGroup is ready to accept a new goal.
-     * \note This is independent from the state of the controller, but if the
-     *       controller cannot be reached, isIdle() will always return false.
+     * \brief Returns true if the controller action server is reachable.
      */
-    bool isIdle() const;
+    bool isConnected() const;
+
+    /**
+     * \brief Returns the largest absolute position error of the controller joints, in the latest feedback of the
+     * controller for the current goal. Zero if no feedback was received yet.
+     */
+    double getTrackingError() const;
 
     /**
      * \brief Cancel the current goal
      */
     void cancel();
+
+    /**
+     * \brief Cancel a goal sent with sendGoal(), including the windows left to stream, unless it was replaced by a
+     * newer goal.
+     * \param goal_id Identifier of the goal, see getGoalId().
+     */
+    void cancel(unsigned int goal_id);
+
+    /**
+     * \brief Returns the identifier of the last goal sent with sendGoal(). Streamed windows belong to the goal they
+     * were streamed for.
+     */
+    unsigned int getGoalId() const;
     
     /**
      * \brief Cancel the current goal, stop tracking it and call the callback
@@ -95,12 +135,6 @@ namespace play_motion
      */
     void abort();
 
-    /**
-     * \brief Register the callback to be called when the action is finished.
-     * \param cb The callback
-     */
-    void setCallback(const Callback& cb);
-
     /**
      * \brief Returns the list of associated joints
      */
@@ -117,15 +151,49 @@ namespace play_motion
     const std::string& getName() const;
 
   private:
-    void alCallback();
+    void alCallback(unsigned int goal_seq);
+
+    /// Keep the tracking error of the controller feedback, if \p goal_seq is still the current goal.
+    void feedbackCb(unsigned int goal_seq, const ActionFeedbackPtr& feedback);
+
+    /// Send the next window of the trajectory being streamed, if \p goal_seq is still the current goal.
+    void streamCb(unsigned int goal_seq);
+
+    /// \brief Get the waypoints to send next: those not executed yet, up to the end of the next window.
+    /// \note Must be called with mutex_ held.
+    void getNextWindow(trajectory_msgs::JointTrajectory& window);
+
+    /// \brief Schedule sending the next window of the trajectory being streamed, if any.
+    /// \note Must be called with mutex_ held.
+    void scheduleNextWindow(unsigned int goal_seq);
+
+    /// Send a goal already checked by sendGoal(). \p stream_timer is set to the timer of the previous goal streaming.
+    void sendValidGoal(trajectory_msgs::JointTrajectory& traj, const Callback& cb, ros::Timer& stream_timer);
+
+    /// \brief Stop streaming the current trajectory.
+    /// \return The timer of the next window, to be stopped by the caller once mutex_ and send_mutex_ are released,
+    ///         as stopping it waits for a running streamCb(), which takes them.
+    /// \note Must be called with mutex_ held.
+    ros::Timer stopStreaming();
 
-    bool            busy_;
+    mutable boost::mutex mutex_;       ///< Protects active_cb_, goal_seq_, goal_id_ and the streaming state.
+    boost::mutex    send_mutex_;       ///< Serializes sending goals, so that streamed windows never replace newer goals
+    unsigned int    goal_seq_;         ///< Incremented on every goal sent, to discard results of replaced goals
+    unsigned int    goal_id_;          ///< Incremented on every sendGoal() call, unlike goal_seq_ for windows
     ros::NodeHandle nh_;               ///< Default node handle.
     std::string     controller_name_;  ///< Controller name. XXX: is this needed?
     JointNames      joint_names_;      ///< Names of controller joints.
     ActionClient    client_;           ///< Action client used to trigger motions.
     Callback        active_cb_;        ///< Call this when we are called back from the controller
     ros::Timer      configure_timer_;  ///< To periodically check for controller actionlib server
+    double          tracking_error_;   ///< Latest max position error of the current goal, protected by mutex_
+
+    std::size_t           window_size_;   ///< Max waypoints per streamed goal, zero to disable streaming
+    ros::Duration         lead_time_;     ///< Time ahead of the end of a window at which the next one is sent
+    std::vector<TrajPoint> stream_points_; ///< Trajectory being streamed, empty if none
+    std::size_t           stream_end_;    ///< Index past the last waypoint sent to the controller
+    ros::Time             stream_start_;  ///< Start time shared by all the windows
+    ros::Timer            stream_timer_;  ///< Fires when the next window has to be sent
   };
 }
 
@@ -0,0 +1,133 @@
+/*
+ * Software License Agreement (Modified BSD License)
+ *
+ *  Copyright (c) 2013, PAL Robotics, S.L.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of PAL Robotics, S.L. nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PLAY_MOTION_PACKED_TRAJECTORY_H
+#define PLAY_MOTION_PACKED_TRAJECTORY_H
+
+#include <vector>
+
+#include <ros/duration.h>
+#include <trajectory_msgs/JointTrajectory.h>
+
+#include "play_motion/datatypes.h"
+
+namespace play_motion
+{
+  /** Structure of arrays trajectory representation.
+   * The values of all waypoints are stored in contiguous buffers, one per kind of value, so copying a trajectory or
+   * splitting it by controller does not require allocations per waypoint. Waypoints may or may not have velocities
+   * and accelerations, missing values are stored as zeros.
+   */
+  class PackedTrajectory
+  {
+  public:
+    PackedTrajectory();
+
+    /// \param traj Trajectory to pack. All its waypoints must have the same number of positions.
+    explicit PackedTrajectory(const Trajectory& traj);
+
+    /// \brief Replace the contents with those of \p traj.
+    void pack(const Trajectory& traj);
+
+    /// \brief Convert back to a vector of waypoints.
+    void unpack(Trajectory& traj) const;
+
+    /// \brief Convert back a single waypoint.
+    void getPoint(std::size_t point, TrajPoint& traj_point) const;
+
+    std::size_t size() const {return times_.size();}
+    bool empty() const {return times_.empty();}
+    std::size_t getNumJoints() const {return num_joints_;}
+
+    const ros::Duration& getTime(std::size_t point) const {return times_[point];}
+    const double* getPositions(std::size_t point) const {return &positions_[point * num_joints_];}
+
+    /// \return Velocities of a waypoint, null if it has none.
+    const double* getVelocities(std::size_t point) const
+    {return has_velocities_[point] ? &velocities_[point * num_joints_] : 0;}
+
+    /// \return Accelerations of a waypoint, null if it has none.
+    const double* getAccelerations(std::size_t point) const
+    {return has_accelerations_[point] ? &accelerations_[point * num_joints_] : 0;}
+
+    /**
+     * \brief Extract the trajectory of a set of joints, as a message ready to be sent to a controller.
+     * \param indices Index of each output joint in the trajectory, -1 for joints not in it.
+     * \param hold_positions Position of each output joint not in the trajectory, which is held during the whole
+     *                       trajectory with zero velocity and acceleration.
+     * \param[out] traj Output trajectory. Its joint names are not set.
+     */
+    void extract(const std::vector<int>&           indices,
+                 const std::vector<double>&        hold_positions,
+                 trajectory_msgs::JointTrajectory& traj) const;
+
+    /**
+     * \brief Append the trajectory of a set of joints to a message, delayed by a time offset.
+     * \param time_offset Added to the time from start of every appended waypoint.
+     * \sa extract()
+     */
+    void append(const std::vector<int>&           indices,
+                const std::vector<double>&        hold_positions,
+                const ros::Duration&              time_offset,
+                trajectory_msgs::JointTrajectory& traj) const;
+
+  private:
+    /// \brief Write the trajectory of a set of joints to a message, starting at its waypoint \p first.
+    void write(const std::vector<int>&           indices,
+               const std::vector<double>&        hold_positions,
+               const ros::Duration&              time_offset,
+               std::size_t                       first,
+               trajectory_msgs::JointTrajectory& traj) const;
+
+    std::size_t                 num_joints_;
+    std::vector<ros::Duration>  times_;
+    std::vector<double>         positions_;         ///< Waypoint major, num_joints_ values per waypoint
+    std::vector<double>         velocities_;
+    std::vector<double>         accelerations_;
+    std::vector<unsigned char>  has_velocities_;    ///< Per waypoint
+    std::vector<unsigned char>  has_accelerations_;
+  };
+
+  /**
+   * \brief Extract the trajectory of a set of joints straight from a vector of waypoints, without packing it first.
+   * \param traj_in Trajectory whose waypoints all have the same number of positions.
+   * \sa PackedTrajectory::extract()
+   */
+  void extractJoints(const Trajectory&                 traj_in,
+                     const std::vector<int>&           indices,
+                     const std::vector<double>&        hold_positions,
+                     trajectory_msgs::JointTrajectory& traj);
+}
+
+#endif
@@ -38,25 +38,40 @@
 #ifndef REACHPOSE_H
 #define REACHPOSE_H
 
+#include <atomic>
 #include <string>
 #include <list>
 #include <map>
+#include <set>
 #include <ros/ros.h>
 #include <boost/foreach.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/weak_ptr.hpp>
+#include <trajectory_msgs/JointTrajectory.h>
 
 #include "play_motion/datatypes.h"
 #include "play_motion/controller_updater.h"
+#include "play_motion/joint_state_buffer.h"
+#include "play_motion/latency_stats.h"
+#include "play_motion/motion_library.h"
 #include "play_motion_msgs/PlayMotionResult.h"
 
 namespace sensor_msgs
 { ROS_DECLARE_MESSAGE(JointState); }
 
+namespace std_msgs
+{ ROS_DECLARE_MESSAGE(Float64); }
+
+namespace trajectory_msgs
+{ ROS_DECLARE_MESSAGE(JointTrajectory); }
+
 namespace play_motion
 {
   typedef play_motion_msgs::PlayMotionResult PMR;
 
   class MoveJointGroup;
   class ApproachPlanner;
+  class PackedTrajectory;
 
   class PMException : public ros::Exception
   {
@@ -84,6 +99,79 @@ namespace play_motion
     typedef boost::shared_ptr<MoveJointGroup>        MoveJointGroupPtr;
     typedef std::list<MoveJointGroupPtr>             ControllerList;
     typedef boost::function<void(const GoalHandle&)> Callback;
+    typedef std::map<std::string, boost::weak_ptr<Goal> > Reservations;
+
+    /// Controllers spanning the joints of a motion, and how the motion joints map to the controller joints.
+    struct MotionControllers
+    {
+      struct Group
+      {
+        MoveJointGroupPtr ctrl;
+        bool              connected;      ///< Whether the controller was reachable when the entry was computed
+        std::vector<int>  motion_indices; ///< Index in the motion of each controller joint, -1 if not in the motion
+
+        /// Controller joints, whose indices in the joint states are resolved once instead of on every execution
+        mutable JointStateBuffer::Selection joints;
+        boost::shared_ptr<boost::mutex>     joints_mutex; ///< Serializes the reads of goals executed concurrently
+      };
+
+      MotionInfoConstPtr motion;          ///< Motion the entry was computed for
+      std::vector<Group> groups;
+
+      /// Motion without the waypoints downsampling removes, which is the same on every execution. Computed on first
+      /// use
+      mutable MotionInfoConstPtr                            downsampled;
+
+      /// Processed motion waypoints following the first one, which are the same on every execution at the nominal
+      /// speed. Times are relative to the first motion waypoint. Computed on first use. Saves processing them again,
+      /// but they are still written into the trajectory of each controller on every execution
+      mutable boost::shared_ptr<const PackedTrajectory> body;
+      mutable boost::mutex                              body_mutex; ///< Protects the downsampled motion and body
+    };
+    typedef boost::shared_ptr<const PackedTrajectory>        PackedTrajectoryConstPtr;
+    typedef boost::shared_ptr<const MotionControllers>       MotionControllersConstPtr;
+    typedef std::map<std::string, MotionControllersConstPtr> MotionControllersCache;
+
+    /// Motion playing only some of the joints of a library motion.
+    struct PartialMotion
+    {
+      MotionInfoConstPtr source; ///< Library motion the entry was computed from
+      MotionInfoConstPtr motion;
+    };
+    typedef std::map<std::string, PartialMotion> PartialMotions;
+
+    /// Approach of a motion computed ahead of time.
+    struct PreparedApproach
+    {
+      MotionInfoConstPtr  motion;    ///< Motion the approach was computed for
+      std::vector<double> start_pos; ///< Predicted position of the motion joints when the motion starts
+      Trajectory          traj;      ///< Motion with the approach prepended
+    };
+    typedef std::map<std::string, PreparedApproach> PreparedApproaches;
+
+    /// Joints compared with the first waypoint of motions by isAlreadyThere(), read from the joint states at once.
+    struct StartCheck
+    {
+      struct Motion
+      {
+        MotionInfoConstPtr       motion;  ///< Motion the entry was computed for
+        std::vector<std::size_t> indices; ///< Index in the checked joints of each motion joint
+      };
+
+      JointStateBuffer::Selection           joints;      ///< Joints of all the checked motions
+      std::map<std::string, std::size_t>    joint_index; ///< Index of each joint in the selection
+      std::map<std::string, Motion>         motions;     ///< Per motion name
+    };
+  public:
+    typedef boost::shared_ptr<MotionLibrary>         MotionLibraryPtr;
+
+    /// Execution progress of a goal.
+    struct Progress
+    {
+      double        progress;           ///< From 0.0 when the trajectories are sent, to 1.0 when they end
+      ros::Duration time_remaining;     ///< Until the trajectories end
+      double        max_tracking_error; ///< Largest position error of the goal controllers
+    };
     typedef boost::shared_ptr<ApproachPlanner>       ApproachPlannerPtr;
 
   public:
@@ -98,52 +186,350 @@ namespace play_motion
       Callback       cb;
       ControllerList controllers;
       bool           canceled;
+      boost::mutex   mutex;       ///< Protects the goal state, which is accessed from the executor threads
 
       ~Goal();
       void cancel();
       void addController(const MoveJointGroupPtr& ctrl);
 
+      /// \brief Succeed as soon as the motion joints settle at the last waypoint, instead of waiting for the
+      /// controllers to report.
+      ///
+      /// Once the trajectories have ended, the joint states are compared with the last waypoint like
+      /// isAlreadyThere() does, and the goal succeeds when all the motion joints are within tolerance. Must be called
+      /// before execute().
+      /// \param tolerance Tolerance per joint in radians (or meters). Zero to wait for the controllers.
+      /// \param cancel_controllers Cancel the controller goals on completion. Otherwise the controllers keep
+      ///        settling until they get a new trajectory.
+      void setEarlyCompletion(double tolerance, bool cancel_controllers);
+
+      /// \brief Scale the duration of the motion, e.g. 2.0 plays it twice as slow. Combined with the speed override.
+      /// Must be called before execute().
+      /// \param scale Duration scaling. Zero plays the motion at its nominal speed.
+      void setTimeScaling(double scale);
+
+      /// \brief Start the trajectories at a given time, e.g. to start several goals in sync. Goals that are ready
+      /// later fail with the \c START_TIME_MISSED error code, without sending their trajectories. Must be called
+      /// before execute().
+      /// \param start Start time. Zero starts the trajectories as soon as they are ready.
+      void setStartTime(const ros::Time& start);
+
     private:
       Goal(const Callback& cbk);
+
+      /// \return True if the goal is still using the named controller, i.e. it is neither canceled nor was the
+      ///         controller done with its part of the motion.
+      bool isUsingController(const std::string& controller_name);
+
+      MotionInfoConstPtr motion;                 ///< At its nominal speed. Set on acceptance, read-only afterwards
+      MotionControllersConstPtr motion_controllers;
+      bool               skip_planning;
+      int                priority;
+      bool               took_over;              ///< Some controllers were taken over from a preempted goal
+      bool               refresh_controllers;    ///< Controllers are reserved on execution, after refreshing them
+      ros::Time          request_time;
+      LatencyStats::Timing timing;               ///< Time spent in each processing stage, zero for stages not reached
+      ros::WallTime      stage_end;              ///< End of the last stage timed on acceptance
+      ros::Time          start_time;             ///< When the trajectories were sent, zero if not sent yet. Protected
+                                                 ///< by mutex
+      ros::Duration      duration;               ///< Of the longest trajectory sent, protected by mutex
+      double             completion_tolerance;   ///< Zero to wait for the controllers to report
+      bool               cancel_on_completion;
+      JointStateBuffer::Selection completion_joints; ///< Motion joints, read from the joint state callback only
+      std::vector<double> completion_target;     ///< Last motion waypoint, in the order of completion_joints
+      double             time_scaling;           ///< Requested duration scaling, 1.0 for the nominal speed
+      ros::Time          requested_start;        ///< When the trajectories must start, zero to start them once ready
+      ros::Time          sent_time;              ///< When the current trajectories were sent, after start_time if
+                                                 ///< they were rescaled. Protected by mutex
+      std::map<MoveJointGroupPtr, Trajectory> sent_trajs; ///< Current trajectory of each controller, kept to rescale
+                                                          ///< them if the speed override is enabled. Protected by
+                                                          ///< mutex
+      std::map<MoveJointGroupPtr, unsigned int> ctrl_goal_ids; ///< Identifier of the goal sent to each controller,
+                                                               ///< protected by mutex
     };
 
     PlayMotion(ros::NodeHandle& nh);
 
-    /// \brief Send motion goal request
+    /// \brief Accept a motion goal request.
+    ///
+    /// Checks that the motion exists and that its controllers are available, and reserves them for this goal.
+    /// This is fast, and does no motion planning. The goal is started by calling execute(). Goals on disjoint
+    /// controller sets can be accepted and executed concurrently. If some controllers are missing and the controller
+    /// refresh is enabled, the goal is accepted, and execute() reserves them after refreshing the controllers.
+    /// Controllers reserved by goals of lower priority are taken over: these goals are preempted, and finish with the
+    /// \c PREEMPTED error code. The controllers keep tracking the preempted trajectory until the new one is sent.
     /// \param motion_name Name of motion to execute.
     /// \param skip_planning Skip motion planning for computing the approach trajectory.
-    /// \param[out] goal_id contains the goal ID if function returns true
-    bool run(const std::string& motion_name,
-             bool               skip_planning,
-             GoalHandle&        gh,
-             const Callback&    cb);
+    /// \param priority Goal priority.
+    /// \param[out] gh Goal handle. If the goal is rejected, it contains the error information.
+    /// \param cb Callback to call when the goal finishes. Not called if the goal is rejected.
+    /// \return True if the goal was accepted.
+    bool accept(const std::string& motion_name,
+                bool               skip_planning,
+                int                priority,
+                GoalHandle&        gh,
+                const Callback&    cb);
+
+    /// \brief Accept a goal request playing several motions back to back, as a single continuous motion.
+    ///
+    /// The motions are validated and concatenated on acceptance, and from then on the sequence is handled like any
+    /// other motion: a single approach is computed at its start, and each controller gets a single trajectory.
+    /// Steps starting where the previous step ends, within the approach planner joint tolerance, are joined without
+    /// stopping. Otherwise a non-planned approach is inserted between them. Joints not used by a step hold the
+    /// position where the previous step left them or, before their first step, where that step starts.
+    /// \param sequence Names of motions to execute, in order.
+    /// \param time_scaling Duration scaling of each motion of the sequence. All motions are played at their nominal
+    ///                     speed if empty.
+    /// \sa accept()
+    bool acceptSequence(const MotionNames&         sequence,
+                        const std::vector<double>& time_scaling,
+                        bool                       skip_planning,
+                        int                        priority,
+                        GoalHandle&                gh,
+                        const Callback&            cb);
+
+    /// \brief Accept a goal request playing only some of the joints of a motion, or of a sequence of motions.
+    ///
+    /// Lets a motion be split between several instances, each owning the controllers of some of its joints.
+    /// \param motion_name Name of motion to execute, ignored if \p sequence is not empty.
+    /// \param sequence Names of motions to execute back to back, empty to execute a single motion.
+    /// \param joints Joints to play, all of them must be used by the motion.
+    /// \sa accept(), acceptSequence()
+    bool acceptPartial(const std::string&         motion_name,
+                       const MotionNames&         sequence,
+                       const std::vector<double>& time_scaling,
+                       const JointNames&          joints,
+                       bool                       skip_planning,
+                       int                        priority,
+                       GoalHandle&                gh,
+                       const Callback&            cb);
+
+    /// \brief Plan the approach trajectory of an accepted goal, and send it to the controllers.
+    ///
+    /// This can take long, so it is meant to be called from an executor thread. Errors are reported through the
+    /// goal callback.
+    /// \param gh Goal handle returned by accept().
+    void execute(const GoalHandle& gh);
+
+    /// \brief Get the execution progress of a goal.
+    /// \return False if the trajectories of the goal were not sent to the controllers yet, or if it was canceled.
+    bool getProgress(const GoalHandle& gh, Progress& progress);
+
+    /// \brief Change the speed at which all goals are played, e.g. 0.5 plays them twice as slow.
+    ///
+    /// Goals being played are rescaled from their current point on, by sending the rest of their trajectories to the
+    /// controllers again, which replace the trajectories being executed. Segments exceeding the joint velocity limits
+    /// are slowed down if motion retiming is enabled in the approach planner.
+    /// \param speed Speed factor, see checkSpeedFactor().
+    /// \throws PMException if the speed is out of range, or if the speed override is not enabled.
+    void setSpeedOverride(double speed);
+
+    /// \brief Check a time scaling or speed override factor, which must be between 0.01 and 100, as more extreme
+    /// values could overflow the trajectory times.
+    /// \param what Description of the factor, for the error message.
+    /// \throws PMException if the factor is out of range, or not a number.
+    static void checkSpeedFactor(double factor, const std::string& what);
+
+    /// \brief Returns the current speed override factor, 1.0 for the nominal speed.
+    double getSpeedOverride();
+
+    /// \brief Compute ahead of time the approach of a motion that is going to be requested next.
+    ///
+    /// The approach starts from the last waypoint of the motions being played, for the joints they use, and from the
+    /// current state for the rest of joints. A goal requesting the motion later on uses the prepared approach, with no
+    /// planning latency, if the robot is at the predicted state when the goal is executed.
+    /// \param motion_name Name of motion to prepare.
+    /// \throws PMException if the motion does not exist, or if its approach could not be computed.
+    void prepare(const std::string& motion_name);
+
+    /// \brief Check whether the current joint state matches the first waypoint of a motion.
+    /// \param motion_name Name of motion to check.
+    /// \param tolerance Tolerance per joint in radians (or meters).
+    /// \return False if the motion does not exist, or if the state of some of its joints is unknown.
+    bool isAlreadyThere(const std::string& motion_name, double tolerance);
+
+    /// \brief Compare the current joint state with the first waypoint of several motions.
+    ///
+    /// All the motions are compared against the same snapshot of the joint states. The indices of the motion joints
+    /// in the joint states are cached, so checking many motions is cheap.
+    /// \param motion_names Names of motions to check.
+    /// \param[out] max_deviation Largest joint position difference between the current state and the first waypoint
+    ///             of each motion. Infinite if the motion does not exist, or if the state of some of its joints is
+    ///             unknown.
+    void getStartDeviations(const MotionNames& motion_names, std::vector<double>& max_deviation);
+
+    /// \brief Returns the library the motions are served from.
+    const MotionLibraryPtr& getMotionLibrary() const { return motion_library_; }
+
+    /// \brief Returns the planner used to compute approach trajectories.
+    const ApproachPlannerPtr& getApproachPlanner() const { return approach_planner_; }
+
+    /// \brief Returns the time spent by the latest goals in each processing stage.
+    const LatencyStats& getLatencyStats() const { return latency_stats_; }
+
+    /// \brief Returns the number of times the action client of a controller was recreated, after the controller was
+    /// stopped or changed.
+    unsigned int getControllerReconnects();
 
   private:
     void jointStateCb(const sensor_msgs::JointStatePtr& msg);
+    void speedOverrideCb(const std_msgs::Float64ConstPtr& msg);
+
+    /// \brief Rescale the rest of the trajectories of a goal being played, and send them to its controllers.
+    /// \param ratio Ratio between the new and the current duration of the trajectories.
+    /// \note Must be called with controllers_mutex_ and the goal lock held.
+    void rescaleGoal(const GoalHandle& goal_hdl, double ratio);
+
+    /// \brief Complete the goals whose motion joints settled at the last waypoint.
+    /// \sa Goal::setEarlyCompletion()
+    void checkCompletion();
+
+    /// \brief Finish a goal successfully, without waiting for its controllers.
+    /// \return False if the goal had already finished or was canceled.
+    bool completeGoal(const GoalHandle& goal_hdl);
+
+    /// \brief Record the time spent by a goal in each stage, and publish it.
+    void publishGoalStats(const GoalHandle& goal_hdl, int error_code);
 
-    bool getGroupTraj(MoveJointGroupPtr move_joint_group,
-                      const JointNames& motion_joints,
-                      const Trajectory& motion_points, Trajectory& traj_group);
-    void getMotionJoints(const std::string& motion_name, JointNames& motion_joints);
-    void getMotionPoints(const std::string& motion_name, Trajectory& motion_points);
+    /// \brief Accept a goal playing a motion, or a sequence of motions if \p sequence is not empty.
+    /// \param joints Joints of the motion to play, all of them if empty.
+    bool accept(const std::string&         motion_name,
+                const MotionNames&         sequence,
+                const std::vector<double>& time_scaling,
+                const JointNames&          joints,
+                bool                       skip_planning,
+                int                        priority,
+                GoalHandle&                gh,
+                const Callback&            cb);
 
-    /// \brief Populate a list of controllers that span the motion joints.
+    /// \brief Get the motion playing only some of the joints of another motion.
+    ///
+    /// Partial motions of library motions are cached, so that the controllers of the partial motion are cached too.
+    /// \param[in,out] cache_key Cache key of \p motion, empty if it is not cached. The joints are appended to it.
+    /// \throws PMException if some of the joints are not used by the motion.
+    MotionInfoConstPtr getPartialMotion(const MotionInfoConstPtr& motion, const JointNames& joints,
+                                        std::string& cache_key);
+
+    /// \brief Concatenate a sequence of motions into a single one.
+    /// \throws PMException if some of the motions do not exist, or if the time scaling is not valid.
+    /// \sa acceptSequence()
+    MotionInfoConstPtr buildSequence(const MotionNames& sequence, const std::vector<double>& time_scaling);
+
+    /// \brief Extract the trajectory of a controller from the motion trajectory, ready to be sent.
+    /// \param body Cached motion body, whose controller joints are appended after \p motion_points, delayed by
+    ///             \p body_offset. Ignored if null.
+    bool getGroupTraj(const MotionControllers::Group& group,
+                      const Trajectory& motion_points, const PackedTrajectory* body,
+                      const ros::Duration& body_offset, trajectory_msgs::JointTrajectory& traj_group);
+
+    /// \brief Validate and resample a trajectory before sending it to the controllers.
+    /// \throws ros::Exception if the trajectory is not valid.
+    void processTrajectory(Trajectory& traj, std::size_t num_joints) const;
+
+    /// \brief Downsample a motion, or return it as it is if downsampling is disabled.
+    /// \throws PMException if the motion trajectory is not valid.
+    MotionInfoConstPtr downsampleMotion(const MotionInfoConstPtr& motion) const;
+
+    /// \brief Get the downsampled motion of an entry, downsampling it on first use.
+    /// \throws PMException if the motion trajectory is not valid.
+    MotionInfoConstPtr getDownsampledMotion(const MotionControllers& motion_ctrls) const;
+
+    /// \brief Get the processed motion waypoints following the first one, processing them on first use.
+    /// \param traj Motion trajectory with the approach prepended.
+    /// \param body_start Index in \p traj of the second motion waypoint.
+    /// \throws ros::Exception if the trajectory is not valid.
+    PackedTrajectoryConstPtr getMotionBody(const MotionControllers& motion_ctrls, const Trajectory& traj,
+                                           std::size_t body_start) const;
+
+    /// \brief Get the controllers that span the motion joints.
     ///
     /// In the general case, the controllers will span more than the motion joints, but never less.
-    /// This method also validates that the controllers are not busy executing another goal.
-    /// \param motion_joints List of motion joints.
-    /// \return A list of controllers that span (at least) all the motion joints.
+    /// This method also validates that the controllers are not reserved by another goal of the same or higher
+    /// priority.
+    /// \param cache_key Name of the motion, followed by its joints for partial motions. Empty for motions not in the
+    ///        library, which are not cached.
+    /// \param motion The motion.
+    /// \param priority Priority of the goal requesting the controllers.
+    /// \param[out] preempted Lower priority goals holding reservations on some of the controllers.
+    /// \return Controllers that span (at least) all the motion joints.
     /// \throws PMException if no controllers spanning the motion joints were found, or if some of them are busy.
-    ControllerList getMotionControllers(const JointNames& motion_joints);
+    /// \note Must be called with controllers_mutex_ held.
+    MotionControllersConstPtr getMotionControllers(const std::string& cache_key, const MotionInfoConstPtr& motion,
+                                                   int priority, std::vector<GoalHandle>& preempted);
+
+    /// \brief Reserve for a goal the controllers of its motion.
+    /// \param cache_key See getMotionControllers().
+    /// \param[out] preempted Goals that were preempted to free some of the controllers.
+    /// \throws PMException if the controllers are missing or busy.
+    void reserveControllers(const GoalHandle& goal_hdl, const std::string& cache_key,
+                            std::vector<GoalHandle>& preempted);
+
+    /// \brief Refresh the controllers and reserve them, for a goal accepted while some of them were missing.
+    /// Preempted goals are notified.
+    /// \throws PMException if the goal was canceled, or the controllers are still missing or busy.
+    void reserveRefreshedControllers(const GoalHandle& goal_hdl);
+
+    /// \brief Map the joints of a motion to the current controllers.
+    /// \throws PMException if no controllers spanning the motion joints were found.
+    MotionControllersConstPtr computeMotionControllers(const MotionInfoConstPtr& motion) const;
+
+    /// \brief Preempt a goal, handing over some of its controllers to another goal.
+    ///
+    /// The handed over controllers are not canceled, so that they keep moving until they receive the trajectory of
+    /// the new goal. The rest of controllers of the preempted goal are canceled.
+    /// \return False if the goal had already finished or was canceled.
+    bool preempt(const GoalHandle& goal_hdl, const ControllerList& handed_over);
+
+    /// \return The goal holding a reservation on the named controller, null if the controller is free.
+    /// \note Must be called with controllers_mutex_ held.
+    GoalHandle getReservation(const std::string& controller_name);
+    /// \brief Predict the position of the motion joints once the goals being played are done.
+    /// \throws PMException if the current position of some joints is unknown.
+    void predictStartPos(const MotionInfoConstPtr& motion, std::vector<double>& start_pos);
+
+    /// \brief Take the approach prepared for a motion, if it starts at the current position of the motion joints.
+    /// \return True if a prepared approach was found.
+    bool takePreparedApproach(const MotionInfoConstPtr& motion, const std::vector<double>& curr_pos,
+                              Trajectory& traj);
+
+    /// \brief Update the controllers, rebuilding only the ones that were added, removed or remapped.
+    ///
+    /// Goals using a controller that is removed or remapped are aborted, the rest are not affected.
     void updateControllersCb(const ControllerUpdater::ControllerStates& states,
                              const ControllerUpdater::ControllerJoints& joints);
 
     ros::NodeHandle                  nh_;
     ControllerList                   move_joint_groups_;
-    std::map<std::string, double>    joint_states_;
+    boost::mutex                     controllers_mutex_;      ///< Protects the controllers and their reservations
+    Reservations                     reservations_;           ///< Goal each controller was last reserved for
+    MotionControllersCache           motion_controllers_;     ///< Per cache key, valid for the current controllers
+    JointStateBuffer                 joint_states_;
     ros::Subscriber                  joint_states_sub_;
+    ros::WallDuration                refresh_timeout_;        ///< Max wait for a controller refresh on missing ones
+    double                           downsample_tolerance_;   ///< Max deviation of removed waypoints, zero to keep all
+    double                           upsample_period_;        ///< Max time between waypoints, zero to not add any
+    std::size_t                      stream_window_size_;     ///< Max waypoints per controller goal, zero for all
+    ros::Duration                    stream_lead_time_;       ///< Time ahead of the end of a window to send the next
     ControllerUpdater                ctrlr_updater_;
     ApproachPlannerPtr               approach_planner_;
+    PreparedApproaches               prepared_approaches_;    ///< Per motion name
+    boost::mutex                     prepared_mutex_;
+    PartialMotions                   partial_motions_;        ///< Per cache key, see getPartialMotion()
+    boost::mutex                     partial_mutex_;
+    MotionLibraryPtr                 motion_library_;
+    StartCheck                       start_check_;
+    boost::mutex                     start_check_mutex_;
+    LatencyStats                     latency_stats_;
+    ros::Publisher                   goal_stats_pub_;         ///< Latched, time spent by each goal in every stage
+    std::set<std::string>            known_controllers_;      ///< Controllers ever created
+    unsigned int                     controller_reconnects_;  ///< Protected by controllers_mutex_
+    std::list<boost::weak_ptr<Goal> > settling_goals_;        ///< Sent goals completing on joint state tolerance
+    std::list<boost::weak_ptr<Goal> > running_goals_;         ///< Sent goals, protected by controllers_mutex_
+    bool                             speed_override_enabled_; ///< Keep the sent trajectories, to rescale them
+    double                           speed_override_;         ///< Protected by controllers_mutex_
+    ros::Subscriber                  speed_override_sub_;
+    boost::mutex                     settling_mutex_;
+    std::atomic<bool>                has_settling_goals_;     ///< Lets joint state callbacks skip the list lock
   };
 }
 
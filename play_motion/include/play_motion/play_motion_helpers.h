@@ -41,11 +41,13 @@
 #define PLAYMOTIONHELPERS_H
 
 #include <string>
+#include <boost/shared_ptr.hpp>
+#include <ros/node_handle.h>
 #include "play_motion/datatypes.h"
 
-namespace ros
+namespace XmlRpc
 {
-  class NodeHandle;
+  class XmlRpcValue;
 }
 
 namespace play_motion
@@ -61,6 +63,66 @@ namespace play_motion
     Trajectory traj;
   };
 
+  /**
+   * \brief Motion of the parameter server whose parts are fetched and parsed on first access.
+   *
+   * Joints, meta information and waypoints are fetched separately, so that querying e.g. the joints of a motion does
+   * not pay for parsing its waypoints. Each part is fetched once, and kept for subsequent accesses. Queries about a
+   * nonexistent or malformed motion throw when the offending part is accessed.
+   *
+   * Instances are not thread-safe: each thread should use its own.
+   */
+  class MotionHandle
+  {
+  public:
+    /**
+     * \param nh Nodehandle with the namespace containing the motions
+     *           (When omitted, defaults to ros::NodeHandle nh("play_motion"))
+     * \param motion_id Motion identifier
+     */
+    MotionHandle(const ros::NodeHandle& nh, const std::string& motion_id);
+    explicit MotionHandle(const std::string& motion_id);
+
+    const std::string& getId() const {return id_;}
+
+    /// \throws ros::Exception if the motion does not exist or is malformed.
+    const JointNames& getJoints() const;
+
+    /// \{
+    /// \brief Meta information, empty if the motion doesn't specify it.
+    /// \throws ros::Exception if the motion meta information is malformed.
+    const std::string& getName() const;
+    const std::string& getUsage() const;
+    const std::string& getDescription() const;
+    /// \}
+
+    /// \brief Time from start of the last waypoint. Waypoint positions are not parsed.
+    /// \throws ros::Exception if the motion does not exist or is malformed.
+    ros::Duration getDuration() const;
+
+    /// \throws ros::Exception if the motion does not exist or is malformed.
+    const Trajectory& getPoints() const;
+
+    /// \brief Get all the motion parts.
+    /// \throws ros::Exception if the motion does not exist or is malformed.
+    void getMotion(MotionInfo& motion_info) const;
+
+  private:
+    /// \return Motion parameter member.
+    /// \throws ros::Exception if it does not exist.
+    void fetchMember(const std::string& member, XmlRpc::XmlRpcValue& value) const;
+    void fetchPoints() const;
+    void fetchMeta() const;
+
+    ros::NodeHandle nh_; ///< Motions namespace
+    std::string     id_;
+
+    mutable boost::shared_ptr<JointNames>          joints_;
+    mutable boost::shared_ptr<MotionInfo>          meta_;       ///< Only meta information is set
+    mutable boost::shared_ptr<XmlRpc::XmlRpcValue> points_raw_; ///< Fetched, but not parsed yet
+    mutable boost::shared_ptr<Trajectory>          points_;
+  };
+
   /**
    * \param nh Nodehandle with the namespace containing the motions
    *           (When omitted, defaults to ros::NodeHandle nh("play_motion"))
@@ -87,9 +149,12 @@ namespace play_motion
    */
   ros::Duration getMotionDuration(const ros::NodeHandle &nh,
                                   const std::string &motion_id);
+  ros::Duration getMotionDuration(const std::string &motion_id);
 
   /**
    * \brief getMotions obtain all motion names
+   *
+   * Only parameter names are fetched, not the motions themselves.
    * \param nh Nodehandle with the namespace containing the motions
    *           (When omitted, defaults to ros::NodeHandle nh("play_motion"))
    * \throws xh::XmlrpcHelperException if no motions available
@@ -151,13 +216,74 @@ namespace play_motion
    * will be set to zero.
    *
    * \param[in] traj_in Input trajectory. Some waypoints may have a velocity specification (or not at all).
-   * \param[out] traj_out Output trajectory. All waypoints have a velocity specification. Can be the same instance as
-   * \c traj_in.
+   * \param[out] traj_out Output trajectory, a copy of \c traj_in where all waypoints have a velocity specification.
+   * Can be the same instance as \c traj_in.
    *
    * \sa populateVelocities(const TrajPoint&, const TrajPoint&, TrajPoint&)
    */
   void populateVelocities(const Trajectory& traj_in, Trajectory& traj_out);
 
+  /**
+   * \brief Compute the velocities of the interior waypoints of a trajectory stored in contiguous arrays.
+   *
+   * Batched version of populateVelocities(const TrajPoint&, const TrajPoint&, TrajPoint&), processing all the
+   * interior waypoints in a single pass, without branches in the inner loop. Results are identical.
+   *
+   * \param[in] num_points Number of waypoints.
+   * \param[in] num_joints Number of joints.
+   * \param[in] times Time from start of each waypoint, in seconds.
+   * \param[in] positions Waypoint major position matrix, \c num_joints values per waypoint.
+   * \param[out] velocities Velocity matrix, with the same layout as \c positions. Rows of interior waypoints are
+   * written, the first and last rows are left untouched.
+   */
+  void populateVelocities(std::size_t   num_points,
+                          std::size_t   num_joints,
+                          const double* times,
+                          const double* positions,
+                                double* velocities);
+
+  /**
+   * \brief Check that a trajectory can be sent to the controllers.
+   *
+   * All waypoints must have \c num_joints positions, and either none or \c num_joints velocities and accelerations.
+   * Values must be finite, and times from start must be non-negative and strictly increasing.
+   *
+   * \throws ros::Exception if the trajectory is not valid.
+   */
+  void validateTrajectory(const Trajectory& traj, std::size_t num_joints);
+
+  /**
+   * \brief Remove the waypoints of a trajectory that the controllers reproduce from their neighbours.
+   *
+   * Velocities are first populated as in populateVelocities(), from the original neighbours of each waypoint. Waypoints
+   * are then removed as long as the cubic polynomials the controllers interpolate between the kept waypoints, with
+   * their populated velocities, deviate from them by at most \c tolerance, for every joint. All output waypoints have
+   * a velocity specification, so the output is sent as it is. The endpoints and waypoints with a velocity or
+   * acceleration specification are always kept, as are segments whose endpoints have an acceleration specification.
+   * This is well suited for dense motions, like the ones recorded by teleoperation.
+   *
+   * \param[in] traj_in Input trajectory.
+   * \param[in] tolerance Maximum deviation per joint, in radians (or meters).
+   * \param[out] traj_out Output trajectory. Can be the same instance as \c traj_in.
+   */
+  void downsampleTrajectory(const Trajectory& traj_in, double tolerance, Trajectory& traj_out);
+
+  /**
+   * \brief Add waypoints to a trajectory, so that consecutive waypoints are at most \c max_period apart.
+   *
+   * Added waypoints are sampled from the cubic polynomials the controllers interpolate between waypoints, so the
+   * trajectory shape is not altered. All input waypoints must have a velocity specification. Segments whose endpoints
+   * have an acceleration specification are interpolated by the controllers with quintic polynomials, and are left
+   * untouched.
+   *
+   * \param[in] traj_in Input trajectory.
+   * \param[in] max_period Maximum time between consecutive waypoints, in seconds.
+   * \param[out] traj_out Output trajectory. Can be the same instance as \c traj_in.
+   *
+   * \sa populateVelocities(const Trajectory&, Trajectory&)
+   */
+  void upsampleTrajectory(const Trajectory& traj_in, double max_period, Trajectory& traj_out);
+
   /**
    * \brief Parse a motion specified in the ROS parameter server into a data structure.
    * \param[in] nh Nodehandle with the namespace containing the motions
@@ -169,6 +295,16 @@ namespace play_motion
   void getMotion(const ros::NodeHandle &nh, const std::string &motion_id,
                  MotionInfo &motion_info);
   void getMotion(const std::string &motion_id, MotionInfo &motion_info);
+
+  /**
+   * \brief Parse an already fetched motion parameter into a data structure.
+   * \param[in] motion_id Motion identifier
+   * \param[in] param Motion parameter, i.e. the contents of \c motions/<motion_id>
+   * \param[out] motion_info Data structure containing parsed motion
+   * \throws xh::XmlrpcHelperException if the motion is malformed.
+   */
+  void parseMotion(const std::string &motion_id, XmlRpc::XmlRpcValue &param,
+                   MotionInfo &motion_info);
 }
 
 #endif
@@ -0,0 +1,131 @@
+/*
+ * Software License Agreement (Modified BSD License)
+ *
+ *  Copyright (c) 2013, PAL Robotics, S.L.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of PAL Robotics, S.L. nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PLAY_MOTION_PLAY_MOTION_ROUTER_H
+#define PLAY_MOTION_PLAY_MOTION_ROUTER_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <ros/ros.h>
+#include <actionlib/client/action_client.h>
+#include <actionlib/server/action_server.h>
+
+#include "play_motion/datatypes.h"
+#include "play_motion_msgs/PlayMotionAction.h"
+#include "play_motion_msgs/ReloadMotions.h"
+
+namespace play_motion
+{
+  class MotionLibrary;
+
+  /** Front-end of several play_motion instances, each owning a subset of the robot controllers.
+   *
+   * Goals are routed by the joints of their motion, read from the motion library shared by all the instances. Goals
+   * whose joints belong to a single instance are forwarded to it unchanged. Goals spanning several instances are
+   * split into partial goals, one per instance, which start their trajectories at the same time. Goals needing an
+   * instance whose action server is not connected are rejected.
+   */
+  class PlayMotionRouter
+  {
+  private:
+    typedef play_motion_msgs::PlayMotionAction          Action;
+    typedef play_motion_msgs::PlayMotionGoal            Goal;
+    typedef play_motion_msgs::PlayMotionResult          Result;
+    typedef play_motion_msgs::PlayMotionFeedback        Feedback;
+    typedef boost::shared_ptr<const Feedback>           FeedbackConstPtr;
+    typedef actionlib::ActionServer<Action>             AlServer;
+    typedef actionlib::ActionClient<Action>             AlClient;
+    typedef boost::shared_ptr<AlClient>                 AlClientPtr;
+    typedef boost::shared_ptr<MotionLibrary>            MotionLibraryPtr;
+
+    /// play_motion instance owning some of the controllers.
+    struct Shard
+    {
+      std::string name;
+      JointNames  joints; ///< Joints of the controllers owned by the instance
+      AlClientPtr client;
+    };
+
+    /// Goal being played by one or more instances.
+    struct Route
+    {
+      Route() : pending(0), finished(false) {}
+
+      AlServer::GoalHandle              gh;
+      std::vector<std::size_t>          shards;   ///< Index of the instance playing each part of the goal
+      std::vector<AlClient::GoalHandle> parts;
+      std::vector<Feedback>             feedback; ///< Latest feedback of each part
+      std::size_t                       pending;  ///< Parts that did not finish yet
+      bool                              finished; ///< The result of the goal was already set
+    };
+    typedef boost::shared_ptr<Route> RoutePtr;
+
+  public:
+    /// \throws ros::Exception if the instances are not properly configured.
+    PlayMotionRouter(const ros::NodeHandle& nh);
+
+  private:
+    void alGoalCb(AlServer::GoalHandle gh);
+    void alCancelCb(AlServer::GoalHandle gh);
+    void transitionCb(const RoutePtr& route, std::size_t part, AlClient::GoalHandle part_gh);
+    void feedbackCb(const RoutePtr& route, std::size_t part, const FeedbackConstPtr& feedback);
+    bool reloadMotions(play_motion_msgs::ReloadMotions::Request&  req,
+                       play_motion_msgs::ReloadMotions::Response& resp);
+
+    /// \brief Set the result of a routed goal, if it was not set already.
+    /// \param[out] canceled Parts of the goal to cancel, which must be done without holding routes_mutex_.
+    /// \note Must be called with routes_mutex_ held.
+    void finish(const RoutePtr& route, const Result& result, std::vector<AlClient::GoalHandle>& canceled);
+
+    /// \return Joints used by a goal.
+    /// \throws PMException if some of the goal motions do not exist.
+    JointNames getGoalJoints(const Goal& goal) const;
+
+    ros::NodeHandle                 nh_;
+    std::vector<Shard>              shards_;
+    MotionLibraryPtr                motion_library_;
+    ros::Duration                   sync_delay_;     ///< Time between splitting a goal and the start of its parts
+    AlServer                        al_server_;
+    std::map<std::string, RoutePtr> routes_;         ///< Per goal id
+    boost::mutex                    routes_mutex_;
+    ros::ServiceServer              reload_motions_srv_;
+  };
+}
+
+#endif
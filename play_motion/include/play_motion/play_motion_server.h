@@ -43,11 +43,17 @@
 #include <map>
 #include <ros/ros.h>
 #include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
 #include <actionlib/server/action_server.h>
+#include <ros/callback_queue.h>
 
 #include "play_motion/play_motion.h"
 #include "play_motion_msgs/PlayMotionAction.h"
 #include "play_motion_msgs/ListMotions.h"
+#include "play_motion_msgs/IsAlreadyThere.h"
+#include "play_motion_msgs/IsAlreadyThereBatch.h"
+#include "play_motion_msgs/PrepareMotion.h"
+#include "play_motion_msgs/ReloadMotions.h"
 
 namespace play_motion
 {
@@ -56,6 +62,24 @@ namespace play_motion
   private:
     typedef actionlib::ActionServer<play_motion_msgs::PlayMotionAction> AlServer;
     typedef boost::shared_ptr<PlayMotion> PlayMotionPtr;
+    typedef boost::shared_ptr<ros::AsyncSpinner> AsyncSpinnerPtr;
+    typedef boost::shared_ptr<ros::CallbackQueue> CallbackQueuePtr;
+
+    /// Executor thread, running the goals of the controller sets assigned to it in order.
+    struct Pipeline
+    {
+      CallbackQueuePtr cb_queue;
+      AsyncSpinnerPtr  spinner;
+      std::size_t      pending;  ///< Goals queued or being executed
+    };
+    typedef boost::shared_ptr<Pipeline> PipelinePtr;
+
+    /// Pipeline a controller set is assigned to, while it has goals pending.
+    struct ControllerSet
+    {
+      PipelinePtr pipeline;
+      std::size_t pending;
+    };
 
   public:
     PlayMotionServer(const ros::NodeHandle& nh, const PlayMotionPtr& pm);
@@ -65,20 +89,57 @@ namespace play_motion
     void playMotionCb(const PlayMotion::GoalHandle& goal_hdl);
     void alCancelCb(AlServer::GoalHandle gh);
     void alGoalCb(AlServer::GoalHandle gh);
+    void executeGoal(const PlayMotion::GoalHandle& goal_hdl, const std::string& controller_set);
+
+    /// \brief Get the pipeline to execute a goal with, and count the goal as pending in it.
+    /// \param controller_set Identifier of the controllers of the goal.
+    PipelinePtr getPipeline(const std::string& controller_set);
     bool findGoalId(AlServer::GoalHandle gh, PlayMotion::GoalHandle& goal_id);
     bool listMotions(play_motion_msgs::ListMotions::Request&  req,
                      play_motion_msgs::ListMotions::Response& resp);
+    bool isAlreadyThere(play_motion_msgs::IsAlreadyThere::Request&  req,
+                        play_motion_msgs::IsAlreadyThere::Response& resp);
+    bool isAlreadyThereBatch(play_motion_msgs::IsAlreadyThereBatch::Request&  req,
+                             play_motion_msgs::IsAlreadyThereBatch::Response& resp);
+    bool reloadMotions(play_motion_msgs::ReloadMotions::Request&  req,
+                       play_motion_msgs::ReloadMotions::Response& resp);
+    bool prepareMotion(play_motion_msgs::PrepareMotion::Request&  req,
+                       play_motion_msgs::PrepareMotion::Response& resp);
     void publishDiagnostics(const ros::TimerEvent &ev) const;
+    void publishFeedback(const ros::TimerEvent &ev);
 
     ros::NodeHandle                                        nh_;
     std::vector<std::string>                               clist_;
     PlayMotionPtr                                          pm_;
     AlServer                                               al_server_;
     std::map<PlayMotion::GoalHandle, AlServer::GoalHandle> al_goals_;
+    mutable boost::mutex                                   al_goals_mutex_;
     ros::ServiceServer                                     list_motions_srv_;
+    ros::ServiceServer                                     is_already_there_srv_;
+    ros::ServiceServer                                     is_already_there_batch_srv_;
+
+    // Reloading motions can take long, so it's served from its own callback queue
+    CallbackQueuePtr                                       reload_cb_queue_;
+    AsyncSpinnerPtr                                        reload_spinner_;
+    ros::ServiceServer                                     reload_motions_srv_;
+
+    // Preparing motions involves motion planning, so it's also served from its own callback queue
+    CallbackQueuePtr                                       prepare_cb_queue_;
+    AsyncSpinnerPtr                                        prepare_spinner_;
+    ros::ServiceServer                                     prepare_motion_srv_;
 
     ros::Publisher                                         diagnostic_pub_;
     ros::Timer                                             diagnostic_timer_;
+    ros::Timer                                             feedback_timer_;
+
+    // Accepted goals are planned and sent to the controllers by a pool of executor threads, so that the callbacks
+    // processed in the main thread (goal acceptance and cancelation, joint states, etc.) are never blocked. Goals on
+    // a controller set are executed in order, by the pipeline the set is assigned to while it has goals pending.
+    // Sets are assigned to the least busy pipeline, so goals on disjoint controllers are prepared independently
+    // while there are free pipelines
+    std::vector<PipelinePtr>                               pipelines_;
+    std::map<std::string, ControllerSet>                   controller_sets_;
+    boost::mutex                                           pipelines_mutex_;
   };
 }
 
@@ -3,7 +3,97 @@
 from __future__ import print_function
 import yaml
 import argparse
+import math
+import os
+import struct
 import sys
+import tempfile
+
+# Binary motion file layout, see include/play_motion/motion_file.h
+MOTION_FILE_MAGIC = b'PMLIB001'
+HAS_VELOCITIES = 1
+HAS_ACCELERATIONS = 2
+
+def pack_string(s):
+    data = s.encode('utf-8')
+    return struct.pack('<I', len(data)) + data
+
+def write_motion_file(motions, filename):
+    """Write motions, as found in the 'motions' parameter namespace, to a binary motion file"""
+    ids = sorted(motions.keys())
+    records = []
+    blocks = []
+    for motion_id in ids:
+        motion = motions[motion_id]
+        joints = motion['joints']
+        points = motion['points']
+        meta = motion.get('meta', {})
+        flags = 0
+        if any('velocities' in p for p in points):
+            flags |= HAS_VELOCITIES
+        if any('accelerations' in p for p in points):
+            flags |= HAS_ACCELERATIONS
+
+        values = []
+        for i, p in enumerate(points):
+            # Waypoint blocks have no per waypoint sizes, so a short waypoint would shift all the following values
+            for key in ('positions', 'velocities', 'accelerations'):
+                if key in p and len(p[key]) != len(joints):
+                    raise ValueError("waypoint {} of motion '{}' has {} {}, expected one per joint ({})".format(
+                        i, motion_id, len(p[key]), key, len(joints)))
+            values.append(float(p['time_from_start']))
+            values.extend(float(x) for x in p['positions'])
+            for key, flag in (('velocities', HAS_VELOCITIES), ('accelerations', HAS_ACCELERATIONS)):
+                if flags & flag:
+                    # NaN marks waypoints without values
+                    values.extend(float(x) for x in p.get(key, [float('nan')] * len(joints)))
+        duration = float(points[-1]['time_from_start']) if points else 0.0
+
+        record = (pack_string(motion_id) + pack_string(meta.get('name', '')) +
+                  pack_string(meta.get('usage', '')) + pack_string(meta.get('description', '')) +
+                  struct.pack('<I', len(joints)) + b''.join(pack_string(j) for j in joints) +
+                  struct.pack('<IId', len(points), flags, duration))
+        records.append(record)
+        blocks.append(struct.pack('<%dd' % len(values), *values))
+
+    # Waypoint blocks follow the index, 8 byte aligned. Each record ends with the uint64 offset of its block
+    index_size = 16 + sum(len(r) + 8 for r in records)
+    padding = int(math.ceil(index_size / 8.0)) * 8 - index_size
+
+    def write(f):
+        offset = index_size + padding
+        f.write(MOTION_FILE_MAGIC + struct.pack('<II', len(records), 0))
+        for record, block in zip(records, blocks):
+            f.write(record + struct.pack('<Q', offset))
+            offset += len(block)
+        f.write(b'\0' * padding)
+        for block in blocks:
+            f.write(block)
+
+    # Outputs that are not regular files, like stdout, are written as they are
+    if os.path.exists(filename) and not os.path.isfile(filename):
+        with open(filename, 'wb') as f:
+            write(f)
+        return
+
+    # Running play_motion nodes keep the file mapped, and would crash reading past the end of a file truncated under
+    # them. The file is written next to the target instead, and then replaces it, so they keep the old one
+    dirname, basename = os.path.split(os.path.abspath(filename))
+    fd, tmp_filename = tempfile.mkstemp(prefix='.' + basename + '.', dir=dirname)
+    try:
+        with os.fdopen(fd, 'wb') as f:
+            write(f)
+        if os.path.exists(filename):
+            mode = os.stat(filename).st_mode & 0o777
+        else:
+            umask = os.umask(0)
+            os.umask(umask)
+            mode = 0o666 & ~umask
+        os.chmod(tmp_filename, mode)
+        os.rename(tmp_filename, filename)
+    except:
+        os.remove(tmp_filename)
+        raise
 
 def main():
     parser = argparse.ArgumentParser(description='Convert old poses to new motion format.')
@@ -13,29 +103,47 @@ def main():
     parser.add_argument('outfile', nargs='?',
                         help='output poses parameter file [default: stdout]',
                         default='/dev/stdout')
+    parser.add_argument('--binary', action='store_true',
+                        help='write the motions to a binary motion file, to be loaded with the '
+                             'motion_library/file parameter of play_motion')
 
     args = parser.parse_args()
 
     with open(args.infile) as f:
-        poses = yaml.load(f.read())
+        poses = yaml.safe_load(f.read())
 
     if poses is None:
         print("uh oh, nothing could be read from the input :(", file=sys.stderr)
         return
 
-    for n, toplevel in poses.iteritems():
+    for n, toplevel in poses.items():
         if 'poses' not in toplevel:
-            print("no poses to convert, I'm done here.", file=sys.stderr)
-            return
+            if not args.binary:
+                print("no poses to convert, I'm done here.", file=sys.stderr)
+                return
+            continue
         if not 'motions' in toplevel:
             toplevel['motions'] = {}
-        for pn, pose in toplevel['poses'].iteritems():
+        for pn, pose in toplevel['poses'].items():
             print("converting pose '{}'".format(pn), file=sys.stderr)
             joints, positions = [list(x) for x in zip(*pose.items())]
             points = {'positions': positions, 'time_from_start': 0.0}
             toplevel['motions'][pn] = {'joints': joints, 'points': [points]}
         del toplevel['poses']
 
+    if args.binary:
+        motions = {}
+        for toplevel in poses.values():
+            motions.update(toplevel.get('motions', {}))
+        print("writing {} motions to binary output file".format(len(motions)), file=sys.stderr)
+        try:
+            write_motion_file(motions, args.outfile)
+        except ValueError as e:
+            print("uh oh, {} :(".format(e), file=sys.stderr)
+            sys.exit(1)
+        print("finished! You're all set.", file=sys.stderr)
+        return
+
     print("writing to output file", file=sys.stderr)
     with open(args.outfile, "w") as f:
         yaml.dump(poses, f)
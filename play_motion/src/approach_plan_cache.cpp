@@ -0,0 +1,140 @@
+/*
+ * Software License Agreement (Modified BSD License)
+ *
+ *  Copyright (c) 2013, PAL Robotics, S.L.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of PAL Robotics, S.L. nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "play_motion/approach_plan_cache.h"
+
+#include <cmath>
+
+namespace play_motion
+{
+  bool ApproachPlanCache::Key::operator<(const Key& other) const
+  {
+    if (group != other.group) {return group < other.group;}
+    if (start != other.start) {return start < other.start;}
+    return goal < other.goal;
+  }
+
+  ApproachPlanCache::ApproachPlanCache(std::size_t capacity, double resolution)
+    : capacity_(capacity),
+      resolution_(resolution > 0.0 ? resolution : 1e-3)
+  {}
+
+  long ApproachPlanCache::quantise(double value) const
+  {
+    return static_cast<long>(std::floor(value / resolution_ + 0.5));
+  }
+
+  ApproachPlanCache::Key ApproachPlanCache::makeKey(const std::string&         group,
+                                                    const std::vector<double>& start,
+                                                    const std::vector<double>& goal) const
+  {
+    Key key;
+    key.group = group;
+    key.start.reserve(start.size());
+    key.goal.reserve(goal.size());
+    for (std::size_t i = 0; i < start.size(); ++i) {key.start.push_back(quantise(start[i]));}
+    for (std::size_t i = 0; i < goal.size(); ++i)  {key.goal.push_back(quantise(goal[i]));}
+    return key;
+  }
+
+  bool ApproachPlanCache::get(const std::string&                group,
+                              const std::vector<double>&        start,
+                              const std::vector<double>&        goal,
+                              trajectory_msgs::JointTrajectory& traj)
+  {
+    if (!isEnabled()) {return false;}
+    const Key key = makeKey(group, start, goal);
+
+    boost::mutex::scoped_lock lock(mutex_);
+    Index::iterator it = index_.find(key);
+    if (it == index_.end())
+    {
+      ++stats_.misses;
+      return false;
+    }
+    entries_.splice(entries_.begin(), entries_, it->second); // Mark as most recently used
+    traj = it->second->second;
+    ++stats_.hits;
+    return true;
+  }
+
+  void ApproachPlanCache::put(const std::string&                      group,
+                              const std::vector<double>&              start,
+                              const std::vector<double>&              goal,
+                              const trajectory_msgs::JointTrajectory& traj)
+  {
+    if (!isEnabled()) {return;}
+    const Key key = makeKey(group, start, goal);
+
+    boost::mutex::scoped_lock lock(mutex_);
+    Index::iterator it = index_.find(key);
+    if (it != index_.end())
+    {
+      it->second->second = traj;
+      entries_.splice(entries_.begin(), entries_, it->second);
+      return;
+    }
+    entries_.push_front(Entry(key, traj));
+    index_[key] = entries_.begin();
+    if (entries_.size() > capacity_)
+    {
+      index_.erase(entries_.back().first);
+      entries_.pop_back();
+    }
+  }
+
+  void ApproachPlanCache::reject(const std::string&         group,
+                                 const std::vector<double>& start,
+                                 const std::vector<double>& goal)
+  {
+    if (!isEnabled()) {return;}
+    const Key key = makeKey(group, start, goal);
+
+    boost::mutex::scoped_lock lock(mutex_);
+    ++stats_.rejected;
+    Index::iterator it = index_.find(key);
+    if (it == index_.end()) {return;}
+    entries_.erase(it->second);
+    index_.erase(it);
+  }
+
+  ApproachPlanCache::Stats ApproachPlanCache::getStats() const
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    Stats stats = stats_;
+    stats.size = entries_.size();
+    return stats;
+  }
+}
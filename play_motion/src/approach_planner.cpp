@@ -35,19 +35,25 @@
 /** \author Adolfo Rodriguez Tsouroukdissian. */
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cmath>
 #include <sstream>
 #include <string>
 
 #include <boost/foreach.hpp>
+#include <boost/thread/condition_variable.hpp>
 
 #include <ros/ros.h>
 #include <ros/callback_queue.h>
 #include <trajectory_msgs/JointTrajectory.h>
 #include <moveit/move_group_interface/move_group_interface.h>
+#include <moveit/planning_scene_monitor/planning_scene_monitor.h>
+#include <moveit/robot_trajectory/robot_trajectory.h>
+#include <moveit_msgs/RobotState.h>
 
 #include <play_motion/approach_planner.h>
+#include <play_motion/function_callback.h>
 #include <play_motion/xmlrpc_helpers.h>
 
 #define foreach BOOST_FOREACH
@@ -68,6 +74,44 @@ string enumerateElementsStr(const T& val)
   return ret;
 }
 
+/// Quintic polynomial with given boundary positions and velocities, and zero boundary accelerations.
+class QuinticSegment
+{
+public:
+  QuinticSegment() : duration_(0.0) {std::fill(coefs_, coefs_ + 6, 0.0);}
+
+  QuinticSegment(double pos_start, double vel_start, double pos_end, double vel_end, double duration)
+    : duration_(duration)
+  {
+    std::fill(coefs_, coefs_ + 6, 0.0);
+    coefs_[0] = pos_start;
+    if (duration <= 0.0)
+    {
+      coefs_[0] = pos_end;
+      return;
+    }
+    const double d  = pos_end - pos_start;
+    const double T  = duration;
+    const double T2 = T * T;
+    coefs_[1] = vel_start;
+    coefs_[3] = ( 20.0 * d - (8.0 * vel_end + 12.0 * vel_start) * T) / (2.0 * T2 * T);
+    coefs_[4] = (-30.0 * d + (14.0 * vel_end + 16.0 * vel_start) * T) / (2.0 * T2 * T2);
+    coefs_[5] = ( 12.0 * d - 6.0 * (vel_end + vel_start) * T) / (2.0 * T2 * T2 * T);
+  }
+
+  void sample(double time, double& pos, double& vel, double& acc) const
+  {
+    const double t = std::max(0.0, std::min(time, duration_));
+    pos = ((((coefs_[5] * t + coefs_[4]) * t + coefs_[3]) * t + coefs_[2]) * t + coefs_[1]) * t + coefs_[0];
+    vel = (((5.0 * coefs_[5] * t + 4.0 * coefs_[4]) * t + 3.0 * coefs_[3]) * t + 2.0 * coefs_[2]) * t + coefs_[1];
+    acc = ((20.0 * coefs_[5] * t + 12.0 * coefs_[4]) * t + 6.0 * coefs_[3]) * t + 2.0 * coefs_[2];
+  }
+
+private:
+  double coefs_[6];
+  double duration_;
+};
+
 typedef moveit::planning_interface::MoveGroupInterface MoveGroupInterface;
 typedef boost::shared_ptr<MoveGroupInterface> MoveGroupInterfacePtr;
 
@@ -85,18 +129,52 @@ string enumeratePlanningGroups(const std::vector<MoveGroupInterfacePtr>& move_gr
 namespace play_motion
 {
 
-ApproachPlanner::PlanningData::PlanningData(MoveGroupInterfacePtr move_group_ptr)
+ApproachPlanner::PlanningData::PlanningData(MoveGroupInterfacePtr move_group_ptr,
+                                            CallbackQueuePtr      cb_queue_ptr,
+                                            AsyncSpinnerPtr       spinner_ptr)
   : move_group(move_group_ptr),
-    sorted_joint_names(move_group_ptr->getActiveJoints())
+    sorted_joint_names(move_group_ptr->getActiveJoints()),
+    mutex(new boost::mutex()),
+    cb_queue(cb_queue_ptr),
+    spinner(spinner_ptr),
+    plan_queue(new ros::CallbackQueue()),
+    plan_spinner(new ros::AsyncSpinner(1, plan_queue.get()))
 {
   std::sort(sorted_joint_names.begin(), sorted_joint_names.end());
+  plan_spinner->start();
 }
 
+/// State of a planning request served by several planning groups at once.
+struct ApproachPlanner::ParallelPlanning
+{
+  enum Status {PENDING, SUCCEEDED, FAILED};
+
+  ParallelPlanning(unsigned int size) : status(size, PENDING), trajs(size), cancelled(false) {}
+
+  boost::mutex                                  mutex;
+  boost::condition_variable                     cond;
+  std::vector<Status>                           status; ///< Per planning group, in order of preference
+  std::vector<trajectory_msgs::JointTrajectory> trajs;
+  std::atomic<bool>                             cancelled; ///< A result was picked, jobs not planning yet are skipped
+};
+
+/// Local copy of the planning scene, kept in sync with the one of move_group.
+struct ApproachPlanner::SceneMonitor
+{
+  planning_scene_monitor::PlanningSceneMonitorPtr monitor;
+};
+
 ApproachPlanner::ApproachPlanner(const ros::NodeHandle& nh)
   : joint_tol_(1e-3),
     skip_planning_vel_(0.5),
     skip_planning_min_dur_(0.0),
-    planning_disabled_(false)
+    use_joint_limits_(false),
+    retime_motions_(false),
+    planning_disabled_(false),
+    parallel_planning_(false),
+    planning_time_(0.0),
+    plan_cache_(new ApproachPlanCache(0, 0.0)),
+    validate_cached_plans_(true)
 {
   ros::NodeHandle ap_nh(nh, "approach_planner");
 
@@ -120,6 +198,20 @@ ApproachPlanner::ApproachPlanner(const ros::NodeHandle& nh)
   else                      {ROS_DEBUG_STREAM("Min duration for unplanned approaches not specified. " <<
                                               "Using default value of " << skip_planning_min_dur_);}
 
+  // Joint limits, used for timing non-planned approaches and optionally whole motions. They are read from the robot
+  // description, then from the MoveIt joint limits, and finally from play_motion's own overrides
+  ap_nh.getParam("use_joint_limits", use_joint_limits_);
+  ap_nh.getParam("retime_motions", retime_motions_);
+  if (use_joint_limits_ || retime_motions_)
+  {
+    string urdf_xml;
+    if (ros::NodeHandle().getParam("robot_description", urdf_xml) && !getJointLimitsFromUrdf(urdf_xml, joint_limits_))
+      ROS_WARN("Could not parse the robot description, joint limits are not read from it.");
+    getJointLimitsFromParams(ros::NodeHandle("robot_description_planning/joint_limits"), joint_limits_);
+    getJointLimitsFromParams(ros::NodeHandle(ap_nh, "joint_limits"), joint_limits_);
+    ROS_DEBUG_STREAM("Using the limits of " << joint_limits_.size() << " joints for timing trajectories.");
+  }
+
   // Initialize motion planning capability, unless explicitly disabled
   nh.getParam("disable_motion_planning", planning_disabled_);
   if (planning_disabled_)
@@ -176,30 +268,92 @@ ApproachPlanner::ApproachPlanner(const ros::NodeHandle& nh)
   }
   catch(const xh::XmlrpcHelperException& ex) {throw ros::Exception(ex.what());}
 
-  // Move group instances require their own spinner thread. To isolate this asynchronous spinner from the rest of the
-  // node, it is set up in a node handle with a custom callback queue
-  ros::NodeHandle as_nh;
-  cb_queue_.reset(new ros::CallbackQueue());
-  as_nh.setCallbackQueue(cb_queue_.get());
-  spinner_.reset(new ros::AsyncSpinner(1, cb_queue_.get()));
-  spinner_->start();
+  // Cache of approach plans, which are looked up by their quantised start and goal positions
+  int plan_cache_size = 16;
+  double plan_cache_resolution = 0.01;
+  ap_nh.getParam("plan_cache/size", plan_cache_size);
+  ap_nh.getParam("plan_cache/resolution", plan_cache_resolution);
+  ap_nh.getParam("plan_cache/validate", validate_cached_plans_);
+  plan_cache_.reset(new ApproachPlanCache(std::max(plan_cache_size, 0), plan_cache_resolution));
+  if (plan_cache_->isEnabled())
+  {
+    ROS_DEBUG_STREAM("Caching up to " << plan_cache_size << " approach plans, with a resolution of " <<
+                     plan_cache_resolution << ".");
+  }
+  if (plan_cache_->isEnabled() && validate_cached_plans_)
+  {
+    // Cached plans are checked against a local copy of the planning scene, so that a whole plan is validated at once,
+    // without a service call per waypoint
+    scene_monitor_.reset(new SceneMonitor());
+    scene_monitor_->monitor.reset(new planning_scene_monitor::PlanningSceneMonitor("robot_description"));
+    if (scene_monitor_->monitor->getPlanningScene())
+    {
+      scene_monitor_->monitor->requestPlanningSceneState("/get_planning_scene");
+      scene_monitor_->monitor->startSceneMonitor("/move_group/monitored_planning_scene");
+      scene_monitor_->monitor->startStateMonitor();
+    }
+    else
+    {
+      ROS_WARN("Could not load the robot model to validate cached approach plans, they won't be reused.");
+      scene_monitor_.reset();
+    }
+  }
+
+  // Planning time budget per goal, and whether the eligible planning groups are tried at once
+  ap_nh.getParam("planning_time", planning_time_);
+  ap_nh.getParam("parallel_planning", parallel_planning_);
+  if (planning_time_ > 0.0) {ROS_DEBUG_STREAM("Using a planning time budget of " << planning_time_ << "s.");}
+  if (parallel_planning_)   {ROS_DEBUG("Planning approaches with all eligible planning groups at once.");}
 
   // Populate planning data
   foreach (const string& planning_group, planning_groups)
   {
+    // Move group instances require their own spinner thread. To isolate these asynchronous spinners from the rest of
+    // the node and from each other, each one is set up in a node handle with a custom callback queue
+    ros::NodeHandle as_nh;
+    CallbackQueuePtr cb_queue(new ros::CallbackQueue());
+    as_nh.setCallbackQueue(cb_queue.get());
+    AsyncSpinnerPtr spinner(new ros::AsyncSpinner(1, cb_queue.get()));
+    spinner->start();
+
     MoveGroupInterface::Options opts(planning_group);
     opts.node_handle_ = as_nh;
     MoveGroupInterfacePtr move_group(new MoveGroupInterface(opts)); // TODO: Timeout and retry, log feedback. Throw on failure
-    planning_data_.push_back(PlanningData(move_group));
+    planning_data_.push_back(PlanningData(move_group, cb_queue, spinner));
   }
 }
 
+ApproachPlanner::~ApproachPlanner()
+{
+  // Planning jobs use the move group instances, so they are stopped first
+  foreach (PlanningData& data, planning_data_) {data.plan_spinner->stop();}
+  foreach (PlanningData& data, planning_data_) {data.spinner->stop();}
+}
+
 // TODO: Work directly with JointStates and JointTrajector messages?
 bool ApproachPlanner::prependApproach(const JointNames&        joint_names,
                                       const vector<double>&    current_pos,
                                       bool                     skip_planning,
                                       const vector<TrajPoint>& traj_in,
                                             vector<TrajPoint>& traj_out)
+{
+  return prependApproach(joint_names, current_pos, skip_planning, true, traj_in, traj_out);
+}
+
+bool ApproachPlanner::prepareApproach(const JointNames&        joint_names,
+                                      const vector<double>&    start_pos,
+                                      const vector<TrajPoint>& traj_in,
+                                            vector<TrajPoint>& traj_out)
+{
+  return prependApproach(joint_names, start_pos, false, false, traj_in, traj_out);
+}
+
+bool ApproachPlanner::prependApproach(const JointNames&        joint_names,
+                                      const vector<double>&    current_pos,
+                                      bool                     skip_planning,
+                                      bool                     plan_from_current,
+                                      const vector<TrajPoint>& traj_in,
+                                            vector<TrajPoint>& traj_out)
 {
   // TODO: Instead of returning false, raise exceptions, so error message can be forwarded to goal result
 
@@ -230,18 +384,17 @@ bool ApproachPlanner::prependApproach(const JointNames&        joint_names,
     return false;
   }
 
+  // Recorded motions might be too fast for the robot
+  vector<TrajPoint> traj = traj_in;
+  retimeTrajectory(joint_names, traj);
+
   if (skip_planning)
   {
     // Skip motion planning altogether
-    traj_out = traj_in;
+    traj_out = traj;
 
-    // If the first waypoint specifies zero time from start, set a duration that does not exceed a specified
-    // max avg velocity
-    if (traj_out.front().time_from_start.isZero())
-    {
-      const double reach_time = noPlanningReachTime(current_pos, traj_out.front().positions);
-      foreach(TrajPoint& point, traj_out) {point.time_from_start += ros::Duration(reach_time);}
-    }
+    // If the first waypoint specifies zero time from start, set a duration that does not exceed the joint limits
+    if (traj_out.front().time_from_start.isZero()) {prependUnplannedApproach(joint_names, current_pos, 0.0, traj_out);}
   }
   else
   {
@@ -249,14 +402,15 @@ bool ApproachPlanner::prependApproach(const JointNames&        joint_names,
     trajectory_msgs::JointTrajectory approach;
     const bool approach_ok = computeApproach(joint_names,
                                              current_pos,
-                                             traj_in.front().positions,
+                                             traj.front().positions,
+                                             plan_from_current,
                                              approach);
     if (!approach_ok) {return false;}
 
     // No approach is required
     if (approach.points.empty())
     {
-      traj_out = traj_in;
+      traj_out = traj;
       ROS_INFO("Approach motion not needed.");
     }
     else
@@ -264,7 +418,7 @@ bool ApproachPlanner::prependApproach(const JointNames&        joint_names,
       // Combine approach and input motion trajectories
       combineTrajectories(joint_names,
                           current_pos,
-                          traj_in,
+                          traj,
                           approach,
                           traj_out);
     }
@@ -275,11 +429,7 @@ bool ApproachPlanner::prependApproach(const JointNames&        joint_names,
   const double eps_time = 1e-3; // NOTE: Magic number
   if (traj_out.front().time_from_start.isZero())
   {
-    const double reach_time = noPlanningReachTime(current_pos, traj_out.front().positions);
-    if (reach_time > eps_time)
-    {
-      foreach(TrajPoint& point, traj_out) {point.time_from_start += ros::Duration(reach_time);}
-    }
+    prependUnplannedApproach(joint_names, current_pos, eps_time, traj_out);
   }
   // 2 . First waypoint corresponds to current state: Make the first time_from_start a small nonzero value.
   // Rationale: Sending a waypoint with zero time from start will make the controllers complain with a warning, and
@@ -293,6 +443,12 @@ bool ApproachPlanner::prependApproach(const JointNames&        joint_names,
   return true;
 }
 
+void ApproachPlanner::retimeTrajectory(const JointNames& joint_names, vector<TrajPoint>& traj) const
+{
+  // Joints without velocity limits don't constrain the motion
+  if (retime_motions_) {enforceVelocityLimits(getJointLimits(joint_names, false), traj);}
+}
+
 bool ApproachPlanner::needsApproach(const std::vector<double>& current_pos,
                                     const std::vector<double>& goal_pos)
 {
@@ -307,6 +463,7 @@ bool ApproachPlanner::needsApproach(const std::vector<double>& current_pos,
 bool ApproachPlanner::computeApproach(const vector<string>&             joint_names,
                                       const vector<double>&             current_pos,
                                       const vector<double>&             goal_pos,
+                                      bool                              plan_from_current,
                                       trajectory_msgs::JointTrajectory& traj)
 {
   traj.joint_names.clear();
@@ -319,6 +476,9 @@ bool ApproachPlanner::computeApproach(const vector<string>&             joint_na
   // Joint positions associated to the maximum set
   vector<double> max_planning_values;
 
+  // Current joint positions of the maximum set
+  vector<double> max_planning_start;
+
   // Minimum set of joints that a planning group can have. Corresponds to the maximum set minus the joints that are
   // already at their goal configuration. If this set is empty, no approach is required, i.e. all motion joints are
   // either excluded from planning or already at the goal.
@@ -330,6 +490,7 @@ bool ApproachPlanner::computeApproach(const vector<string>&             joint_na
     {
       max_planning_group.push_back(joint_names[i]);
       max_planning_values.push_back(goal_pos[i]);
+      max_planning_start.push_back(current_pos[i]);
       if (std::abs(current_pos[i] - goal_pos[i]) > joint_tol_) {min_planning_group.push_back(joint_names[i]);}
     }
   }
@@ -352,12 +513,46 @@ bool ApproachPlanner::computeApproach(const vector<string>&             joint_na
                      << enumeratePlanningGroups(valid_move_groups) << ".");
   }
 
+  // Start state of the planners, empty if it's the current robot state
+  const vector<double> plan_start = plan_from_current ? vector<double>() : max_planning_start;
+
+  // Planning time budget, shared by all the planning groups
+  const ros::WallTime deadline = planning_time_ > 0.0 ? ros::WallTime::now() + ros::WallDuration(planning_time_)
+                                                      : ros::WallTime();
+
   // Call motion planners
   bool approach_ok = false;
-  foreach(MoveGroupInterfacePtr move_group, valid_move_groups)
+  if (parallel_planning_ && valid_move_groups.size() > 1)
+  {
+    // Cached plans are cheap to validate, so they are looked up before starting the planners
+    foreach(MoveGroupInterfacePtr move_group, valid_move_groups)
+    {
+      approach_ok = getCachedApproach(max_planning_group, max_planning_start, max_planning_values, move_group, traj);
+      if (approach_ok) {break;}
+    }
+
+    MoveGroupInterfacePtr move_group;
+    if (!approach_ok)
+    {
+      approach_ok = planApproachParallel(max_planning_group, max_planning_values, plan_start, valid_move_groups,
+                                         deadline, move_group, traj);
+      if (approach_ok) {plan_cache_->put(move_group->getName(), max_planning_start, max_planning_values, traj);}
+    }
+  }
+  else
   {
-    approach_ok = planApproach(max_planning_group, max_planning_values, move_group, traj);
-    if (approach_ok) {break;}
+    foreach(MoveGroupInterfacePtr move_group, valid_move_groups)
+    {
+      approach_ok = getCachedApproach(max_planning_group, max_planning_start, max_planning_values, move_group, traj);
+      if (approach_ok) {break;}
+
+      approach_ok = planApproach(max_planning_group, max_planning_values, plan_start, move_group, deadline, traj);
+      if (approach_ok)
+      {
+        plan_cache_->put(move_group->getName(), max_planning_start, max_planning_values, traj);
+        break;
+      }
+    }
   }
 
   if (!approach_ok)
@@ -372,10 +567,39 @@ bool ApproachPlanner::computeApproach(const vector<string>&             joint_na
 
 bool ApproachPlanner::planApproach(const JointNames&                 joint_names,
                                    const std::vector<double>&        joint_values,
+                                   const std::vector<double>&        start_values,
                                    MoveGroupInterfacePtr             move_group,
-                                   trajectory_msgs::JointTrajectory& traj)
+                                   const ros::WallTime&              deadline,
+                                   trajectory_msgs::JointTrajectory& traj,
+                                   const std::atomic<bool>*          cancelled)
 {
-  move_group->setStartStateToCurrentState();
+  // Move group instances can't process several planning requests at once, and goals are prepared concurrently
+  boost::mutex::scoped_lock lock(*getPlanningData(move_group).mutex);
+
+  // Give the planner whatever is left of the time budget
+  if (!deadline.isZero())
+  {
+    const double planning_time = (deadline - ros::WallTime::now()).toSec();
+    if (planning_time <= 0.0)
+    {
+      ROS_DEBUG_STREAM("Planning time budget exhausted before planning with group '" << move_group->getName() << "'.");
+      return false;
+    }
+    move_group->setPlanningTime(planning_time);
+  }
+
+  if (start_values.empty())
+  {
+    move_group->setStartStateToCurrentState();
+  }
+  else
+  {
+    moveit_msgs::RobotState start_state;
+    start_state.is_diff = true; // Joints not in the approach are at their current position
+    start_state.joint_state.name = joint_names;
+    start_state.joint_state.position = start_values;
+    move_group->setStartState(start_state);
+  }
   for (unsigned int i = 0; i < joint_names.size(); ++i)
   {
     const bool set_goal_ok = move_group->setJointValueTarget(joint_names[i], joint_values[i]);
@@ -386,6 +610,14 @@ bool ApproachPlanner::planApproach(const JointNames&                 joint_names
       return false;
     }
   }
+
+  // The request may have been dropped while waiting for the move group
+  if (cancelled && *cancelled)
+  {
+    ROS_DEBUG_STREAM("Planning with group '" << move_group->getName() << "' no longer needed.");
+    return false;
+  }
+
   moveit::planning_interface::MoveGroupInterface::Plan plan;
   const moveit::planning_interface::MoveItErrorCode planning_ok = move_group->plan(plan);
   if (!(planning_ok == moveit::planning_interface::MoveItErrorCode::SUCCESS))
@@ -405,6 +637,129 @@ bool ApproachPlanner::planApproach(const JointNames&                 joint_names
   return true;
 }
 
+bool ApproachPlanner::planApproachParallel(const JointNames&                         joint_names,
+                                           const std::vector<double>&                joint_values,
+                                           const std::vector<double>&                start_values,
+                                           const std::vector<MoveGroupInterfacePtr>& move_groups,
+                                           const ros::WallTime&                      deadline,
+                                           MoveGroupInterfacePtr&                    move_group,
+                                           trajectory_msgs::JointTrajectory&         traj)
+{
+  // Each planning group serves its requests in its own thread
+  boost::shared_ptr<ParallelPlanning> state(new ParallelPlanning(move_groups.size()));
+  for (unsigned int i = 0; i < move_groups.size(); ++i)
+  {
+    getPlanningData(move_groups[i]).plan_queue->addCallback(ros::CallbackInterfacePtr(new FunctionCallback(
+        boost::bind(&ApproachPlanner::planJob, this, state, i, joint_names, joint_values, start_values, move_groups[i],
+                    deadline))));
+  }
+
+  boost::mutex::scoped_lock lock(state->mutex);
+  unsigned int best = 0;
+  while (true)
+  {
+    // Most preferred group that has not failed yet
+    best = 0;
+    while (best < state->status.size() && ParallelPlanning::FAILED == state->status[best]) {++best;}
+    if (best == state->status.size()) {break;}
+    if (ParallelPlanning::SUCCEEDED == state->status[best]) {break;}
+
+    if (deadline.isZero())
+    {
+      state->cond.wait(lock);
+      continue;
+    }
+
+    const double time_left = (deadline - ros::WallTime::now()).toSec();
+    if (time_left <= 0.0 ||
+        !state->cond.timed_wait(lock, boost::posix_time::microseconds(static_cast<long>(time_left * 1e6))))
+    {
+      // Out of time, settle for the most preferred result available
+      while (best < state->status.size() && ParallelPlanning::SUCCEEDED != state->status[best]) {++best;}
+      if (best == state->status.size())
+      {
+        ROS_DEBUG_STREAM("Planning time budget exhausted while planning with groups: [" <<
+                         enumeratePlanningGroups(move_groups) << "].");
+      }
+      break;
+    }
+  }
+
+  // Planning requests that did not start yet are dropped. Running ones can't be interrupted, their results are ignored
+  state->cancelled = true;
+  if (best == state->status.size()) {return false;}
+
+  move_group = move_groups[best];
+  traj = state->trajs[best];
+  return true;
+}
+
+void ApproachPlanner::planJob(const boost::shared_ptr<ParallelPlanning>& state,
+                              unsigned int                               index,
+                              const JointNames&                          joint_names,
+                              const std::vector<double>&                 joint_values,
+                              const std::vector<double>&                 start_values,
+                              MoveGroupInterfacePtr                      move_group,
+                              const ros::WallTime&                       deadline)
+{
+  if (state->cancelled) {return;}
+
+  trajectory_msgs::JointTrajectory traj;
+  const bool approach_ok = planApproach(joint_names, joint_values, start_values, move_group, deadline, traj,
+                                        &state->cancelled);
+
+  boost::mutex::scoped_lock lock(state->mutex);
+  state->status[index] = approach_ok ? ParallelPlanning::SUCCEEDED : ParallelPlanning::FAILED;
+  if (approach_ok) {state->trajs[index] = traj;}
+  state->cond.notify_all();
+}
+
+const ApproachPlanner::PlanningData& ApproachPlanner::getPlanningData(const MoveGroupInterfacePtr& move_group) const
+{
+  std::vector<PlanningData>::const_iterator it = planning_data_.begin();
+  while (it != planning_data_.end() && it->move_group != move_group) {++it;}
+  assert(it != planning_data_.end());
+  return *it;
+}
+
+bool ApproachPlanner::getCachedApproach(const JointNames&                 joint_names,
+                                        const std::vector<double>&        current_pos,
+                                        const std::vector<double>&        goal_pos,
+                                        MoveGroupInterfacePtr             move_group,
+                                        trajectory_msgs::JointTrajectory& traj)
+{
+  if (!plan_cache_->get(move_group->getName(), current_pos, goal_pos, traj)) {return false;}
+
+  // The cached plan started from a state that was approximately the current one. Start from the exact current state
+  trajectory_msgs::JointTrajectoryPoint& first_point = traj.points.front();
+  for (unsigned int i = 0; i < traj.joint_names.size(); ++i)
+  {
+    JointNames::const_iterator it = std::find(joint_names.begin(), joint_names.end(), traj.joint_names[i]);
+    if (it != joint_names.end()) {first_point.positions[i] = current_pos[it - joint_names.begin()];}
+  }
+
+  if (validate_cached_plans_ && !isApproachValid(move_group->getName(), traj))
+  {
+    ROS_DEBUG_STREAM("Cached approach for planning group '" << move_group->getName() << "' is no longer valid.");
+    plan_cache_->reject(move_group->getName(), current_pos, goal_pos);
+    return false;
+  }
+
+  ROS_INFO_STREAM("Reusing cached approach computed with planning group '" << move_group->getName() << "'.");
+  return true;
+}
+
+bool ApproachPlanner::isApproachValid(const std::string& group_name, const trajectory_msgs::JointTrajectory& traj)
+{
+  if (!scene_monitor_) {return false;}
+
+  // Joints not in the approach are at their current position
+  planning_scene_monitor::LockedPlanningSceneRO scene(scene_monitor_->monitor);
+  robot_trajectory::RobotTrajectory path(scene->getRobotModel(), group_name);
+  path.setRobotTrajectoryMsg(scene->getCurrentState(), traj);
+  return scene->isPathValid(path, group_name);
+}
+
 void ApproachPlanner::combineTrajectories(const JointNames&                  joint_names,
                                           const std::vector<double>&         current_pos,
                                           const std::vector<TrajPoint>&      traj_in,
@@ -412,6 +767,29 @@ void ApproachPlanner::combineTrajectories(const JointNames&                  joi
                                           std::vector<TrajPoint>&            traj_out)
 {
   const unsigned int joint_dim = traj_in.front().positions.size();
+  const TrajPoint& motion_start = traj_in.front();
+  const bool has_motion_vel = motion_start.velocities.size() == joint_dim;
+
+  // Index of each motion joint in the approach plan, and blending polynomials for the joints not in it
+  vector<int> approach_ids(joint_dim, -1);
+  vector<QuinticSegment> blends(joint_dim);
+  const double duration = approach.points.back().time_from_start.toSec();
+  for (unsigned int i = 0; i < joint_dim; ++i)
+  {
+    const JointNames& plan_joints = approach.joint_names;
+    JointNames::const_iterator approach_joints_it = find(plan_joints.begin(), plan_joints.end(), joint_names[i]);
+    if (approach_joints_it != plan_joints.end())
+    {
+      approach_ids[i] = std::distance(plan_joints.begin(), approach_joints_it);
+    }
+    else
+    {
+      // Joint is not part of the planning group, and hence not contained in the approach plan. Like the planned
+      // joints, it starts at rest
+      const double vel_end = has_motion_vel ? motion_start.velocities[i] : 0.0;
+      blends[i] = QuinticSegment(current_pos[i], 0.0, motion_start.positions[i], vel_end, duration);
+    }
+  }
 
   foreach(const TrajPoint& point_appr, approach.points)
   {
@@ -422,35 +800,24 @@ void ApproachPlanner::combineTrajectories(const JointNames&                  joi
     if (has_velocities)    {point.velocities.resize(joint_dim, 0.0);}
     if (has_accelerations) {point.accelerations.resize(joint_dim, 0.0);}
     point.time_from_start = point_appr.time_from_start;
+    const double t = point_appr.time_from_start.toSec();
 
     for (unsigned int i = 0; i < joint_dim; ++i)
     {
-      const JointNames& plan_joints = approach.joint_names;
-      JointNames::const_iterator approach_joints_it = find(plan_joints.begin(), plan_joints.end(), joint_names[i]);
-      if (approach_joints_it != plan_joints.end())
+      const int approach_id = approach_ids[i];
+      if (approach_id >= 0)
       {
         // Joint is part of the planned approach
-        const unsigned int approach_id = std::distance(plan_joints.begin(), approach_joints_it);
         point.positions[i] = point_appr.positions[approach_id];
         if (has_velocities)    {point.velocities[i]    = point_appr.velocities[approach_id];}
         if (has_accelerations) {point.accelerations[i] = point_appr.accelerations[approach_id];}
       }
       else
       {
-        // Joint is not part of the planning group, and hence not contained in the approach plan
-        // Default to linear interpolation TODO: Use spline interpolator
-        const double t_min = 0.0;
-        const double t_max = approach.points.back().time_from_start.toSec();
-        const double t     = point_appr.time_from_start.toSec();
-
-        const double p_min = current_pos[i];
-        const double p_max = traj_in.front().positions[i];
-
-        const double vel = (p_max - p_min) / (t_max - t_min);
-
-        point.positions[i] = p_min + vel * t;
+        double vel, acc;
+        blends[i].sample(t, point.positions[i], vel, acc);
         if (has_velocities)    {point.velocities[i]    = vel;}
-        if (has_accelerations) {point.accelerations[i] = 0.0;}
+        if (has_accelerations) {point.accelerations[i] = acc;}
       }
     }
 
@@ -466,14 +833,20 @@ void ApproachPlanner::combineTrajectories(const JointNames&                  joi
   const ros::Duration offset = traj_out.back().time_from_start;
 
   // Remove duplicate waypoint: Position of last approach point coincides with the input's first point
+  std::vector<double> junction_vel;
+  junction_vel.swap(traj_out.back().velocities);
   traj_out.pop_back();
 
   // Append input trajectory to approach
+  const std::size_t junction_idx = traj_out.size();
   foreach(const TrajPoint& point, traj_in)
   {
     traj_out.push_back(point);
     traj_out.back().time_from_start += offset;
   }
+
+  // The junction keeps the velocities the approach ends with, which the blends matched, if the input has none
+  if (traj_out[junction_idx].velocities.empty()) {traj_out[junction_idx].velocities.swap(junction_vel);}
 }
 
 vector<ApproachPlanner::MoveGroupInterfacePtr> ApproachPlanner::getValidMoveGroups(const JointNames& min_group,
@@ -506,6 +879,49 @@ bool ApproachPlanner::isPlanningJoint(const string& joint_name) const
   return std::find(no_plan_joints_.begin(), no_plan_joints_.end(), joint_name) == no_plan_joints_.end();
 }
 
+void ApproachPlanner::prependUnplannedApproach(const JointNames&          joint_names,
+                                               const std::vector<double>& current_pos,
+                                               double                     min_reach_time,
+                                               std::vector<TrajPoint>&    traj)
+{
+  vector<TrajPoint> approach;
+  double reach_time = 0.0;
+  if (use_joint_limits_)
+  {
+    reach_time = getMinTimeApproach(current_pos, traj.front().positions, getJointLimits(joint_names, true),
+                                    skip_planning_min_dur_, approach);
+  }
+  else
+  {
+    reach_time = noPlanningReachTime(current_pos, traj.front().positions);
+  }
+
+  if (reach_time <= min_reach_time) {return;}
+  foreach(TrajPoint& point, traj) {point.time_from_start += ros::Duration(reach_time);}
+  if (approach.empty()) {return;}
+
+  // The approach profile ends at rest
+  TrajPoint& goal = traj.front();
+  if (goal.velocities.size() != goal.positions.size()) {goal.velocities.assign(goal.positions.size(), 0.0);}
+  traj.insert(traj.begin(), approach.begin(), approach.end());
+}
+
+vector<JointLimits> ApproachPlanner::getJointLimits(const JointNames& joint_names, bool approach_fallback) const
+{
+  vector<JointLimits> limits(joint_names.size());
+  for (unsigned int i = 0; i < joint_names.size(); ++i)
+  {
+    JointLimitsMap::const_iterator it = joint_limits_.find(joint_names[i]);
+    if (it != joint_limits_.end()) {limits[i] = it->second;}
+    if (approach_fallback && (!limits[i].has_velocity_limits || limits[i].max_velocity <= 0.0))
+    {
+      limits[i].has_velocity_limits = true;
+      limits[i].max_velocity = skip_planning_vel_;
+    }
+  }
+  return limits;
+}
+
 double ApproachPlanner::noPlanningReachTime(const std::vector<double>& curr_pos,
                                             const std::vector<double>& goal_pos)
 {
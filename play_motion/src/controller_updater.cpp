@@ -36,8 +36,11 @@
 
 #include "play_motion/controller_updater.h"
 
+#include <algorithm>
+
 #include <boost/foreach.hpp>
 #include <controller_manager_msgs/ListControllers.h>
+#include <std_msgs/Empty.h>
 
 #define foreach BOOST_FOREACH
 
@@ -50,14 +53,96 @@ namespace play_motion
         ("controller_manager/list_controllers", true);
   }
 
-  ControllerUpdater::ControllerUpdater(ros::NodeHandle nh) : nh_(nh)
+  static boost::posix_time::time_duration toBoostDuration(const ros::WallDuration& d)
+  {
+    return boost::posix_time::microseconds(d.toNSec() / 1000);
+  }
+
+  ControllerUpdater::ControllerUpdater(ros::NodeHandle nh)
+    : nh_(nh),
+      poll_period_(1.0),
+      max_retry_period_(10.0),
+      requested_updates_(0),
+      served_updates_(0),
+      last_update_ok_(false),
+      stop_(false)
   {
+    ros::NodeHandle private_nh("~");
+    double poll_period = poll_period_.toSec();
+    double max_retry_period = max_retry_period_.toSec();
+    private_nh.getParam("controller_updater/poll_period", poll_period);
+    private_nh.getParam("controller_updater/max_retry_period", max_retry_period);
+    poll_period_ = ros::WallDuration(std::max(poll_period, 0.01));
+    max_retry_period_ = ros::WallDuration(std::max(max_retry_period, poll_period));
+
+    // Optionally, manage only some of the controllers, leaving the rest to other instances
+    std::vector<std::string> whitelist;
+    private_nh.getParam("controller_updater/controllers", whitelist);
+    whitelist_.insert(whitelist.begin(), whitelist.end());
+    private_nh.getParam("controller_updater/namespace", namespace_);
+
     cm_client_ = initCmClient(nh_);
+    refresh_sub_ = private_nh.subscribe("refresh_controllers", 1, &ControllerUpdater::refreshCb, this);
     main_thread_ = boost::thread(&ControllerUpdater::mainLoop, this);
   }
 
   ControllerUpdater::~ControllerUpdater()
-  {}
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      stop_ = true;
+    }
+    cond_.notify_all();
+    refresh_sub_.shutdown();
+    if (main_thread_.joinable())
+      main_thread_.join();
+  }
+
+  void ControllerUpdater::registerUpdateCb(const Callback& cb)
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      update_cb_ = cb;
+    }
+    requestUpdate();
+  }
+
+  void ControllerUpdater::requestUpdate()
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      ++requested_updates_;
+    }
+    cond_.notify_all();
+  }
+
+  bool ControllerUpdater::update(const ros::WallDuration& timeout)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    const unsigned int request = ++requested_updates_;
+    cond_.notify_all();
+
+    const boost::system_time deadline = boost::get_system_time() + toBoostDuration(timeout);
+    while (static_cast<int>(served_updates_ - request) < 0 && !stop_)
+    {
+      if (!cond_.timed_wait(lock, deadline))
+        return false;
+    }
+    return last_update_ok_;
+  }
+
+  void ControllerUpdater::refreshCb(const std_msgs::EmptyConstPtr&)
+  {
+    ROS_DEBUG("Controller refresh requested.");
+    requestUpdate();
+  }
+
+  bool ControllerUpdater::isManaged(const std::string& controller_name) const
+  {
+    if (!whitelist_.empty() && whitelist_.find(controller_name) == whitelist_.end())
+      return false;
+    return controller_name.compare(0, namespace_.size(), namespace_) == 0;
+  }
 
   static bool isJointTrajectoryController(const std::string& name)
   {
@@ -73,40 +158,84 @@ namespace play_motion
 
   void ControllerUpdater::mainLoop()
   {
-    ros::Rate r(1.0); //XXX: magic value
-    for (; ros::ok(); r.sleep())
+    ros::WallDuration wait_period = poll_period_;
+    while (ros::ok())
     {
-      if (!update_cb_)
-        continue;
-
-      controller_manager_msgs::ListControllers srv;
-
-      if (!cm_client_.isValid())
-        cm_client_ = initCmClient(nh_);
-      if(!cm_client_.call(srv))
+      unsigned int request;
       {
-        ROS_WARN_THROTTLE(5.0, "Could not get list of controllers from controller manager.");
-        continue;
+        // Wait for the next poll, unless an update is requested earlier
+        boost::mutex::scoped_lock lock(mutex_);
+        const boost::system_time deadline = boost::get_system_time() + toBoostDuration(wait_period);
+        while (requested_updates_ == served_updates_ && !stop_)
+        {
+          if (!cond_.timed_wait(lock, deadline))
+            break;
+        }
+        if (stop_)
+          return;
+        request = requested_updates_;
       }
 
-      ControllerStates states;
-      ControllerJoints joints;
-      typedef controller_manager_msgs::ControllerState cstate_t;
-      foreach (const cstate_t& cs, srv.response.controller)
+      const bool ok = fetchControllers();
+
       {
-        if (!isJointTrajectoryController(cs.type))
-          continue;
-        states[cs.name] = (cs.state == "running" ? RUNNING : STOPPED);
-        joints[cs.name] = cs.claimed_resources[0].resources;
+        boost::mutex::scoped_lock lock(mutex_);
+        served_updates_ = request;
+        last_update_ok_ = ok;
       }
+      cond_.notify_all();
 
-      if (states == last_cstates_)
-        continue;
+      // Back off while the controller manager is unavailable
+      if (ok)
+        wait_period = poll_period_;
+      else
+        wait_period = std::min(ros::WallDuration(wait_period.toSec() * 2.0), max_retry_period_);
+    }
+  }
+
+  bool ControllerUpdater::fetchControllers()
+  {
+    Callback update_cb;
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      update_cb = update_cb_;
+    }
+    if (!update_cb)
+      return true; // Nobody interested in the controllers yet
+
+    controller_manager_msgs::ListControllers srv;
+
+    if (!cm_client_.isValid())
+      cm_client_ = initCmClient(nh_);
+    if(!cm_client_.call(srv))
+    {
+      ROS_WARN_THROTTLE(5.0, "Could not get list of controllers from controller manager.");
+      return false;
+    }
 
-      ROS_INFO("The set of running joint trajectory controllers has changed, updating it.");
-      update_timer_ = nh_.createTimer(ros::Duration(0), boost::bind(update_cb_, states, joints), true);
-      last_cstates_ = states;
+    ControllerStates states;
+    ControllerJoints joints;
+    typedef controller_manager_msgs::ControllerState cstate_t;
+    foreach (const cstate_t& cs, srv.response.controller)
+    {
+      if (!isJointTrajectoryController(cs.type))
+        continue;
+      if (cs.claimed_resources.empty())
+        continue;
+      if (!isManaged(cs.name))
+        continue;
+      states[cs.name] = (cs.state == "running" ? RUNNING : STOPPED);
+      joints[cs.name] = cs.claimed_resources[0].resources;
     }
+
+    if (states == last_cstates_ && joints == last_cjoints_)
+      return true;
+
+    ROS_INFO("The set of running joint trajectory controllers has changed, updating it.");
+    update_cb(states, joints);
+    last_cstates_ = states;
+    last_cjoints_ = joints;
+    return true;
   }
 
 }
@@ -0,0 +1,212 @@
+/*
+ * Software License Agreement (Modified BSD License)
+ *
+ *  Copyright (c) 2013, PAL Robotics, S.L.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of PAL Robotics, S.L. nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "play_motion/joint_limits.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include <boost/foreach.hpp>
+
+#include <ros/ros.h>
+#include <urdf/model.h>
+
+#define foreach BOOST_FOREACH
+
+namespace
+{
+  const double INF = std::numeric_limits<double>::infinity();
+
+  /// \return Waypoint at the given position of the normalised path from \p start to \p goal.
+  play_motion::TrajPoint makePathPoint(const std::vector<double>& start, const std::vector<double>& goal,
+                                       double s, double s_vel, double time)
+  {
+    play_motion::TrajPoint point;
+    point.positions.resize(start.size());
+    point.velocities.resize(start.size());
+    for (std::size_t i = 0; i < start.size(); ++i)
+    {
+      point.positions[i]  = start[i] + s * (goal[i] - start[i]);
+      point.velocities[i] = s_vel * (goal[i] - start[i]);
+    }
+    point.time_from_start = ros::Duration(time);
+    return point;
+  }
+}
+
+namespace play_motion
+{
+  bool getJointLimitsFromUrdf(const std::string& urdf_xml, JointLimitsMap& limits)
+  {
+    urdf::Model model;
+    if (!model.initString(urdf_xml))
+      return false;
+
+    typedef std::pair<const std::string, urdf::JointSharedPtr> urdf_joint_pair_t;
+    foreach (const urdf_joint_pair_t& p, model.joints_)
+    {
+      if (!p.second->limits || p.second->limits->velocity <= 0.0)
+        continue;
+      JointLimits& joint_limits = limits[p.first];
+      joint_limits.has_velocity_limits = true;
+      joint_limits.max_velocity = p.second->limits->velocity;
+    }
+    return true;
+  }
+
+  void getJointLimitsFromParams(const ros::NodeHandle& nh, JointLimitsMap& limits)
+  {
+    XmlRpc::XmlRpcValue xml_limits;
+    if (!nh.getParam(nh.getNamespace(), xml_limits) || xml_limits.getType() != XmlRpc::XmlRpcValue::TypeStruct)
+      return;
+
+    for (XmlRpc::XmlRpcValue::iterator it = xml_limits.begin(); it != xml_limits.end(); ++it)
+    {
+      const std::string& joint = it->first;
+      JointLimits& joint_limits = limits[joint];
+      nh.getParam(joint + "/has_velocity_limits", joint_limits.has_velocity_limits);
+      nh.getParam(joint + "/max_velocity", joint_limits.max_velocity);
+      nh.getParam(joint + "/has_acceleration_limits", joint_limits.has_acceleration_limits);
+      nh.getParam(joint + "/max_acceleration", joint_limits.max_acceleration);
+    }
+  }
+
+  double getMinTimeApproach(const std::vector<double>&      start,
+                            const std::vector<double>&      goal,
+                            const std::vector<JointLimits>& limits,
+                            double                          min_duration,
+                            std::vector<TrajPoint>&         points)
+  {
+    points.clear();
+
+    // Limits of the normalised path coordinate s, which goes from 0 at the start to 1 at the goal
+    double max_vel = INF;
+    double max_acc = INF;
+    for (std::size_t i = 0; i < start.size(); ++i)
+    {
+      const double d = std::abs(goal[i] - start[i]);
+      if (d == 0.0)
+        continue;
+      if (limits[i].has_velocity_limits && limits[i].max_velocity > 0.0)
+        max_vel = std::min(max_vel, limits[i].max_velocity / d);
+      if (limits[i].has_acceleration_limits && limits[i].max_acceleration > 0.0)
+        max_acc = std::min(max_acc, limits[i].max_acceleration / d);
+    }
+
+    double duration = 0.0;
+    double t_acc    = 0.0; // Duration of the acceleration phase
+    double vel      = 0.0; // Peak velocity
+    if (max_acc == INF)
+    {
+      // A cubic segment from rest to rest peaks at 1.5 times its average velocity
+      if (max_vel != INF)
+        duration = 1.5 / max_vel;
+    }
+    else if (max_vel * max_vel >= max_acc)
+    {
+      // Triangular profile, the velocity limit is never reached
+      t_acc    = std::sqrt(1.0 / max_acc);
+      duration = 2.0 * t_acc;
+      vel      = max_acc * t_acc;
+    }
+    else
+    {
+      // Trapezoidal profile
+      t_acc    = max_vel / max_acc;
+      duration = 1.0 / max_vel + t_acc;
+      vel      = max_vel;
+    }
+
+    // Short approaches are slowed down by stretching their profile
+    double scale = 1.0;
+    if (duration < min_duration)
+    {
+      if (duration > 0.0)
+        scale = min_duration / duration;
+      duration = min_duration;
+    }
+    if (t_acc == 0.0)
+      return duration;
+
+    const double s_acc = 0.5 * vel * t_acc; // Path covered while accelerating
+    points.push_back(makePathPoint(start, goal, s_acc, vel / scale, t_acc * scale));
+    if (duration - 2.0 * t_acc * scale > 1e-6) // NOTE: Magic number
+      points.push_back(makePathPoint(start, goal, 1.0 - s_acc, vel / scale, duration - t_acc * scale));
+    return duration;
+  }
+
+  void enforceVelocityLimits(const std::vector<JointLimits>& limits, Trajectory& traj)
+  {
+    double delay = 0.0;
+    for (std::size_t i = 1; i < traj.size(); ++i)
+    {
+      const TrajPoint& prev = traj[i - 1];
+      TrajPoint&       curr = traj[i];
+
+      // Original segment duration, the previous waypoint was already delayed
+      const double dt = curr.time_from_start.toSec() + delay - prev.time_from_start.toSec();
+      double min_dt = 0.0;
+      for (std::size_t j = 0; j < limits.size(); ++j)
+      {
+        if (limits[j].has_velocity_limits && limits[j].max_velocity > 0.0)
+          min_dt = std::max(min_dt, std::abs(curr.positions[j] - prev.positions[j]) / limits[j].max_velocity);
+      }
+      if (min_dt > dt)
+        delay += min_dt - dt;
+      curr.time_from_start = ros::Duration(curr.time_from_start.toSec() + delay);
+    }
+
+    foreach (TrajPoint& point, traj)
+    {
+      for (std::size_t j = 0; j < point.velocities.size() && j < limits.size(); ++j)
+      {
+        if (limits[j].has_velocity_limits && limits[j].max_velocity > 0.0)
+          point.velocities[j] = std::max(-limits[j].max_velocity,
+                                         std::min(point.velocities[j], limits[j].max_velocity));
+      }
+    }
+  }
+
+  void scaleTrajectory(double scale, Trajectory& traj)
+  {
+    const double acc_scale = scale * scale;
+    foreach (TrajPoint& point, traj)
+    {
+      point.time_from_start = ros::Duration(point.time_from_start.toSec() * scale);
+      foreach (double& vel, point.velocities) {vel /= scale;}
+      foreach (double& acc, point.accelerations) {acc /= acc_scale;}
+    }
+  }
+}
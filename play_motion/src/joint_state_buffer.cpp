@@ -0,0 +1,181 @@
+/*
+ * Software License Agreement (Modified BSD License)
+ *
+ *  Copyright (c) 2013, PAL Robotics, S.L.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of PAL Robotics, S.L. nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "play_motion/joint_state_buffer.h"
+
+#include <algorithm>
+#include <limits>
+
+#include <boost/foreach.hpp>
+#include <sensor_msgs/JointState.h>
+
+#define foreach BOOST_FOREACH
+
+namespace play_motion
+{
+  /// Joint names of a message layout, and the latest values received with it.
+  struct JointStateBuffer::Layout
+  {
+    Layout(const JointNames& joint_names)
+      : names(joint_names),
+        positions(joint_names.size()),
+        velocities(joint_names.size()),
+        seq(0),
+        stale(false)
+    {}
+
+    JointNames                        names;
+    std::vector<std::atomic<double> > positions;
+    std::vector<std::atomic<double> > velocities;
+    std::atomic<unsigned int>         seq;   ///< Odd while an update is in progress
+    std::atomic<bool>                 stale; ///< Set when a new layout replaces this one
+  };
+
+  JointStateBuffer::JointStateBuffer()
+    : layout_(new Layout(JointNames()))
+  {}
+
+  JointStateBuffer::LayoutPtr JointStateBuffer::getLayout() const
+  {
+    boost::mutex::scoped_lock lock(layout_mutex_);
+    return layout_;
+  }
+
+  void JointStateBuffer::update(const sensor_msgs::JointState& msg)
+  {
+    const std::size_t joint_dim = msg.name.size();
+    if (msg.position.size() != joint_dim || (!msg.velocity.empty() && msg.velocity.size() != joint_dim))
+    {
+      ROS_WARN_STREAM_THROTTLE(1.0, "Ignoring joint state message: the number of names, positions and velocities "
+                               "differ.");
+      return;
+    }
+
+    // Only the update thread modifies the layout, so it can be read here without locking
+    const bool layout_changed = layout_->names != msg.name;
+    LayoutPtr layout = layout_changed ? LayoutPtr(new Layout(msg.name)) : layout_;
+
+    const unsigned int seq = layout->seq.load(std::memory_order_relaxed);
+    layout->seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (std::size_t i = 0; i < joint_dim; ++i)
+    {
+      layout->positions[i].store(msg.position[i], std::memory_order_relaxed);
+      layout->velocities[i].store(msg.velocity.empty() ? 0.0 : msg.velocity[i], std::memory_order_relaxed);
+    }
+    layout->seq.store(seq + 2, std::memory_order_release);
+
+    // New layouts are published once they hold values
+    if (layout_changed)
+    {
+      ROS_DEBUG_STREAM("Joint state layout changed, now with " << joint_dim << " joints.");
+      {
+        boost::mutex::scoped_lock lock(layout_mutex_);
+        layout_.swap(layout);
+      }
+      layout->stale.store(true, std::memory_order_release); // Previous layout
+    }
+  }
+
+  bool JointStateBuffer::read(Selection& selection, std::vector<double>& positions,
+                              std::vector<double>& velocities) const
+  {
+    return read(selection, positions, &velocities, false);
+  }
+
+  bool JointStateBuffer::read(Selection& selection, std::vector<double>& positions) const
+  {
+    return read(selection, positions, 0, false);
+  }
+
+  void JointStateBuffer::readAvailable(Selection& selection, std::vector<double>& positions) const
+  {
+    read(selection, positions, 0, true);
+  }
+
+  bool JointStateBuffer::read(Selection& selection, std::vector<double>& positions,
+                              std::vector<double>* velocities, bool allow_missing) const
+  {
+    const std::size_t npos = std::numeric_limits<std::size_t>::max();
+
+    // Resolve joint indices if the layout changed since the last read
+    if (!selection.layout_ || selection.layout_->stale.load(std::memory_order_acquire))
+    {
+      selection.layout_ = getLayout();
+      selection.indices_.assign(selection.joints_.size(), npos);
+      const JointNames& names = selection.layout_->names;
+      for (std::size_t i = 0; i < selection.joints_.size(); ++i)
+      {
+        JointNames::const_iterator it = std::find(names.begin(), names.end(), selection.joints_[i]);
+        if (it != names.end())
+          selection.indices_[i] = it - names.begin();
+      }
+    }
+
+    if (!allow_missing)
+    {
+      foreach (std::size_t index, selection.indices_)
+        if (index == npos)
+          return false;
+    }
+
+    const Layout& layout = *selection.layout_;
+    const std::size_t joint_dim = selection.indices_.size();
+    positions.resize(joint_dim);
+    if (velocities)
+      velocities->resize(joint_dim);
+
+    unsigned int seq_begin, seq_end;
+    do
+    {
+      seq_begin = layout.seq.load(std::memory_order_acquire);
+      for (std::size_t i = 0; i < joint_dim; ++i)
+      {
+        if (selection.indices_[i] == npos)
+        {
+          positions[i] = std::numeric_limits<double>::quiet_NaN(); // Only when missing joints are allowed
+          continue;
+        }
+        positions[i] = layout.positions[selection.indices_[i]].load(std::memory_order_relaxed);
+        if (velocities)
+          (*velocities)[i] = layout.velocities[selection.indices_[i]].load(std::memory_order_relaxed);
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+      seq_end = layout.seq.load(std::memory_order_relaxed);
+    } while ((seq_begin & 1) || seq_begin != seq_end);
+
+    return true;
+  }
+}
@@ -0,0 +1,129 @@
+/*
+ * Software License Agreement (Modified BSD License)
+ *
+ *  Copyright (c) 2013, PAL Robotics, S.L.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of PAL Robotics, S.L. nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "play_motion/latency_stats.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+  /// Nearest-rank percentile of sorted values.
+  double percentile(const std::vector<double>& sorted, double p)
+  {
+    const std::size_t rank = static_cast<std::size_t>(std::ceil(p * sorted.size()));
+    return sorted[std::max(rank, std::size_t(1)) - 1];
+  }
+
+  play_motion::LatencyStats::Percentiles computePercentiles(std::vector<double>& values)
+  {
+    std::sort(values.begin(), values.end());
+    play_motion::LatencyStats::Percentiles p;
+    p.p50 = percentile(values, 0.50);
+    p.p95 = percentile(values, 0.95);
+    p.p99 = percentile(values, 0.99);
+    return p;
+  }
+}
+
+namespace play_motion
+{
+  double LatencyStats::Timing::getTotal() const
+  {
+    double total = 0.0;
+    for (std::size_t i = 0; i < durations.size(); ++i)
+      total += durations[i];
+    return total;
+  }
+
+  LatencyStats::LatencyStats(std::size_t window_size)
+    : window_size_(std::max(window_size, std::size_t(1))),
+      count_(0)
+  {}
+
+  const char* LatencyStats::getStageName(Stage stage)
+  {
+    switch (stage)
+    {
+      case MOTION_FETCH:          return "motion fetch";
+      case CONTROLLER_LOOKUP:     return "controller lookup";
+      case QUEUED:                return "queued";
+      case APPROACH_PLANNING:     return "approach planning";
+      case TRAJECTORY_PROCESSING: return "trajectory processing";
+      case GOAL_SPLIT:            return "goal split";
+      case GOAL_SEND:             return "goal send";
+      default:                    return "unknown";
+    }
+  }
+
+  void LatencyStats::add(const Timing& timing)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    if (samples_.size() < window_size_)
+      samples_.push_back(timing);
+    else
+      samples_[count_ % window_size_] = timing;
+    ++count_;
+  }
+
+  std::size_t LatencyStats::getCount() const
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return count_;
+  }
+
+  bool LatencyStats::getPercentiles(std::vector<Percentiles>& stages, Percentiles& total) const
+  {
+    std::vector<Timing> samples;
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      samples = samples_;
+    }
+    if (samples.empty())
+      return false;
+
+    std::vector<double> values(samples.size());
+    stages.resize(NUM_STAGES);
+    for (std::size_t stage = 0; stage < NUM_STAGES; ++stage)
+    {
+      for (std::size_t i = 0; i < samples.size(); ++i)
+        values[i] = samples[i].durations[stage];
+      stages[stage] = computePercentiles(values);
+    }
+    for (std::size_t i = 0; i < samples.size(); ++i)
+      values[i] = samples[i].getTotal();
+    total = computePercentiles(values);
+    return true;
+  }
+}
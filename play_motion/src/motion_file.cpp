@@ -0,0 +1,234 @@
+/*
+ * Software License Agreement (Modified BSD License)
+ *
+ *  Copyright (c) 2013, PAL Robotics, S.L.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of PAL Robotics, S.L. nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "play_motion/motion_file.h"
+
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <boost/cstdint.hpp>
+#include <ros/ros.h>
+
+namespace
+{
+  const char        MAGIC[]     = "PMLIB001";
+  const std::size_t MAGIC_SIZE  = 8;
+  const std::size_t HEADER_SIZE = MAGIC_SIZE + 2 * sizeof(boost::uint32_t);
+
+  /// Size of an index record with empty strings and no joints: four strings, the number of joints, the number of
+  /// waypoints, the flags, the duration and the offset.
+  const std::size_t MIN_RECORD_SIZE = 7 * sizeof(boost::uint32_t) + sizeof(double) + sizeof(boost::uint64_t);
+
+  /// Sequential reader of the values of a mapped file, checking that they are within bounds.
+  class Reader
+  {
+  public:
+    Reader(const char* data, std::size_t size, std::size_t pos, const std::string& path)
+      : data_(data), size_(size), pos_(pos), path_(path)
+    {}
+
+    template <class T>
+    T read()
+    {
+      T value;
+      std::memcpy(&value, get(sizeof(T)), sizeof(T));
+      return value;
+    }
+
+    std::string readString()
+    {
+      const boost::uint32_t length = read<boost::uint32_t>();
+      return std::string(get(length), length);
+    }
+
+    /// \brief Read the number of elements that follow, checking that they fit in the rest of the file before
+    /// anything is allocated for them.
+    /// \param min_size Number of bytes taken by an element, at least.
+    std::size_t readCount(std::size_t min_size)
+    {
+      const boost::uint32_t count = read<boost::uint32_t>();
+      if (count > (size_ - pos_) / min_size)
+        throw ros::Exception("Motion file '" + path_ + "' is truncated.");
+      return count;
+    }
+
+  private:
+    const char* get(std::size_t bytes)
+    {
+      if (bytes > size_ - pos_)
+        throw ros::Exception("Motion file '" + path_ + "' is truncated.");
+      const char* ptr = data_ + pos_;
+      pos_ += bytes;
+      return ptr;
+    }
+
+    const char*        data_;
+    std::size_t        size_;
+    std::size_t        pos_;
+    const std::string& path_;
+  };
+
+  /// \throws ros::Exception if \p secs is not a valid duration, e.g. in a corrupt file.
+  ros::Duration toDuration(double secs, const std::string& path, const std::string& motion_id)
+  {
+    if (!std::isfinite(secs) || secs < 0.0 || secs >= std::numeric_limits<boost::int32_t>::max())
+      throw ros::Exception("Motion file '" + path + "' has an invalid time for motion '" + motion_id + "'.");
+    return ros::Duration(secs);
+  }
+
+  /// Copy the velocities (or accelerations) of a waypoint, leaving them empty if the waypoint has none.
+  void readOptional(const double* values, std::size_t num_joints, std::vector<double>& out)
+  {
+    out.clear();
+    if (num_joints == 0 || std::isnan(values[0]))
+      return;
+    out.assign(values, values + num_joints);
+  }
+}
+
+namespace play_motion
+{
+  MotionFile::MotionFile(const std::string& path)
+    : path_(path),
+      data_(0),
+      size_(0)
+  {
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      throw ros::Exception("Could not open motion file '" + path + "': " + std::strerror(errno));
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(HEADER_SIZE))
+    {
+      ::close(fd);
+      throw ros::Exception("Motion file '" + path + "' is not a valid motion file.");
+    }
+    size_ = st.st_size;
+
+    // The mapping stays valid after closing the file
+    void* data = ::mmap(0, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED)
+      throw ros::Exception("Could not map motion file '" + path + "': " + std::strerror(errno));
+    data_ = static_cast<const char*>(data);
+
+    try
+    {
+      if (std::memcmp(data_, MAGIC, MAGIC_SIZE) != 0)
+        throw ros::Exception("Motion file '" + path + "' is not a valid motion file.");
+
+      Reader reader(data_, size_, MAGIC_SIZE, path_);
+      const std::size_t num_motions = reader.readCount(MIN_RECORD_SIZE);
+      reader.read<boost::uint32_t>(); // Reserved
+
+      records_.resize(num_motions);
+      for (std::size_t i = 0; i < num_motions; ++i)
+      {
+        Record& record = records_[i];
+        record.id          = reader.readString();
+        record.name        = reader.readString();
+        record.usage       = reader.readString();
+        record.description = reader.readString();
+        record.joints.resize(reader.readCount(sizeof(boost::uint32_t)));
+        for (std::size_t j = 0; j < record.joints.size(); ++j)
+          record.joints[j] = reader.readString();
+        record.num_points = reader.read<boost::uint32_t>();
+        record.flags      = reader.read<boost::uint32_t>();
+        record.duration   = toDuration(reader.read<double>(), path_, record.id);
+        const boost::uint64_t offset = reader.read<boost::uint64_t>();
+
+        // Check that the waypoints block is within the file. The number of joints is bounded by the file size, so
+        // the size of a waypoint does not overflow, but the size of the block might
+        const std::size_t values_per_point = 1 + record.joints.size() * (1 + bool(record.flags & HAS_VELOCITIES)
+                                                                          + bool(record.flags & HAS_ACCELERATIONS));
+        const std::size_t point_size = values_per_point * sizeof(double);
+        if (offset % sizeof(double) != 0 || offset > size_ || record.num_points > (size_ - offset) / point_size)
+          throw ros::Exception("Motion file '" + path + "' has an invalid waypoints block for motion '" +
+                               record.id + "'.");
+        record.offset = offset;
+      }
+    }
+    catch (const std::exception&)
+    {
+      // Also out of memory errors, so that the mapping is not leaked
+      ::munmap(const_cast<char*>(data_), size_);
+      throw;
+    }
+  }
+
+  MotionFile::~MotionFile()
+  {
+    ::munmap(const_cast<char*>(data_), size_);
+  }
+
+  void MotionFile::getMotion(std::size_t index, MotionInfo& motion) const
+  {
+    const Record& record = records_.at(index);
+    const std::size_t num_joints = record.joints.size();
+
+    motion.id          = record.id;
+    motion.name        = record.name;
+    motion.usage       = record.usage;
+    motion.description = record.description;
+    motion.joints      = record.joints;
+    motion.traj.resize(record.num_points);
+
+    // Blocks are 8 byte aligned, so the values can be read in place
+    const double* values = reinterpret_cast<const double*>(data_ + record.offset);
+    for (std::size_t i = 0; i < record.num_points; ++i)
+    {
+      TrajPoint& point = motion.traj[i];
+      point.time_from_start = toDuration(*values++, path_, record.id);
+      point.positions.assign(values, values + num_joints);
+      values += num_joints;
+      if (record.flags & HAS_VELOCITIES)
+      {
+        readOptional(values, num_joints, point.velocities);
+        values += num_joints;
+      }
+      if (record.flags & HAS_ACCELERATIONS)
+      {
+        readOptional(values, num_joints, point.accelerations);
+        values += num_joints;
+      }
+    }
+  }
+}
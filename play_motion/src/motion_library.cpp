@@ -0,0 +1,433 @@
+/*
+ * Software License Agreement (Modified BSD License)
+ *
+ *  Copyright (c) 2013, PAL Robotics, S.L.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of PAL Robotics, S.L. nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "play_motion/motion_library.h"
+
+#include <algorithm>
+
+#include <boost/functional/hash.hpp>
+#include <XmlRpcException.h>
+
+#include "play_motion/play_motion.h"
+#include "play_motion/play_motion_helpers.h"
+#include "play_motion/xmlrpc_helpers.h"
+
+namespace
+{
+  using namespace play_motion;
+
+  /// \return Empty string if the motion is valid, a description of the problem otherwise.
+  std::string validateMotion(const MotionInfo& info)
+  {
+    if (info.joints.empty())
+      return "motion has no joints";
+
+    // Same checks as the trajectories sent to the controllers, so motions that would fail on every goal are reported
+    // when they are loaded
+    try
+    {
+      validateTrajectory(info.traj, info.joints.size());
+    }
+    catch (const ros::Exception& e)
+    {
+      return e.what();
+    }
+    return std::string();
+  }
+
+  /// \return Hash of the parts of a motion parameter that play_motion reads.
+  std::size_t motionFingerprint(const XmlRpc::XmlRpcValue& param)
+  {
+    std::size_t seed = 0;
+    if (param.getType() != XmlRpc::XmlRpcValue::TypeStruct)
+    {
+      boost::hash_combine(seed, param.toXml());
+      return seed;
+    }
+
+    const char* members[] = {"joints", "points", "meta"};
+    XmlRpc::XmlRpcValue& p = const_cast<XmlRpc::XmlRpcValue&>(param); // XXX: XmlRpcValue::operator[] is not const
+    for (unsigned int i = 0; i < sizeof(members) / sizeof(members[0]); ++i)
+    {
+      boost::hash_combine(seed, std::string(members[i]));
+      if (p.hasMember(members[i]))
+        boost::hash_combine(seed, p[members[i]].toXml());
+    }
+    return seed;
+  }
+} // unnamed namespace
+
+namespace play_motion
+{
+  MotionLibrary::MotionLibrary(const ros::NodeHandle& nh)
+    : nh_(new ros::NodeHandle(nh)),
+      entries_(new Entries)
+  {}
+
+  MotionLibrary::MotionLibrary()
+    : entries_(new Entries)
+  {}
+
+  MotionLibrary::~MotionLibrary()
+  {
+    watch_thread_.interrupt();
+    if (watch_thread_.joinable())
+      watch_thread_.join();
+  }
+
+  MotionLibrary::EntriesConstPtr MotionLibrary::getEntries() const
+  {
+    boost::mutex::scoped_lock lock(entries_mutex_);
+    return entries_;
+  }
+
+  void MotionLibrary::setEntries(const EntriesConstPtr& entries)
+  {
+    boost::mutex::scoped_lock lock(entries_mutex_);
+    entries_ = entries;
+  }
+
+  void MotionLibrary::load()
+  {
+    {
+      boost::mutex::scoped_lock update_lock(update_mutex_);
+      setEntries(EntriesConstPtr(new Entries));
+
+      std::string file_path;
+      file_.reset();
+      if (nh_ && nh_->getParam("motion_library/file", file_path) && !file_path.empty())
+      {
+        try
+        {
+          file_.reset(new MotionFile(file_path));
+          ROS_INFO_STREAM("Mapped motion file '" << file_path << "', with " << file_->getRecords().size()
+                          << " motions.");
+        }
+        catch (const std::exception& e)
+        {
+          ROS_ERROR_STREAM(e.what());
+        }
+      }
+    }
+
+    ReloadReport report;
+    if (reload(report))
+      ROS_INFO_STREAM("Loaded " << report.added.size() << " motions into the motion library.");
+    else
+      ROS_WARN_STREAM("No motions loaded into the motion library.");
+  }
+
+  bool MotionLibrary::reload(ReloadReport& report)
+  {
+    if (!nh_)
+      return false;
+
+    boost::mutex::scoped_lock update_lock(update_mutex_);
+
+    xh::Struct motions;
+    const bool has_params = nh_->getParam("motions", motions);
+    if (!has_params && !file_)
+    {
+      ROS_WARN_STREAM("No motions found in namespace " << nh_->getNamespace() << "/motions.");
+      return false;
+    }
+    if (has_params && motions.getType() != XmlRpc::XmlRpcValue::TypeStruct)
+    {
+      ROS_ERROR_STREAM("Parameter " << nh_->getNamespace() << "/motions is not a struct, motions not loaded.");
+      return false;
+    }
+
+    updateEntries(motions, report);
+    return true;
+  }
+
+  void MotionLibrary::update(XmlRpc::XmlRpcValue& motions, ReloadReport& report)
+  {
+    boost::mutex::scoped_lock update_lock(update_mutex_);
+    updateEntries(motions, report);
+  }
+
+  void MotionLibrary::updateEntries(XmlRpc::XmlRpcValue& motions, ReloadReport& report)
+  {
+    xh::Struct no_motions;
+    xh::Struct& params = motions.getType() == XmlRpc::XmlRpcValue::TypeStruct ? motions : no_motions;
+
+    const EntriesConstPtr old_entries = getEntries();
+    boost::shared_ptr<Entries> new_entries(new Entries);
+    for (xh::Struct::iterator it = params.begin(); it != params.end(); ++it)
+    {
+      const std::string& motion_id = it->first;
+      Entries::const_iterator old_it = old_entries->find(motion_id);
+
+      // Reuse motions that didn't change since the last update
+      if (old_it != old_entries->end() && old_it->second.fingerprint == motionFingerprint(it->second))
+      {
+        new_entries->insert(*old_it);
+        continue;
+      }
+
+      new_entries->insert(std::make_pair(motion_id, parseEntry(motion_id, it->second)));
+      if (old_it == old_entries->end())
+        report.added.push_back(motion_id);
+      else
+        report.changed.push_back(motion_id);
+    }
+
+    // Motions of the motion file not overridden in the parameter server. Motions already read are kept
+    if (file_)
+    {
+      for (std::size_t i = 0; i < file_->getRecords().size(); ++i)
+      {
+        const std::string& motion_id = file_->getRecords()[i].id;
+        if (new_entries->find(motion_id) != new_entries->end())
+          continue;
+        Entries::const_iterator old_it = old_entries->find(motion_id);
+        if (old_it != old_entries->end() && old_it->second.file_motion && old_it->second.file_motion->file == file_)
+        {
+          new_entries->insert(*old_it);
+          continue;
+        }
+        new_entries->insert(std::make_pair(motion_id, makeFileEntry(file_, i)));
+        if (old_it == old_entries->end())
+          report.added.push_back(motion_id);
+        else
+          report.changed.push_back(motion_id);
+      }
+    }
+
+    for (Entries::const_iterator it = old_entries->begin(); it != old_entries->end(); ++it)
+    {
+      if (new_entries->find(it->first) == new_entries->end())
+        report.removed.push_back(it->first);
+    }
+
+    setEntries(new_entries);
+
+    if (!old_entries->empty() && (!report.added.empty() || !report.changed.empty() || !report.removed.empty()))
+    {
+      ROS_INFO_STREAM("Motion library updated: " << report.added.size() << " motions added, "
+                      << report.changed.size() << " changed, " << report.removed.size() << " removed.");
+    }
+  }
+
+  MotionLibrary::Entry MotionLibrary::parseEntry(const std::string& motion_id, XmlRpc::XmlRpcValue& param)
+  {
+    Entry entry;
+    entry.fingerprint = motionFingerprint(param);
+
+    boost::shared_ptr<MotionInfo> info(new MotionInfo);
+    try
+    {
+      parseMotion(motion_id, param, *info);
+    }
+    catch (const xh::XmlrpcHelperException& e)
+    {
+      entry.error = e.what();
+    }
+    catch (const XmlRpc::XmlRpcException& e)
+    {
+      entry.error = e.getMessage();
+    }
+    if (!entry.error.empty())
+    {
+      ROS_ERROR_STREAM("Could not parse motion '" << motion_id << "': " << entry.error);
+      entry.error_code = PMR::MOTION_NOT_FOUND;
+      entry.error = "Could not parse motion '" + motion_id + "': " + entry.error;
+      return entry;
+    }
+
+    const std::string error = validateMotion(*info);
+    if (!error.empty())
+    {
+      ROS_WARN_STREAM("Motion '" << motion_id << "' is malformed: " << error);
+      entry.error_code = PMR::OTHER_ERROR;
+      entry.error = "Motion '" + motion_id + "' is malformed: " + error;
+      return entry;
+    }
+
+    entry.motion = info;
+    entry.summary.id = motion_id;
+    entry.summary.joints = info->joints;
+    entry.summary.duration = info->traj.empty() ? ros::Duration(0.0) : info->traj.back().time_from_start;
+    entry.sorted_joints = info->joints;
+    std::sort(entry.sorted_joints.begin(), entry.sorted_joints.end());
+    return entry;
+  }
+
+  MotionLibrary::Entry MotionLibrary::makeFileEntry(const MotionFileConstPtr& file, std::size_t record)
+  {
+    // The summary comes from the file index, the waypoints are read on first use
+    const MotionFile::Record& file_record = file->getRecords()[record];
+    Entry entry;
+    entry.file_motion.reset(new FileMotion(file, record));
+    entry.summary.id = file_record.id;
+    entry.summary.joints = file_record.joints;
+    entry.summary.duration = file_record.duration;
+    entry.sorted_joints = file_record.joints;
+    std::sort(entry.sorted_joints.begin(), entry.sorted_joints.end());
+    return entry;
+  }
+
+  MotionInfoConstPtr MotionLibrary::readFileMotion(FileMotion& file_motion)
+  {
+    boost::mutex::scoped_lock lock(file_motion.mutex);
+    if (!file_motion.loaded)
+    {
+      file_motion.loaded = true;
+      const std::string& motion_id = file_motion.file->getRecords()[file_motion.record].id;
+      boost::shared_ptr<MotionInfo> info(new MotionInfo);
+      std::string error;
+      try
+      {
+        file_motion.file->getMotion(file_motion.record, *info);
+        error = validateMotion(*info);
+      }
+      catch (const ros::Exception& e)
+      {
+        error = e.what();
+      }
+      if (error.empty())
+      {
+        file_motion.motion = info;
+      }
+      else
+      {
+        ROS_WARN_STREAM("Motion '" << motion_id << "' of file '" << file_motion.file->getPath() << "' is malformed: "
+                        << error);
+        file_motion.error_code = PMR::OTHER_ERROR;
+        file_motion.error = "Motion '" + motion_id + "' is malformed: " + error;
+      }
+    }
+
+    if (!file_motion.motion)
+      throw PMException(file_motion.error, file_motion.error_code);
+    return file_motion.motion;
+  }
+
+  void MotionLibrary::startWatching(const ros::WallDuration& period)
+  {
+    if (watch_thread_.joinable())
+      return;
+    ROS_INFO_STREAM("Watching for motion updates every " << period.toSec() << "s.");
+    watch_thread_ = boost::thread(&MotionLibrary::watchLoop, this, period);
+  }
+
+  void MotionLibrary::watchLoop(const ros::WallDuration& period)
+  {
+    try
+    {
+      while (ros::ok())
+      {
+        boost::this_thread::sleep(boost::posix_time::microseconds(period.toNSec() / 1000));
+        ReloadReport report;
+        reload(report);
+      }
+    }
+    catch (const boost::thread_interrupted&) {}
+  }
+
+  MotionInfoConstPtr MotionLibrary::getMotion(const std::string& motion_id)
+  {
+    EntriesConstPtr entries = getEntries();
+    Entries::const_iterator it = entries->find(motion_id);
+
+    // Motion might have been loaded in the parameter server after the library
+    if (it == entries->end() && nh_ && motionExists(*nh_, motion_id))
+    {
+      ROS_DEBUG_STREAM("Motion '" << motion_id << "' not in the motion library, fetching it.");
+      xh::Struct param;
+      try
+      {
+        xh::fetchParam(ros::NodeHandle(*nh_, "motions"), motion_id, param);
+
+        boost::mutex::scoped_lock update_lock(update_mutex_);
+        boost::shared_ptr<Entries> new_entries(new Entries(*getEntries()));
+        (*new_entries)[motion_id] = parseEntry(motion_id, param);
+        setEntries(new_entries);
+        entries = new_entries;
+        it = entries->find(motion_id);
+      }
+      catch (const xh::XmlrpcHelperException& e)
+      {
+        ROS_ERROR_STREAM(e.what());
+      }
+    }
+
+    if (it == entries->end())
+    {
+      const std::string where = nh_ ? " (namespace " + nh_->getNamespace() + "/motions)" : "";
+      throw PMException("Motion '" + motion_id + "' does not exist or is malformed" + where + ".",
+                        PMR::MOTION_NOT_FOUND);
+    }
+    if (!it->second.motion && it->second.file_motion)
+      return readFileMotion(*it->second.file_motion);
+    if (!it->second.motion)
+      throw PMException(it->second.error, it->second.error_code);
+
+    return it->second.motion;
+  }
+
+  void MotionLibrary::getMotionIds(MotionNames& motion_ids) const
+  {
+    EntriesConstPtr entries = getEntries();
+    motion_ids.clear();
+    motion_ids.reserve(entries->size());
+    for (Entries::const_iterator it = entries->begin(); it != entries->end(); ++it)
+    {
+      if (it->second.isValid())
+        motion_ids.push_back(it->first);
+    }
+  }
+
+  void MotionLibrary::getMotionSummaries(const std::string& name_prefix, const JointNames& joints,
+                                         std::vector<MotionSummary>& motions) const
+  {
+    JointNames joints_s = joints;
+    std::sort(joints_s.begin(), joints_s.end());
+
+    EntriesConstPtr entries = getEntries();
+    motions.clear();
+    for (Entries::const_iterator it = entries->lower_bound(name_prefix); it != entries->end(); ++it)
+    {
+      if (it->first.compare(0, name_prefix.size(), name_prefix) != 0)
+        break; // Entries are sorted, no more motions with this prefix
+      if (!it->second.isValid())
+        continue;
+      if (!joints_s.empty() && !std::includes(joints_s.begin(), joints_s.end(),
+                                              it->second.sorted_joints.begin(), it->second.sorted_joints.end()))
+        continue;
+      motions.push_back(it->second.summary);
+    }
+  }
+}
@@ -38,6 +38,9 @@
 #include "play_motion/move_joint_group.h"
 #include <play_motion_msgs/PlayMotionResult.h>
 
+#include <algorithm>
+#include <cmath>
+
 #include <ros/ros.h>
 #include <boost/foreach.hpp>
 
@@ -46,45 +49,191 @@
 namespace play_motion
 {
   MoveJointGroup::MoveJointGroup(const std::string& controller_name, const JointNames& joint_names)
-    : busy_(false),
+    : goal_seq_(0),
+      goal_id_(0),
       controller_name_(controller_name),
       joint_names_(joint_names),
-      client_(controller_name_ + "/follow_joint_trajectory", false)
+      client_(controller_name_ + "/follow_joint_trajectory", false),
+      tracking_error_(0.0),
+      window_size_(0),
+      lead_time_(1.0),
+      stream_end_(0)
   { }
 
-  void MoveJointGroup::alCallback()
+  void MoveJointGroup::setStreaming(std::size_t window_size, const ros::Duration& lead_time)
   {
-    busy_ = false;
+    boost::mutex::scoped_lock lock(mutex_);
+    window_size_ = window_size;
+    lead_time_   = lead_time;
+  }
+
+  void MoveJointGroup::alCallback(unsigned int goal_seq)
+  {
+    Callback cb;
+    ros::Timer stream_timer;
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      if (goal_seq != goal_seq_)
+        return; // Result of a goal that was replaced by a newer one
+
+      if (!stream_points_.empty() && client_.getState() == actionlib::SimpleClientGoalState::SUCCEEDED)
+      {
+        // The window was executed before the next one was sent, so send it right away
+        ROS_WARN_STREAM("Controller " << controller_name_ << " finished a trajectory window before the next one "
+                        "was sent. Consider increasing the streaming lead time.");
+        stream_timer = stream_timer_;
+        stream_timer_ = nh_.createTimer(ros::Duration(0.001), boost::bind(&MoveJointGroup::streamCb, this, goal_seq),
+                                        true);
+      }
+      else
+      {
+        stream_timer = stopStreaming();
+        cb.swap(active_cb_);
+      }
+    }
+    // A window being sent holds the locks until it is sent, so its timer can only be stopped once they are released.
+    // The window is then discarded, as it was scheduled for an older goal_seq_
+    stream_timer.stop();
+    if (!cb)
+      return;
+
     ActionResultPtr r = client_.getResult();
-    active_cb_(r->error_code);
-    active_cb_.clear();
+    cb(r->error_code);
+  }
+
+  void MoveJointGroup::feedbackCb(unsigned int goal_seq, const ActionFeedbackPtr& feedback)
+  {
+    double error = 0.0;
+    for (std::size_t i = 0; i < feedback->error.positions.size(); ++i)
+      error = std::max(error, std::fabs(feedback->error.positions[i]));
+
+    boost::mutex::scoped_lock lock(mutex_);
+    if (goal_seq == goal_seq_)
+      tracking_error_ = error;
+  }
+
+  double MoveJointGroup::getTrackingError() const
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return tracking_error_;
+  }
+
+  void MoveJointGroup::streamCb(unsigned int goal_seq)
+  {
+    boost::mutex::scoped_lock send_lock(send_mutex_);
+
+    ActionGoal goal;
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      if (goal_seq != goal_seq_ || stream_points_.empty())
+        return; // Goal replaced or canceled since the window was scheduled
+      getNextWindow(goal.trajectory);
+      goal_seq = ++goal_seq_;
+    }
+    ROS_DEBUG_STREAM("Sending trajectory window to " << controller_name_ << ", with "
+                     << goal.trajectory.points.size() << " waypoints.");
+    client_.sendGoal(goal, boost::bind(&MoveJointGroup::alCallback, this, goal_seq),
+                     ActionClient::SimpleActiveCallback(),
+                     boost::bind(&MoveJointGroup::feedbackCb, this, goal_seq, _1));
+
+    boost::mutex::scoped_lock lock(mutex_);
+    scheduleNextWindow(goal_seq);
+  }
+
+  void MoveJointGroup::getNextWindow(trajectory_msgs::JointTrajectory& window)
+  {
+    // Waypoints already executed are not sent again. Waypoints that were never sent are sent even if they are late,
+    // so that the controller can catch up
+    const ros::Duration elapsed = ros::Time::now() - stream_start_;
+    std::size_t first = 0;
+    while (first < stream_end_ && stream_points_[first].time_from_start <= elapsed)
+      ++first;
+    const std::size_t last = std::min(stream_end_ + window_size_, stream_points_.size());
+
+    window.header.stamp = stream_start_;
+    window.joint_names  = joint_names_;
+    window.points.assign(stream_points_.begin() + first, stream_points_.begin() + last);
+    stream_end_ = last;
+  }
+
+  void MoveJointGroup::scheduleNextWindow(unsigned int goal_seq)
+  {
+    if (goal_seq != goal_seq_ || stream_points_.empty())
+      return;
+
+    if (stream_end_ == stream_points_.size())
+    {
+      // Everything was sent. The timer is left alone, as it is either the one that sent the last window or was
+      // already stopped by the caller
+      std::vector<TrajPoint>().swap(stream_points_);
+      stream_end_ = 0;
+      return;
+    }
+
+    const ros::Time send_time = stream_start_ + stream_points_[stream_end_ - 1].time_from_start - lead_time_;
+    const ros::Duration delay = std::max(send_time - ros::Time::now(), ros::Duration(0.001));
+    stream_timer_ = nh_.createTimer(delay, boost::bind(&MoveJointGroup::streamCb, this, goal_seq), true);
   }
 
-  bool MoveJointGroup::isIdle() const
+  ros::Timer MoveJointGroup::stopStreaming()
   {
-    return !busy_;
+    ros::Timer stream_timer = stream_timer_;
+    stream_timer_ = ros::Timer();
+    std::vector<TrajPoint>().swap(stream_points_);
+    stream_end_ = 0;
+    return stream_timer;
   }
 
   void MoveJointGroup::cancel()
   {
-    busy_ = false;
+    ros::Timer stream_timer;
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      stream_timer = stopStreaming();
+    }
+    stream_timer.stop();
     client_.cancelAllGoals();
   }
+
+  void MoveJointGroup::cancel(unsigned int goal_id)
+  {
+    ros::Timer stream_timer;
+    {
+      // No window or goal can be sent in between, so that only the controller goal of goal_id is canceled
+      boost::mutex::scoped_lock send_lock(send_mutex_);
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        if (goal_id != goal_id_)
+          return; // Replaced by a newer goal, which is left alone
+        stream_timer = stopStreaming();
+      }
+      client_.cancelGoal();
+    }
+    stream_timer.stop();
+  }
+
+  unsigned int MoveJointGroup::getGoalId() const
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return goal_id_;
+  }
   
   void MoveJointGroup::abort()
   {
-    if (busy_)
+    Callback cb;
+    ros::Timer stream_timer;
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      stream_timer = stopStreaming();
+      cb.swap(active_cb_);
+    }
+    stream_timer.stop();
+    if (cb)
     {
       client_.cancelAllGoals();
       client_.stopTrackingGoal(); 
+      cb(play_motion_msgs::PlayMotionResult::OTHER_ERROR);
     }
-    if (active_cb_)
-      active_cb_(play_motion_msgs::PlayMotionResult::OTHER_ERROR);
-  }
-
-  void MoveJointGroup::setCallback(const Callback& cb)
-  {
-    active_cb_ = cb;
   }
 
   const JointNames& MoveJointGroup::getJointNames() const
@@ -102,9 +251,14 @@ namespace play_motion
     return controller_name_;
   }
 
+  bool MoveJointGroup::isConnected() const
+  {
+    return client_.isServerConnected();
+  }
+
   bool MoveJointGroup::isControllingJoint(const std::string& joint_name)
   {
-    if (!client_.isServerConnected())
+    if (!isConnected())
       return false;
 
     foreach (const std::string& jn, joint_names_)
@@ -114,15 +268,18 @@ namespace play_motion
     return false;
   }
 
-  bool MoveJointGroup::sendGoal(const std::vector<TrajPoint>& traj)
+  bool MoveJointGroup::sendGoal(const std::vector<TrajPoint>& traj, const Callback& cb)
   {
-    ROS_DEBUG_STREAM("Sending trajectory goal to " << controller_name_ << ".");
+    trajectory_msgs::JointTrajectory goal_traj;
+    goal_traj.points = traj;
+    return sendGoal(goal_traj, cb);
+  }
 
-    ActionGoal goal;
-    goal.trajectory.joint_names = joint_names_;
-    goal.trajectory.points.reserve(traj.size());
+  bool MoveJointGroup::sendGoal(trajectory_msgs::JointTrajectory& traj, const Callback& cb)
+  {
+    ROS_DEBUG_STREAM("Sending trajectory goal to " << controller_name_ << ".");
 
-    foreach (const TrajPoint& p, traj)
+    foreach (const TrajPoint& p, traj.points)
     {
       if (p.positions.size() != joint_names_.size())
       {
@@ -130,19 +287,55 @@ namespace play_motion
                          << ", got: " << p.positions.size() << ".");
         return false;
       }
-      trajectory_msgs::JointTrajectoryPoint point;
+    }
 
-      point.positions     = p.positions;         // Reach these joint positions...
-      point.velocities    = p.velocities;        // ...with a given velocity (may be unset)
-      point.accelerations = p.accelerations;     // ...and acceleration      (may be unset)
+    // Stopped once the locks are released, as a window of the previous goal may be waiting for them
+    ros::Timer stream_timer;
+    sendValidGoal(traj, cb, stream_timer);
+    stream_timer.stop();
+    return true;
+  }
 
-      point.time_from_start = p.time_from_start; // ...in this time
+  void MoveJointGroup::sendValidGoal(trajectory_msgs::JointTrajectory& traj, const Callback& cb,
+                                     ros::Timer& stream_timer)
+  {
+    boost::mutex::scoped_lock send_lock(send_mutex_);
 
-      goal.trajectory.points.push_back(point);
+    ActionGoal goal;
+    traj.joint_names.clear();
+
+    // Results of the previous goal arriving from now on are discarded, so they don't reach the new callback
+    unsigned int goal_seq;
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      active_cb_ = cb;
+      goal_seq = ++goal_seq_;
+      ++goal_id_;
+      tracking_error_ = 0.0;
+      stream_timer = stopStreaming();
+
+      if (window_size_ == 0 || traj.points.size() <= window_size_)
+      {
+        goal.trajectory.points.swap(traj.points);
+        goal.trajectory.joint_names = joint_names_;
+        goal.trajectory.header.stamp = traj.header.stamp;
+      }
+      else
+      {
+        // Only the first window is sent now, the rest is streamed while it is executed
+        stream_points_.swap(traj.points);
+        stream_start_ = traj.header.stamp.isZero() ? ros::Time::now() : traj.header.stamp;
+        getNextWindow(goal.trajectory);
+        ROS_DEBUG_STREAM("Streaming trajectory of " << stream_points_.size() << " waypoints to " << controller_name_
+                         << ", in windows of " << window_size_ << ".");
+      }
     }
-    client_.sendGoal(goal, boost::bind(&MoveJointGroup::alCallback, this));
-    busy_ = true;
+    traj.points.clear();
+    client_.sendGoal(goal, boost::bind(&MoveJointGroup::alCallback, this, goal_seq),
+                     ActionClient::SimpleActiveCallback(),
+                     boost::bind(&MoveJointGroup::feedbackCb, this, goal_seq, _1));
 
-    return true;
+    boost::mutex::scoped_lock lock(mutex_);
+    scheduleNextWindow(goal_seq);
   }
 }
@@ -0,0 +1,199 @@
+/*
+ * Software License Agreement (Modified BSD License)
+ *
+ *  Copyright (c) 2013, PAL Robotics, S.L.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of PAL Robotics, S.L. nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "play_motion/packed_trajectory.h"
+
+#include <algorithm>
+
+namespace
+{
+  /// Waypoint accessors of PackedTrajectory over a vector of waypoints, for writePoints().
+  class TrajectoryView
+  {
+  public:
+    explicit TrajectoryView(const play_motion::Trajectory& traj) : traj_(traj) {}
+
+    std::size_t size() const {return traj_.size();}
+    const ros::Duration& getTime(std::size_t point) const {return traj_[point].time_from_start;}
+    const double* getPositions(std::size_t point) const {return &traj_[point].positions[0];}
+    /// Velocities not matching the positions in size are treated as missing, like PackedTrajectory::pack() does.
+    const double* getVelocities(std::size_t point) const
+    {return hasAll(traj_[point].velocities, point) ? &traj_[point].velocities[0] : 0;}
+    const double* getAccelerations(std::size_t point) const
+    {return hasAll(traj_[point].accelerations, point) ? &traj_[point].accelerations[0] : 0;}
+
+  private:
+    const play_motion::Trajectory& traj_;
+
+    bool hasAll(const std::vector<double>& values, std::size_t point) const
+    {return !values.empty() && values.size() == traj_[point].positions.size();}
+  };
+
+  /// Write the waypoints of \p points for a set of joints to a message, starting at its waypoint \p first.
+  template <class Points>
+  void writePoints(const Points&                     points,
+                   const std::vector<int>&           indices,
+                   const std::vector<double>&        hold_positions,
+                   const ros::Duration&              time_offset,
+                   std::size_t                       first,
+                   trajectory_msgs::JointTrajectory& traj)
+  {
+    const std::size_t out_dim = indices.size();
+    traj.points.resize(first + points.size());
+    for (std::size_t i = 0; i < points.size(); ++i)
+    {
+      trajectory_msgs::JointTrajectoryPoint& point = traj.points[first + i];
+      const double* pos = points.getPositions(i);
+      const double* vel = points.getVelocities(i);
+      const double* acc = points.getAccelerations(i);
+
+      point.time_from_start = points.getTime(i) + time_offset;
+      point.positions.resize(out_dim);
+      point.velocities.resize(vel ? out_dim : 0);
+      point.accelerations.resize(acc ? out_dim : 0);
+      point.effort.clear();
+      for (std::size_t j = 0; j < out_dim; ++j)
+      {
+        const int index = indices[j];
+        if (index < 0)
+        {
+          point.positions[j] = hold_positions[j];
+          if (vel) {point.velocities[j] = 0.0;}
+          if (acc) {point.accelerations[j] = 0.0;}
+          continue;
+        }
+        point.positions[j] = pos[index];
+        if (vel) {point.velocities[j] = vel[index];}
+        if (acc) {point.accelerations[j] = acc[index];}
+      }
+    }
+  }
+}
+
+namespace play_motion
+{
+  PackedTrajectory::PackedTrajectory()
+    : num_joints_(0)
+  {}
+
+  PackedTrajectory::PackedTrajectory(const Trajectory& traj)
+    : num_joints_(0)
+  {
+    pack(traj);
+  }
+
+  void PackedTrajectory::pack(const Trajectory& traj)
+  {
+    num_joints_ = traj.empty() ? 0 : traj.front().positions.size();
+    const std::size_t num_points = traj.size();
+    times_.resize(num_points);
+    positions_.resize(num_points * num_joints_);
+    velocities_.assign(num_points * num_joints_, 0.0);
+    accelerations_.assign(num_points * num_joints_, 0.0);
+    has_velocities_.assign(num_points, 0);
+    has_accelerations_.assign(num_points, 0);
+
+    for (std::size_t i = 0; i < num_points; ++i)
+    {
+      const TrajPoint& point = traj[i];
+      const std::size_t offset = i * num_joints_;
+      times_[i] = point.time_from_start;
+      std::copy(point.positions.begin(), point.positions.begin() + num_joints_, positions_.begin() + offset);
+      if (point.velocities.size() == num_joints_)
+      {
+        std::copy(point.velocities.begin(), point.velocities.end(), velocities_.begin() + offset);
+        has_velocities_[i] = 1;
+      }
+      if (point.accelerations.size() == num_joints_)
+      {
+        std::copy(point.accelerations.begin(), point.accelerations.end(), accelerations_.begin() + offset);
+        has_accelerations_[i] = 1;
+      }
+    }
+  }
+
+  void PackedTrajectory::unpack(Trajectory& traj) const
+  {
+    traj.resize(size());
+    for (std::size_t i = 0; i < size(); ++i)
+      getPoint(i, traj[i]);
+  }
+
+  void PackedTrajectory::getPoint(std::size_t i, TrajPoint& point) const
+  {
+    const std::size_t offset = i * num_joints_;
+    point.time_from_start = times_[i];
+    point.positions.assign(positions_.begin() + offset, positions_.begin() + offset + num_joints_);
+    if (has_velocities_[i])
+      point.velocities.assign(velocities_.begin() + offset, velocities_.begin() + offset + num_joints_);
+    else
+      point.velocities.clear();
+    if (has_accelerations_[i])
+      point.accelerations.assign(accelerations_.begin() + offset, accelerations_.begin() + offset + num_joints_);
+    else
+      point.accelerations.clear();
+  }
+
+  void PackedTrajectory::extract(const std::vector<int>&           indices,
+                                 const std::vector<double>&        hold_positions,
+                                 trajectory_msgs::JointTrajectory& traj) const
+  {
+    write(indices, hold_positions, ros::Duration(0.0), 0, traj);
+  }
+
+  void PackedTrajectory::append(const std::vector<int>&           indices,
+                                const std::vector<double>&        hold_positions,
+                                const ros::Duration&              time_offset,
+                                trajectory_msgs::JointTrajectory& traj) const
+  {
+    write(indices, hold_positions, time_offset, traj.points.size(), traj);
+  }
+
+  void PackedTrajectory::write(const std::vector<int>&           indices,
+                               const std::vector<double>&        hold_positions,
+                               const ros::Duration&              time_offset,
+                               std::size_t                       first,
+                               trajectory_msgs::JointTrajectory& traj) const
+  {
+    writePoints(*this, indices, hold_positions, time_offset, first, traj);
+  }
+
+  void extractJoints(const Trajectory&                 traj_in,
+                     const std::vector<int>&           indices,
+                     const std::vector<double>&        hold_positions,
+                     trajectory_msgs::JointTrajectory& traj)
+  {
+    writePoints(TrajectoryView(traj_in), indices, hold_positions, ros::Duration(0.0), 0, traj);
+  }
+}
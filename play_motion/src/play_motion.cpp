@@ -36,7 +36,10 @@
 
 #include "play_motion/play_motion.h"
 #include "play_motion/play_motion_helpers.h"
+#include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <limits>
 
 #include <boost/foreach.hpp>
 #include <boost/lexical_cast.hpp>
@@ -45,9 +48,14 @@
 #include <actionlib/client/simple_action_client.h>
 #include <control_msgs/FollowJointTrajectoryAction.h>
 #include <sensor_msgs/JointState.h>
+#include <std_msgs/Float64.h>
+#include <play_motion_msgs/GoalStats.h>
 
 #include "play_motion/approach_planner.h"
+#include "play_motion/joint_limits.h"
+#include "play_motion/motion_library.h"
 #include "play_motion/move_joint_group.h"
+#include "play_motion/packed_trajectory.h"
 #include "play_motion/xmlrpc_helpers.h"
 
 #define foreach BOOST_FOREACH
@@ -61,6 +69,11 @@ namespace
   typedef play_motion::PMR                               PMR;
   typedef actionlib::SimpleClientGoalState               SCGS;
 
+  /// Range of the time scaling and speed override factors. Goal durations are scaled by up to their ratio, so beyond
+  /// it trajectory times could overflow
+  const double MIN_SPEED_FACTOR = 0.01;
+  const double MAX_SPEED_FACTOR = 100.0;
+
   void generateErrorCode(GoalHandle goal_hdl, int error_code, SCGS ctrl_state)
   {
     typedef control_msgs::FollowJointTrajectoryResult JTR;
@@ -91,49 +104,138 @@ namespace
       return;      
     }
     MoveJointGroupPtr ctrl = weak_ctrl.lock();
-    ControllerList::iterator it = std::find(goal_hdl->controllers.begin(),
-                                            goal_hdl->controllers.end(), ctrl);
-    if (it == goal_hdl->controllers.end())
+
+    bool failed = false;
     {
-      ROS_ERROR_STREAM("Something is wrong in the controller callback handling. "
-                       << ctrl->getName() << " called a goal callback while no "
-                       "motion goal was alive for it.");
-      return;
-    }
-    goal_hdl->controllers.erase(it);
+      boost::mutex::scoped_lock lock(goal_hdl->mutex);
+      ControllerList::iterator it = std::find(goal_hdl->controllers.begin(),
+                                              goal_hdl->controllers.end(), ctrl);
+      if (it == goal_hdl->controllers.end() && goal_hdl->canceled)
+      {
+        ROS_DEBUG_STREAM("Return from joint group " << ctrl->getName() << ", which was handed over to another goal.");
+        return;
+      }
+      if (it == goal_hdl->controllers.end())
+      {
+        ROS_ERROR_STREAM("Something is wrong in the controller callback handling. "
+                         << ctrl->getName() << " called a goal callback while no "
+                         "motion goal was alive for it.");
+        return;
+      }
+      goal_hdl->controllers.erase(it);
 
-    ROS_DEBUG_STREAM("Return from joint group " << ctrl->getName() << ", "
-                     << goal_hdl->controllers.size() << " active controllers, "
-                     "error: " << error_code);
+      ROS_DEBUG_STREAM("Return from joint group " << ctrl->getName() << ", "
+                       << goal_hdl->controllers.size() << " active controllers, "
+                       "error: " << error_code);
 
-    if (goal_hdl->canceled)
-    {
-      ROS_DEBUG("The Goal was canceled, not calling Motion callback.");
-      return;
+      if (goal_hdl->canceled)
+      {
+        ROS_DEBUG("The Goal was canceled, not calling Motion callback.");
+        return;
+      }
+
+      goal_hdl->error_code = PMR::SUCCEEDED;
+      if (error_code != 0 || ctrl->getState() != actionlib::SimpleClientGoalState::SUCCEEDED)
+      {
+        ROS_ERROR_STREAM("Controller " << ctrl->getName() << " aborted.");
+        generateErrorCode(goal_hdl, error_code, ctrl->getState());
+        failed = true;
+      }
+      else if (!goal_hdl->controllers.empty())
+        return;
     }
 
-    goal_hdl->error_code = PMR::SUCCEEDED;
-    if (error_code != 0 || ctrl->getState() != actionlib::SimpleClientGoalState::SUCCEEDED)
-    {
-      ROS_ERROR_STREAM("Controller " << ctrl->getName() << " aborted.");
+    // Callbacks are called without holding the goal lock
+    if (failed)
       goal_hdl->cancel();
-      generateErrorCode(goal_hdl, error_code, ctrl->getState());
-      goal_hdl->cb(goal_hdl);
+    goal_hdl->cb(goal_hdl);
+  }
+
+  /// \return Index of the second motion waypoint in a trajectory made of an approach followed by the motion, or zero
+  ///         if the trajectory does not have that structure, or if the motion is too short to be worth splitting.
+  std::size_t getBodyStart(const play_motion::Trajectory& motion_traj, const play_motion::Trajectory& traj)
+  {
+    const std::size_t num_points = motion_traj.size();
+    if (num_points < 3 || traj.size() < num_points)
+      return 0;
+    const std::size_t first = traj.size() - num_points;
+    if (traj[first].positions != motion_traj.front().positions || traj.back().positions != motion_traj.back().positions)
+      return 0;
+    return first + 1;
+  }
+
+  play_motion::MotionInfoConstPtr scaleMotion(const play_motion::MotionInfo& motion, double scale)
+  {
+    boost::shared_ptr<play_motion::MotionInfo> scaled(new play_motion::MotionInfo(motion));
+    play_motion::scaleTrajectory(scale, scaled->traj);
+    return scaled;
+  }
+
+  /// \brief Scale the duration of the motion of a trajectory made of an approach followed by the motion. The approach
+  /// and the first motion waypoint, where it ends, are left as they are.
+  /// \param motion_size Number of waypoints of the motion, at the end of the trajectory.
+  void scaleApproachedMotion(double scale, std::size_t motion_size, play_motion::Trajectory& traj)
+  {
+    if (motion_size < 2 || traj.size() < motion_size)
       return;
+    const play_motion::Trajectory::iterator first = traj.end() - motion_size;
+    const ros::Duration start = first->time_from_start;
+
+    play_motion::Trajectory motion(first + 1, traj.end());
+    foreach (play_motion::TrajPoint& point, motion)
+      point.time_from_start -= start;
+    play_motion::scaleTrajectory(scale, motion);
+    foreach (play_motion::TrajPoint& point, motion)
+      point.time_from_start += start;
+    std::copy(motion.begin(), motion.end(), first + 1);
+  }
+
+  /// \return Motion playing only some of the joints of another motion.
+  /// \throws PMException if some of the joints are not used by the motion.
+  play_motion::MotionInfoConstPtr selectJoints(const play_motion::MotionInfo& motion,
+                                               const play_motion::JointNames& joints)
+  {
+    std::vector<std::size_t> indices;
+    foreach (const std::string& joint, joints)
+    {
+      play_motion::JointNames::const_iterator it = std::find(motion.joints.begin(), motion.joints.end(), joint);
+      if (it == motion.joints.end())
+        throw play_motion::PMException("Joint '" + joint + "' is not used by motion '" + motion.id + "'");
+      indices.push_back(it - motion.joints.begin());
     }
 
-    if (goal_hdl->controllers.empty())
-      goal_hdl->cb(goal_hdl);
+    boost::shared_ptr<play_motion::MotionInfo> partial(new play_motion::MotionInfo());
+    partial->id = motion.id;
+    partial->name = motion.name;
+    partial->usage = motion.usage;
+    partial->description = motion.description;
+    partial->joints = joints;
+    partial->traj.resize(motion.traj.size());
+    for (std::size_t i = 0; i < motion.traj.size(); ++i)
+    {
+      const play_motion::TrajPoint& point = motion.traj[i];
+      play_motion::TrajPoint&       partial_point = partial->traj[i];
+      partial_point.time_from_start = point.time_from_start;
+      foreach (std::size_t index, indices)
+      {
+        partial_point.positions.push_back(point.positions[index]);
+        if (!point.velocities.empty())
+          partial_point.velocities.push_back(point.velocities[index]);
+        if (!point.accelerations.empty())
+          partial_point.accelerations.push_back(point.accelerations[index]);
+      }
+    }
+    return partial;
   }
 
-  template <class T>
-  bool hasNonNullIntersection(const std::vector<T>& v1, const std::vector<T>& v2)
+  /// Remove the leading waypoints that correspond to the state the trajectory was computed from.
+  void dropInitialWaypoints(play_motion::Trajectory& traj)
   {
-    foreach (const T& e1, v1)
-      foreach (const T& e2, v2)
-        if (e1 == e2)
-          return true;
-    return false;
+    const ros::Duration min_time(0.01); // NOTE: Magic number
+    play_motion::Trajectory::iterator first = traj.begin();
+    while (first != traj.end() && first + 1 != traj.end() && first->time_from_start < min_time)
+      ++first;
+    traj.erase(traj.begin(), first);
   }
 } // unnamed namespace
 
@@ -142,12 +244,53 @@ namespace play_motion
   PlayMotion::PlayMotion(ros::NodeHandle& nh) :
     nh_(nh),
     joint_states_sub_(nh_.subscribe("joint_states", 10, &PlayMotion::jointStateCb, this)),
-    ctrlr_updater_(nh_)
+    refresh_timeout_(0.5),
+    downsample_tolerance_(0.0),
+    upsample_period_(0.0),
+    stream_window_size_(0),
+    stream_lead_time_(1.0),
+    ctrlr_updater_(nh_),
+    controller_reconnects_(0),
+    speed_override_enabled_(false),
+    speed_override_(1.0),
+    has_settling_goals_(false)
   {
+    ros::NodeHandle private_nh("~");
+    goal_stats_pub_ = private_nh.advertise<play_motion_msgs::GoalStats>("goal_stats", 1, true);
+    double refresh_timeout = refresh_timeout_.toSec();
+    private_nh.getParam("controller_updater/refresh_timeout", refresh_timeout);
+    refresh_timeout_ = ros::WallDuration(std::max(refresh_timeout, 0.0));
+
+    private_nh.getParam("trajectory_processing/downsample_tolerance", downsample_tolerance_);
+    private_nh.getParam("trajectory_processing/upsample_period", upsample_period_);
+
+    int window_size = 0;
+    private_nh.getParam("trajectory_streaming/window_size", window_size);
+    stream_window_size_ = std::max(window_size, 0);
+    double lead_time = stream_lead_time_.toSec();
+    private_nh.getParam("trajectory_streaming/lead_time", lead_time);
+    stream_lead_time_ = ros::Duration(std::max(lead_time, 0.0));
+
+    // Optionally, let the speed of the goals be changed while they are played
+    private_nh.getParam("speed_override/enabled", speed_override_enabled_);
+    if (speed_override_enabled_)
+      speed_override_sub_ = private_nh.subscribe("speed_override", 1, &PlayMotion::speedOverrideCb, this);
+
     ctrlr_updater_.registerUpdateCb(boost::bind(&PlayMotion::updateControllersCb, this, _1, _2));
 
-    ros::NodeHandle private_nh("~");
     approach_planner_.reset(new ApproachPlanner(private_nh));
+
+    // Motions are read from the private namespace, unless they are shared with other instances
+    std::string library_ns;
+    private_nh.getParam("motion_library/namespace", library_ns);
+    motion_library_.reset(new MotionLibrary(library_ns.empty() ? private_nh : ros::NodeHandle(library_ns)));
+    motion_library_->load();
+
+    // Optionally, check periodically for motion updates in the parameter server
+    double watch_period = 0.0;
+    private_nh.getParam("motion_library/watch_period", watch_period);
+    if (watch_period > 0.0)
+      motion_library_->startWatching(ros::WallDuration(watch_period));
   }
 
   PlayMotion::Goal::Goal(const Callback& cbk)
@@ -155,20 +298,60 @@ namespace play_motion
     , active_controllers(0)
     , cb(cbk)
     , canceled(false)
+    , skip_planning(false)
+    , priority(0)
+    , took_over(false)
+    , refresh_controllers(false)
+    , completion_tolerance(0.0)
+    , cancel_on_completion(false)
+    , time_scaling(1.0)
   {}
 
   void PlayMotion::Goal::cancel()
   {
-    canceled = true;
-    foreach (MoveJointGroupPtr mjg, controllers)
+    ControllerList ctrls;
+    {
+      boost::mutex::scoped_lock lock(mutex);
+      canceled = true;
+      ctrls = controllers;
+    }
+    foreach (MoveJointGroupPtr mjg, ctrls)
       mjg->cancel();
   }
 
   void PlayMotion::Goal::addController(const MoveJointGroupPtr& ctrl)
   {
+    boost::mutex::scoped_lock lock(mutex);
     controllers.push_back(ctrl);
   }
 
+  void PlayMotion::Goal::setEarlyCompletion(double tolerance, bool cancel_controllers)
+  {
+    completion_tolerance = std::max(tolerance, 0.0);
+    cancel_on_completion = cancel_controllers;
+  }
+
+  void PlayMotion::Goal::setTimeScaling(double scale)
+  {
+    time_scaling = scale > 0.0 ? scale : 1.0;
+  }
+
+  void PlayMotion::Goal::setStartTime(const ros::Time& start)
+  {
+    requested_start = start;
+  }
+
+  bool PlayMotion::Goal::isUsingController(const std::string& controller_name)
+  {
+    boost::mutex::scoped_lock lock(mutex);
+    if (canceled)
+      return false;
+    foreach (const MoveJointGroupPtr& ctrl, controllers)
+      if (ctrl->getName() == controller_name)
+        return true;
+    return false;
+  }
+
   PlayMotion::Goal::~Goal()
   {
     cancel();
@@ -178,227 +361,1120 @@ namespace play_motion
                                        const ControllerUpdater::ControllerJoints& joints)
   {
     typedef std::pair<std::string, ControllerUpdater::ControllerState> ctrlr_state_pair_t;
-    
-    ROS_INFO_STREAM("Controllers have changed, cancelling all active goals");
-    foreach (MoveJointGroupPtr mjg, move_joint_groups_)
+
+    // Running controllers and their joints
+    ControllerUpdater::ControllerJoints running;
+    foreach (const ctrlr_state_pair_t& p, states)
+    {
+      if (p.second == ControllerUpdater::RUNNING)
+        running[p.first] = joints.at(p.first);
+    }
+
+    // Removed controllers are aborted once the lock is released, since aborting runs the done callbacks of their
+    // goals right away, and these end up taking locks held by threads waiting for controllers_mutex_
+    ControllerList removed;
     {
+      boost::mutex::scoped_lock lock(controllers_mutex_);
+
+      // Keep the controllers that didn't change, so that their goals are not interrupted and their action clients
+      // don't need to reconnect
+      for (ControllerList::iterator it = move_joint_groups_.begin(); it != move_joint_groups_.end();)
+      {
+        ControllerUpdater::ControllerJoints::iterator running_it = running.find((*it)->getName());
+        if (running_it != running.end() && running_it->second == (*it)->getJointNames())
+        {
+          running.erase(running_it);
+          ++it;
+        }
+        else
+        {
+          removed.push_back(*it);
+          it = move_joint_groups_.erase(it);
+        }
+      }
+
+      typedef std::pair<std::string, JointNames> ctrlr_joints_pair_t;
+      foreach (const ctrlr_joints_pair_t& p, running)
+      {
+        if (!known_controllers_.insert(p.first).second)
+          ++controller_reconnects_;
+        MoveJointGroupPtr ctrl(new MoveJointGroup(p.first, p.second));
+        ctrl->setStreaming(stream_window_size_, stream_lead_time_);
+        move_joint_groups_.push_back(ctrl);
+        ROS_DEBUG_STREAM("Controller '" << p.first << "' with " << p.second.size() << " joints.");
+      }
+
+      // Motions may map to different controllers now
+      if (!removed.empty() || !running.empty())
+        motion_controllers_.clear();
+    }
+
+    foreach (MoveJointGroupPtr mjg, removed)
+    {
+      ROS_INFO_STREAM("Controller '" << mjg->getName() << "' stopped or changed, aborting its goals.");
       // Deleting the groups isn't enough, because they are referenced by
       // the goalhandles. They will only be destroyed when the action ends,
       // which will crash because you cannot destroy actionclient from within a callback
       // We must abort, so the goalhandle is destroyed
       mjg->abort();
     }
-    move_joint_groups_.clear();
-    foreach (const ctrlr_state_pair_t& p, states)
-    {
-      if (p.second != ControllerUpdater::RUNNING)
-        continue;
-      move_joint_groups_.push_back(MoveJointGroupPtr(new MoveJointGroup(p.first, joints.at(p.first))));
-      ROS_DEBUG_STREAM("Controller '" << p.first << "' with " << joints.at(p.first).size() << " joints.");
-    }
   }
 
-  void PlayMotion::jointStateCb(const sensor_msgs::JointStatePtr& msg)
+  unsigned int PlayMotion::getControllerReconnects()
+  {
+    boost::mutex::scoped_lock lock(controllers_mutex_);
+    return controller_reconnects_;
+  }
+
+  void PlayMotion::publishGoalStats(const GoalHandle& goal_hdl, int error_code)
   {
-    joint_states_.clear();
-    for (uint32_t i=0; i < msg->name.size(); ++i)
-      joint_states_[msg->name[i]] = msg->position[i];
+    const LatencyStats::Timing& timing = goal_hdl->timing;
+    if (error_code == PMR::SUCCEEDED)
+      latency_stats_.add(timing);
+
+    play_motion_msgs::GoalStats msg;
+    msg.stamp = goal_hdl->request_time;
+    msg.motion_name = goal_hdl->motion->id;
+    msg.error_code = error_code;
+    for (int stage = 0; stage < LatencyStats::NUM_STAGES; ++stage)
+      msg.stages.push_back(LatencyStats::getStageName(static_cast<LatencyStats::Stage>(stage)));
+    msg.durations = timing.durations;
+    msg.total = timing.getTotal();
+    goal_stats_pub_.publish(msg);
   }
 
-  bool PlayMotion::getGroupTraj(MoveJointGroupPtr move_joint_group,
-                                const JointNames& motion_joints,
-                                const Trajectory& motion_points, Trajectory& traj_group)
+  void PlayMotion::jointStateCb(const sensor_msgs::JointStatePtr& msg)
   {
-    JointNames                 group_joint_names = move_joint_group->getJointNames();
-    std::vector<double>        joint_states;
-    std::map<std::string, int> joint_index;
+    joint_states_.update(*msg);
+    checkCompletion();
+  }
 
-    traj_group.clear();
-    traj_group.reserve(motion_points.size());
+  void PlayMotion::checkCompletion()
+  {
+    // Called on every joint state message, while goals settle only now and then
+    if (!has_settling_goals_.load(std::memory_order_acquire))
+      return;
 
-    foreach (const std::string& jn, group_joint_names)
+    std::vector<GoalHandle> goals;
     {
-      // store the index of this joint in the given motion
-      int index = std::find(motion_joints.begin(), motion_joints.end(), jn) - motion_joints.begin();
-      joint_index[jn] = index;
-
-      // retrieve joint state,  we should have it from the joint_states subscriber
-      if (joint_states_.find(jn) == joint_states_.end())
+      boost::mutex::scoped_lock lock(settling_mutex_);
+      for (std::list<boost::weak_ptr<Goal> >::iterator it = settling_goals_.begin(); it != settling_goals_.end();)
       {
-        ROS_ERROR_STREAM("Could not get current position of joint \'" << jn << "\'.");
-        return false;
+        GoalHandle goal_hdl = it->lock();
+        if (goal_hdl)
+        {
+          goals.push_back(goal_hdl);
+          ++it;
+        }
+        else
+          it = settling_goals_.erase(it);
       }
-      joint_states.push_back(joint_states_[jn]);
+      has_settling_goals_.store(!settling_goals_.empty(), std::memory_order_release);
     }
 
-    foreach (const TrajPoint& p, motion_points)
+    // Goals are checked without holding the list lock, which is taken by execute() with the goal lock held
+    const ros::Time now = ros::Time::now();
+    std::vector<Goal*> done;
+    std::vector<double> curr_pos;
+    foreach (const GoalHandle& goal_hdl, goals)
     {
-      bool has_velocities    = !p.velocities.empty();
-      bool has_accelerations = !p.accelerations.empty();
-      TrajPoint point;
-      point.positions.resize(group_joint_names.size());
-      if (has_velocities)
-        point.velocities.resize(group_joint_names.size(), 0);
-      if (has_accelerations)
-        point.accelerations.resize(group_joint_names.size(), 0);
-      point.time_from_start = p.time_from_start;
-
-      for (std::size_t i = 0; i < group_joint_names.size(); ++i)
       {
-        // first assignment, overriden by given motion if joint specified
-        point.positions[i] = joint_states[i];
-
-        size_t index = joint_index[group_joint_names[i]];
-        if (index < motion_joints.size())
+        boost::mutex::scoped_lock lock(goal_hdl->mutex);
+        if (goal_hdl->canceled || goal_hdl->controllers.empty())
         {
-          point.positions[i] = p.positions[index];
-          if (has_velocities)
-            point.velocities[i] = p.velocities[index];
-          if (has_accelerations)
-            point.accelerations[i] = p.accelerations[index];
+          done.push_back(goal_hdl.get());
+          continue;
         }
+        // Earlier on, the joints may pass through the last waypoint without having settled there
+        if (now < goal_hdl->start_time + goal_hdl->duration)
+          continue;
       }
-      traj_group.push_back(point);
+
+      // The joints are read in the order of the target, so positions are compared index by index
+      if (!joint_states_.read(goal_hdl->completion_joints, curr_pos))
+        continue;
+      const std::vector<double>& target = goal_hdl->completion_target;
+      std::size_t i = 0;
+      while (i < target.size() && std::fabs(curr_pos[i] - target[i]) <= goal_hdl->completion_tolerance) {++i;}
+      if (i < target.size())
+        continue;
+
+      if (completeGoal(goal_hdl))
+        ROS_DEBUG_STREAM("Motion '" << goal_hdl->motion->id << "' settled within tolerance, goal completed.");
+      done.push_back(goal_hdl.get());
     }
-    return true;
+
+    if (done.empty())
+      return;
+    boost::mutex::scoped_lock lock(settling_mutex_);
+    for (std::list<boost::weak_ptr<Goal> >::iterator it = settling_goals_.begin(); it != settling_goals_.end();)
+    {
+      if (std::find(done.begin(), done.end(), it->lock().get()) != done.end())
+        it = settling_goals_.erase(it);
+      else
+        ++it;
+    }
+    has_settling_goals_.store(!settling_goals_.empty(), std::memory_order_release);
   }
 
-  void PlayMotion::getMotionJoints(const std::string& motion_name, JointNames& motion_joints)
+  bool PlayMotion::completeGoal(const GoalHandle& goal_hdl)
   {
-    try
+    ControllerList ctrls;
+    std::map<MoveJointGroupPtr, unsigned int> ctrl_goal_ids;
     {
-      ::play_motion::getMotionJoints(ros::NodeHandle("~"), motion_name, motion_joints);
+      boost::mutex::scoped_lock lock(goal_hdl->mutex);
+      if (goal_hdl->canceled || goal_hdl->controllers.empty())
+        return false;
+      // Results reported by the controllers from now on are ignored, and their reservations are released
+      goal_hdl->canceled = true;
+      goal_hdl->error_code = PMR::SUCCEEDED;
+      goal_hdl->error_string.clear();
+      ctrls.swap(goal_hdl->controllers);
+      ctrl_goal_ids = goal_hdl->ctrl_goal_ids;
     }
-    catch (const xh::XmlrpcHelperException& e)
+
+    // Once the reservations are released, the controllers may get the trajectories of the next goal at any time,
+    // so only the goals sent for this one are canceled
+    if (goal_hdl->cancel_on_completion)
     {
-      std::ostringstream error_msg;
-      error_msg << "Could not parse motion '" << motion_name << "': " << e.what();
-      throw PMException(error_msg.str(), PMR::MOTION_NOT_FOUND);
+      foreach (const MoveJointGroupPtr& ctrl, ctrls)
+        ctrl->cancel(ctrl_goal_ids[ctrl]);
     }
-    catch (const ros::Exception& e)
+    goal_hdl->cb(goal_hdl);
+    return true;
+  }
+
+  bool PlayMotion::getGroupTraj(const MotionControllers::Group& group,
+                                const Trajectory& motion_points, const PackedTrajectory* body,
+                                const ros::Duration& body_offset, trajectory_msgs::JointTrajectory& traj_group)
+  {
+    std::vector<double> joint_states;
+
+    // retrieve joint state,  we should have it from the joint_states subscriber
+    bool joints_read;
     {
-      std::ostringstream error_msg;
-      error_msg << "could not parse motion '" << motion_name << "': " << e.what();
-      throw PMException(error_msg.str(), PMR::MOTION_NOT_FOUND);
+      boost::mutex::scoped_lock lock(*group.joints_mutex);
+      joints_read = joint_states_.read(group.joints, joint_states);
     }
+    if (!joints_read)
+    {
+      ROS_ERROR_STREAM("Could not get current position of joints of controller '" << group.ctrl->getName() << "'.");
+      return false;
+    }
+
+    // Joints not in the motion hold their current position. The waypoints processed for this goal are written
+    // straight from the processed trajectory, followed by the cached body, in a single pass over each
+    traj_group.points.reserve(motion_points.size() + (body ? body->size() : 0));
+    extractJoints(motion_points, group.motion_indices, joint_states, traj_group);
+    if (body)
+      body->append(group.motion_indices, joint_states, body_offset, traj_group);
+    return true;
   }
 
-  void PlayMotion::getMotionPoints(const std::string& motion_name, Trajectory& motion_points)
+  void PlayMotion::processTrajectory(Trajectory& traj, std::size_t num_joints) const
   {
+    validateTrajectory(traj, num_joints);
+    if (downsample_tolerance_ > 0.0)
+      downsampleTrajectory(traj, downsample_tolerance_, traj);
+    populateVelocities(traj, traj);
+    if (upsample_period_ > 0.0)
+      upsampleTrajectory(traj, upsample_period_, traj);
+  }
+
+  MotionInfoConstPtr PlayMotion::downsampleMotion(const MotionInfoConstPtr& motion) const
+  {
+    if (downsample_tolerance_ <= 0.0)
+      return motion;
+
+    boost::shared_ptr<MotionInfo> downsampled(new MotionInfo(*motion));
     try
     {
-      ::play_motion::getMotionPoints(ros::NodeHandle("~"), motion_name, motion_points);
-    }
-    catch (const xh::XmlrpcHelperException& e)
-    {
-      std::ostringstream error_msg;
-      error_msg << "Could not parse motion '" << motion_name << "': " << e.what();
-      throw PMException(error_msg.str(), PMR::MOTION_NOT_FOUND);
+      validateTrajectory(downsampled->traj, downsampled->joints.size());
+      downsampleTrajectory(downsampled->traj, downsample_tolerance_, downsampled->traj);
     }
     catch (const ros::Exception& e)
     {
-      std::ostringstream error_msg;
-      error_msg << "could not parse motion '" << motion_name << "': " << e.what();
-      throw PMException(error_msg.str(), PMR::MOTION_NOT_FOUND);
+      throw PMException(e.what(), PMR::OTHER_ERROR);
     }
+    return downsampled;
+  }
+
+  MotionInfoConstPtr PlayMotion::getDownsampledMotion(const MotionControllers& motion_ctrls) const
+  {
+    boost::mutex::scoped_lock lock(motion_ctrls.body_mutex);
+    if (!motion_ctrls.downsampled)
+      motion_ctrls.downsampled = downsampleMotion(motion_ctrls.motion);
+    return motion_ctrls.downsampled;
+  }
+
+  PlayMotion::PackedTrajectoryConstPtr PlayMotion::getMotionBody(const MotionControllers& motion_ctrls,
+                                                                 const Trajectory&        traj,
+                                                                 std::size_t              body_start) const
+  {
+    boost::mutex::scoped_lock lock(motion_ctrls.body_mutex);
+    if (motion_ctrls.body)
+      return motion_ctrls.body;
+
+    // The body is processed together with the first motion waypoint, its neighbor, with times relative to it
+    Trajectory body(traj.begin() + body_start - 1, traj.end());
+    const ros::Duration start = body.front().time_from_start;
+    foreach (TrajPoint& point, body)
+      point.time_from_start -= start;
+
+    // The motion was downsampled beforehand, by getDownsampledMotion()
+    validateTrajectory(body, body.front().positions.size());
+    populateVelocities(body, body);
+    const ros::Duration body_begin = body[1].time_from_start;
+    if (upsample_period_ > 0.0)
+      upsampleTrajectory(body, upsample_period_, body);
+
+    // The first segment depends on the approach, so it is left out
+    Trajectory::iterator first = body.begin();
+    while (first->time_from_start < body_begin)
+      ++first;
+    body.erase(body.begin(), first);
+
+    motion_ctrls.body.reset(new PackedTrajectory(body));
+    return motion_ctrls.body;
   }
 
-  ControllerList PlayMotion::getMotionControllers(const JointNames& motion_joints)
+  PlayMotion::MotionControllersConstPtr PlayMotion::computeMotionControllers(const MotionInfoConstPtr& motion) const
   {
+    const JointNames& motion_joints = motion->joints;
+    boost::shared_ptr<MotionControllers> motion_ctrls(new MotionControllers);
+    motion_ctrls->motion = motion;
+
     // Populate list of controllers containing at least one motion joint,...
-    ControllerList ctrlr_list;
+    std::vector<bool> joint_covered(motion_joints.size(), false);
     foreach (MoveJointGroupPtr move_joint_group, move_joint_groups_)
     {
-      if (hasNonNullIntersection(motion_joints, move_joint_group->getJointNames()))
-        ctrlr_list.push_back(move_joint_group);
+      MotionControllers::Group group;
+      group.ctrl = move_joint_group;
+      group.connected = move_joint_group->isConnected();
+      group.joints = JointStateBuffer::Selection(move_joint_group->getJointNames());
+      group.joints_mutex.reset(new boost::mutex());
+
+      bool in_motion = false;
+      foreach (const std::string& jn, move_joint_group->getJointNames())
+      {
+        JointNames::const_iterator it = std::find(motion_joints.begin(), motion_joints.end(), jn);
+        const int index = it == motion_joints.end() ? -1 : it - motion_joints.begin();
+        group.motion_indices.push_back(index);
+        if (index < 0)
+          continue;
+        in_motion = true;
+        if (group.connected)
+          joint_covered[index] = true;
+      }
+      if (in_motion)
+        motion_ctrls->groups.push_back(group);
     }
 
-    // ...check that all motion joints are contained in this list...
-    foreach (const std::string& jn, motion_joints)
+    // ...and check that all motion joints are controlled by a reachable controller
+    for (std::size_t i = 0; i < motion_joints.size(); ++i)
     {
-      foreach (MoveJointGroupPtr ctrlr, ctrlr_list)
-        if (ctrlr->isControllingJoint(jn))
-          goto next_joint;
+      if (!joint_covered[i])
+        throw PMException("No controller was found for joint '" + motion_joints[i] + "'", PMR::MISSING_CONTROLLER);
+    }
+
+    return motion_ctrls;
+  }
 
-      throw PMException("No controller was found for joint '" + jn + "'", PMR::MISSING_CONTROLLER);
-next_joint:;
+  PlayMotion::MotionControllersConstPtr PlayMotion::getMotionControllers(const std::string&        cache_key,
+                                                                         const MotionInfoConstPtr& motion,
+                                                                         int                       priority,
+                                                                         std::vector<GoalHandle>&  preempted)
+  {
+    // The mapping is computed once per motion, and reused until the motion or the controllers change
+    MotionControllersConstPtr uncached;
+    MotionControllersConstPtr& motion_ctrls = cache_key.empty() ? uncached : motion_controllers_[cache_key];
+    bool valid = motion_ctrls && motion_ctrls->motion == motion;
+    if (valid)
+    {
+      foreach (const MotionControllers::Group& group, motion_ctrls->groups)
+        valid = valid && group.ctrl->isConnected() == group.connected;
     }
+    if (!valid)
+      motion_ctrls = computeMotionControllers(motion);
 
-    // ...and that no controller in the list is busy executing another goal
-    foreach (MoveJointGroupPtr move_joint_group, ctrlr_list)
+    // Check that no controller is reserved by another goal that can't be preempted
+    preempted.clear();
+    foreach (const MotionControllers::Group& group, motion_ctrls->groups)
     {
-      if(!move_joint_group->isIdle())
-        throw PMException("Controller '" + move_joint_group->getName() + "' is busy", PMR::CONTROLLER_BUSY);
+      GoalHandle owner = getReservation(group.ctrl->getName());
+      if (!owner)
+        continue;
+      if (owner->priority >= priority)
+        throw PMException("Controller '" + group.ctrl->getName() + "' is busy", PMR::CONTROLLER_BUSY);
+      if (std::find(preempted.begin(), preempted.end(), owner) == preempted.end())
+        preempted.push_back(owner);
+    }
+
+    return motion_ctrls;
+  }
+
+  PlayMotion::GoalHandle PlayMotion::getReservation(const std::string& controller_name)
+  {
+    // Reservations are not released explicitly: they expire when the owner goal is destroyed, canceled, or done
+    // with the controller
+    Reservations::iterator it = reservations_.find(controller_name);
+    if (it == reservations_.end())
+      return GoalHandle();
+    GoalHandle owner = it->second.lock();
+    if (!owner || !owner->isUsingController(controller_name))
+    {
+      reservations_.erase(it);
+      return GoalHandle();
     }
+    return owner;
+  }
+
+  bool PlayMotion::accept(const std::string& motion_name,
+                          bool               skip_planning,
+                          int                priority,
+                          GoalHandle&        goal_hdl,
+                          const Callback&    cb)
+  {
+    return accept(motion_name, MotionNames(), std::vector<double>(), JointNames(), skip_planning, priority,
+                  goal_hdl, cb);
+  }
 
-    return ctrlr_list;
+  bool PlayMotion::acceptSequence(const MotionNames&         sequence,
+                                  const std::vector<double>& time_scaling,
+                                  bool                       skip_planning,
+                                  int                        priority,
+                                  GoalHandle&                goal_hdl,
+                                  const Callback&            cb)
+  {
+    return accept(std::string(), sequence, time_scaling, JointNames(), skip_planning, priority, goal_hdl, cb);
   }
 
-  bool PlayMotion::run(const std::string& motion_name,
-                       bool               skip_planning,
-                       GoalHandle&        goal_hdl,
-                       const Callback&    cb)
+  bool PlayMotion::acceptPartial(const std::string&         motion_name,
+                                 const MotionNames&         sequence,
+                                 const std::vector<double>& time_scaling,
+                                 const JointNames&          joints,
+                                 bool                       skip_planning,
+                                 int                        priority,
+                                 GoalHandle&                goal_hdl,
+                                 const Callback&            cb)
   {
-    JointNames                              motion_joints;
-    Trajectory                              motion_points;
-    std::map<MoveJointGroupPtr, Trajectory> joint_group_traj;
+    return accept(sequence.empty() ? motion_name : std::string(), sequence, time_scaling, joints, skip_planning,
+                  priority, goal_hdl, cb);
+  }
 
+  bool PlayMotion::accept(const std::string&         motion_name,
+                          const MotionNames&         sequence,
+                          const std::vector<double>& time_scaling,
+                          const JointNames&          joints,
+                          bool                       skip_planning,
+                          int                        priority,
+                          GoalHandle&                goal_hdl,
+                          const Callback&            cb)
+  {
     goal_hdl = GoalHandle(new Goal(cb));
+    goal_hdl->request_time = ros::Time::now();
+    LatencyStats::StageTimer timer(goal_hdl->timing);
+    std::vector<GoalHandle> preempted;
 
     try
     {
-      getMotionJoints(motion_name, motion_joints);
-      ControllerList groups = getMotionControllers(motion_joints); // Checks many preconditions
-      getMotionPoints(motion_name, motion_points);
+      // Motions are cached by name, and partial motions also by their joints. Sequences are not cached
+      std::string cache_key;
+      if (sequence.empty())
+      {
+        goal_hdl->motion = motion_library_->getMotion(motion_name);
+        cache_key = motion_name;
+      }
+      else
+        goal_hdl->motion = buildSequence(sequence, time_scaling);
+      if (!joints.empty())
+        goal_hdl->motion = getPartialMotion(goal_hdl->motion, joints, cache_key);
+      timer.stop(LatencyStats::MOTION_FETCH);
+      goal_hdl->skip_planning = skip_planning;
+      goal_hdl->priority = priority;
+      if (!skip_planning && approach_planner_->isPlanningDisabled())
+        throw PMException("Motion planning capability disabled. To disable planning in goal requests, "
+                          "set 'skip_planning=true'", PMR::NO_PLAN_FOUND);
+
+      try
+      {
+        reserveControllers(goal_hdl, cache_key, preempted);
+      }
+      catch (const PMException& e)
+      {
+        // Controllers might have been switched since the last update. They are refreshed before giving up, but not
+        // here, as callers accept goals with their action server locked and the refresh can take a while
+        if (e.error_code() != PMR::MISSING_CONTROLLER || refresh_timeout_.isZero())
+          throw;
+        ROS_DEBUG_STREAM(e.what() << ". Refreshing the controllers before executing the goal.");
+        goal_hdl->refresh_controllers = true;
+      }
+      timer.stop(LatencyStats::CONTROLLER_LOOKUP);
+      goal_hdl->stage_end = timer.getTime();
+    }
+    catch (const PMException& e)
+    {
+      goal_hdl->error_string = e.what();
+      goal_hdl->error_code = e.error_code();
+      return false;
+    }
+
+    // Callbacks are called without holding the controllers lock
+    foreach (const GoalHandle& victim, preempted)
+    {
+      ROS_INFO_STREAM("Goal preempted by a goal of priority " << priority << ".");
+      victim->cb(victim);
+    }
+    return true;
+  }
+
+  MotionInfoConstPtr PlayMotion::getPartialMotion(const MotionInfoConstPtr& motion, const JointNames& joints,
+                                                 std::string& cache_key)
+  {
+    // The same joints requested in any order play the same motion
+    JointNames sorted_joints(joints);
+    std::sort(sorted_joints.begin(), sorted_joints.end());
+    if (cache_key.empty())
+      return selectJoints(*motion, sorted_joints);
+    foreach (const std::string& joint, sorted_joints)
+      cache_key += '\n' + joint;
+
+    boost::mutex::scoped_lock lock(partial_mutex_);
+    PartialMotion& entry = partial_motions_[cache_key];
+    if (entry.source != motion)
+    {
+      entry.motion = selectJoints(*motion, sorted_joints);
+      entry.source = motion;
+    }
+    return entry.motion;
+  }
+
+  MotionInfoConstPtr PlayMotion::buildSequence(const MotionNames& sequence, const std::vector<double>& time_scaling)
+  {
+    if (!time_scaling.empty() && time_scaling.size() != sequence.size())
+      throw PMException("The sequence has " + boost::lexical_cast<std::string>(sequence.size()) + " motions, but " +
+                        boost::lexical_cast<std::string>(time_scaling.size()) + " time scaling values");
+
+    // Fetch the motions and gather their joints, with the position where each joint is first used
+    std::vector<MotionInfoConstPtr> steps;
+    boost::shared_ptr<MotionInfo> seq(new MotionInfo());
+    std::vector<double> hold_pos; // Position of each sequence joint before and after each step
+    for (std::size_t i = 0; i < sequence.size(); ++i)
+    {
+      if (!time_scaling.empty())
+        checkSpeedFactor(time_scaling[i], "Time scaling of motion '" + sequence[i] + "'");
+      steps.push_back(motion_library_->getMotion(sequence[i]));
+      const MotionInfo& step = *steps.back();
+      if (step.traj.empty())
+        throw PMException("Motion '" + sequence[i] + "' of the sequence has no waypoints");
+      for (std::size_t j = 0; j < step.joints.size(); ++j)
+      {
+        if (std::find(seq->joints.begin(), seq->joints.end(), step.joints[j]) != seq->joints.end())
+          continue;
+        seq->joints.push_back(step.joints[j]);
+        hold_pos.push_back(step.traj.front().positions[j]);
+      }
+    }
+    seq->id = "sequence";
+    seq->name = "Sequence of " + boost::lexical_cast<std::string>(sequence.size()) + " motions";
+
+    ros::Duration offset(0.0); // Time from start of the end of the previous step
+    for (std::size_t i = 0; i < steps.size(); ++i)
+    {
+      const MotionInfo& step = *steps[i];
+
+      // Index of the step joints in the sequence
+      std::vector<std::size_t> indices;
+      std::vector<double> start_pos; // Where the previous step left the step joints
+      foreach (const std::string& joint, step.joints)
+      {
+        indices.push_back(std::find(seq->joints.begin(), seq->joints.end(), joint) - seq->joints.begin());
+        start_pos.push_back(hold_pos[indices.back()]);
+      }
+
+      Trajectory step_traj = step.traj;
+      if (!time_scaling.empty() && time_scaling[i] != 1.0)
+        scaleTrajectory(time_scaling[i], step_traj);
+
+      if (i > 0)
+      {
+        if (!approach_planner_->needsApproach(start_pos, step_traj.front().positions))
+        {
+          // Continuous with the previous step, whose last waypoint replaces the first one of this step. The rest
+          // keep their timing relative to the replaced waypoint, even if it does not start at zero
+          const ros::Duration first_time = step_traj.front().time_from_start;
+          step_traj.erase(step_traj.begin());
+          foreach (TrajPoint& step_point, step_traj)
+            step_point.time_from_start -= first_time;
+        }
+        else
+        {
+          Trajectory step_traj_safe;
+          if (!approach_planner_->prependApproach(step.joints, start_pos, true, step_traj, step_traj_safe))
+            throw PMException("Could not compute the approach to motion '" + sequence[i] + "' of the sequence");
+          step_traj.swap(step_traj_safe);
+        }
+      }
+
+      foreach (const TrajPoint& step_point, step_traj)
+      {
+        TrajPoint point;
+        point.time_from_start = offset + step_point.time_from_start;
+        point.positions = hold_pos;
+        if (!step_point.velocities.empty())
+          point.velocities.assign(hold_pos.size(), 0.0);
+        if (!step_point.accelerations.empty())
+          point.accelerations.assign(hold_pos.size(), 0.0);
+        for (std::size_t j = 0; j < indices.size(); ++j)
+        {
+          point.positions[indices[j]] = step_point.positions[j];
+          if (!step_point.velocities.empty())
+            point.velocities[indices[j]] = step_point.velocities[j];
+          if (!step_point.accelerations.empty())
+            point.accelerations[indices[j]] = step_point.accelerations[j];
+        }
+        seq->traj.push_back(point);
+      }
+      if (!step_traj.empty())
+      {
+        for (std::size_t j = 0; j < indices.size(); ++j)
+          hold_pos[indices[j]] = step_traj.back().positions[j];
+      }
+      if (!seq->traj.empty())
+        offset = seq->traj.back().time_from_start;
+    }
+
+    return seq;
+  }
+
+  void PlayMotion::reserveControllers(const GoalHandle& goal_hdl, const std::string& cache_key,
+                                      std::vector<GoalHandle>& preempted)
+  {
+    // Reserve the controllers, so that goals accepted later see them busy
+    boost::mutex::scoped_lock lock(controllers_mutex_);
+    goal_hdl->motion_controllers = getMotionControllers(cache_key, goal_hdl->motion, goal_hdl->priority,
+                                                        preempted); // Checks many preconditions
+    ControllerList groups;
+    foreach (const MotionControllers::Group& group, goal_hdl->motion_controllers->groups)
+      groups.push_back(group.ctrl);
+
+    std::vector<GoalHandle> candidates;
+    candidates.swap(preempted);
+    foreach (const GoalHandle& candidate, candidates)
+    {
+      if (preempt(candidate, groups))
+        preempted.push_back(candidate);
+    }
+    goal_hdl->took_over = !preempted.empty();
+    foreach (MoveJointGroupPtr move_joint_group, groups)
+    {
+      reservations_[move_joint_group->getName()] = goal_hdl;
+      goal_hdl->addController(move_joint_group);
+    }
+  }
+
+  void PlayMotion::reserveRefreshedControllers(const GoalHandle& goal_hdl)
+  {
+    {
+      boost::mutex::scoped_lock lock(goal_hdl->mutex);
+      if (goal_hdl->canceled)
+        throw PMException("The goal was canceled while waiting for the controllers", PMR::PREEMPTED);
+    }
+    if (!ctrlr_updater_.update(refresh_timeout_))
+      ROS_WARN_STREAM("The controllers could not be refreshed within " << refresh_timeout_.toSec() << " s.");
+
+    std::vector<GoalHandle> preempted;
+    reserveControllers(goal_hdl, std::string(), preempted);
+    foreach (const GoalHandle& victim, preempted)
+    {
+      ROS_INFO_STREAM("Goal preempted by a goal of priority " << goal_hdl->priority << ".");
+      victim->cb(victim);
+    }
+    ROS_DEBUG("Controllers found after refreshing them.");
+  }
+
+  bool PlayMotion::preempt(const GoalHandle& goal_hdl, const ControllerList& handed_over)
+  {
+    ControllerList ctrls;
+    {
+      boost::mutex::scoped_lock lock(goal_hdl->mutex);
+      if (goal_hdl->canceled)
+        return false;
+      goal_hdl->canceled = true;
+      goal_hdl->error_code = PMR::PREEMPTED;
+      goal_hdl->error_string = "Preempted by a higher priority goal";
+
+      foreach (const MoveJointGroupPtr& ctrl, handed_over)
+        goal_hdl->controllers.remove(ctrl);
+      ctrls = goal_hdl->controllers;
+    }
+    foreach (MoveJointGroupPtr mjg, ctrls)
+      mjg->cancel();
+    return true;
+  }
+
+  void PlayMotion::execute(const GoalHandle& goal_hdl)
+  {
+    std::map<MoveJointGroupPtr, trajectory_msgs::JointTrajectory> joint_group_traj;
+    LatencyStats::StageTimer timer(goal_hdl->timing, goal_hdl->stage_end);
+    timer.stop(LatencyStats::QUEUED);
+
+    try
+    {
+      if (goal_hdl->refresh_controllers)
+      {
+        reserveRefreshedControllers(goal_hdl);
+        timer.stop(LatencyStats::CONTROLLER_LOOKUP);
+      }
+
+      const JointNames& motion_joints = goal_hdl->motion->joints;
 
       std::vector<double> curr_pos; // Current position of motion joints
-      foreach(const std::string& motion_joint, motion_joints)
-        curr_pos.push_back(joint_states_[motion_joint]); // TODO: What if motion joint does not exist?
+      JointStateBuffer::Selection selection(motion_joints);
+      if (!joint_states_.read(selection, curr_pos))
+        throw PMException("Could not get current position of some motion joints");
 
-      // Approach trajectory
+      // Approaches are prepared ahead of time for the downsampled motion at its nominal speed. Downsampling is done
+      // once per motion, so the motion waypoints all have velocities and are kept as they are when processed below
       Trajectory motion_points_safe;
-      if (!approach_planner_->prependApproach(motion_joints, curr_pos,
-                                              skip_planning,
-                                              motion_points, motion_points_safe))
+      const bool prepared = !goal_hdl->skip_planning &&
+                            takePreparedApproach(goal_hdl->motion, curr_pos, motion_points_safe);
+      const MotionInfoConstPtr nominal_motion = getDownsampledMotion(*goal_hdl->motion_controllers);
+
+      // The speed override is checked again when sending, in case it changed while the motion was being prepared
+      double speed = 1.0;
+      double scale = 1.0;
+      {
+        boost::mutex::scoped_lock lock(controllers_mutex_);
+        speed = speed_override_;
+        scale = goal_hdl->time_scaling / speed;
+      }
+      // The goal keeps the nominal motion, which is read without its lock once the trajectories are sent
+      const bool scaled = scale != 1.0;
+      const MotionInfoConstPtr motion = scaled ? scaleMotion(*nominal_motion, scale) : nominal_motion;
+      const Trajectory& motion_points = motion->traj;
+
+      // Approach trajectory, unless it was prepared ahead of time
+      if (prepared)
+      {
+        ROS_INFO("Using the approach motion prepared ahead of time.");
+        if (scaled)
+        {
+          scaleApproachedMotion(scale, nominal_motion->traj.size(), motion_points_safe);
+          approach_planner_->retimeTrajectory(motion_joints, motion_points_safe);
+        }
+      }
+      else if (!approach_planner_->prependApproach(motion_joints, curr_pos,
+                                                   goal_hdl->skip_planning,
+                                                   motion_points, motion_points_safe))
         throw PMException("Approach motion planning failed", PMR::NO_PLAN_FOUND);// TODO: Expose descriptive error string from approach_planner
+      timer.stop(LatencyStats::APPROACH_PLANNING);
 
-      // TODO: Resample and validate output trajectory
+      // Validate and resample the output trajectory. The motion waypoints following the first one are the same on
+      // every execution, so they are processed once and then reused. Only the approach and the first motion segment,
+      // which blends the approach into the motion, are processed here. The body is still written into the goal of
+      // every controller, as the messages sent can't share it
+      PackedTrajectoryConstPtr body;
+      ros::Duration body_offset;
       try
       {
-        populateVelocities(motion_points_safe, motion_points_safe);
+        // The processed body is cached at the nominal speed, so scaled goals are processed in full
+        const std::size_t body_start = scaled ? 0 : getBodyStart(motion_points, motion_points_safe);
+        if (body_start > 0)
+        {
+          body = getMotionBody(*goal_hdl->motion_controllers, motion_points_safe, body_start);
+          body_offset = motion_points_safe[body_start - 1].time_from_start;
+          motion_points_safe.resize(body_start + 1);
+          body->getPoint(0, motion_points_safe.back());
+          motion_points_safe.back().time_from_start += body_offset;
+        }
+        processTrajectory(motion_points_safe, motion_joints.size());
       }
       catch (const ros::Exception& e){
           throw PMException(e.what(), PMR::OTHER_ERROR);
       }
 
+      // Controllers taken over from a preempted goal may still be moving, so instead of sending them back to the
+      // state read above, let them blend from their current state into the new trajectory
+      if (goal_hdl->took_over)
+        dropInitialWaypoints(motion_points_safe);
+      if (body)
+        motion_points_safe.pop_back(); // First body waypoint, sent with the rest of the body
+      timer.stop(LatencyStats::TRAJECTORY_PROCESSING);
+
+      ControllerList groups;
+      {
+        boost::mutex::scoped_lock lock(goal_hdl->mutex);
+        groups = goal_hdl->controllers;
+      }
+
       // Seed target pose with current joint state
-      foreach (MoveJointGroupPtr move_joint_group, groups)
+      const MotionControllers& motion_ctrls = *goal_hdl->motion_controllers;
+      for (std::size_t i = 0; i < motion_ctrls.groups.size(); ++i)
       {
-        if(!getGroupTraj(move_joint_group, motion_joints, motion_points_safe,
-                         joint_group_traj[move_joint_group]))
+        const MotionControllers::Group& group = motion_ctrls.groups[i];
+        if (std::find(groups.begin(), groups.end(), group.ctrl) == groups.end())
+          continue; // Handed over to another goal
+        if(!getGroupTraj(group, motion_points_safe, body.get(), body_offset, joint_group_traj[group.ctrl]))
           throw PMException("Missing joint state for joint in controller '"
-                            + move_joint_group->getName() + "'");
+                            + group.ctrl->getName() + "'");
       }
       if (joint_group_traj.empty())
         throw PMException("Nothing to send to controllers");
+      timer.stop(LatencyStats::GOAL_SPLIT);
 
       // Send pose commands
-      typedef std::pair<MoveJointGroupPtr, Trajectory> traj_pair_t;
+      boost::mutex::scoped_lock ctrlr_lock(controllers_mutex_);
+      typedef std::pair<const MoveJointGroupPtr, trajectory_msgs::JointTrajectory> traj_pair_t;
+      foreach (const traj_pair_t& p, joint_group_traj)
+      {
+        if (std::find(move_joint_groups_.begin(), move_joint_groups_.end(), p.first) == move_joint_groups_.end())
+          throw PMException("Controller '" + p.first->getName() + "' changed while the motion was being prepared",
+                            PMR::MISSING_CONTROLLER);
+      }
+
+      // The goal state read by getProgress() and checkCompletion() is only written from here on, with the goal lock
+      boost::mutex::scoped_lock goal_lock(goal_hdl->mutex);
+      if (goal_hdl->canceled)
+      {
+        ROS_DEBUG("The Goal was canceled while being prepared, not sending it.");
+        return;
+      }
+
+      if (speed_override_ != speed)
+      {
+        foreach (traj_pair_t& p, joint_group_traj)
+          scaleTrajectory(speed / speed_override_, p.second.points);
+      }
+
+      // Trajectories start as soon as the controllers get them, unless a later start was requested. Goals meant to
+      // start in sync with others fail if they are late, instead of running out of sync
+      goal_hdl->start_time = ros::Time::now();
+      if (goal_hdl->requested_start > goal_hdl->start_time)
+      {
+        goal_hdl->start_time = goal_hdl->requested_start;
+        foreach (traj_pair_t& p, joint_group_traj)
+          p.second.header.stamp = goal_hdl->start_time;
+      }
+      else if (!goal_hdl->requested_start.isZero())
+      {
+        std::ostringstream os;
+        os << "Motion '" << goal_hdl->motion->id << "' was ready "
+           << (goal_hdl->start_time - goal_hdl->requested_start).toSec() << " s after its requested start time";
+        throw PMException(os.str(), PMR::START_TIME_MISSED);
+      }
+      goal_hdl->sent_time = goal_hdl->start_time;
+      goal_hdl->duration = ros::Duration(0.0);
       foreach (const traj_pair_t& p, joint_group_traj)
       {
-        goal_hdl->addController(p.first);
-        p.first->setCallback(boost::bind(controllerCb, _1, goal_hdl, MoveJointGroupWeakPtr(p.first)));
-        if (!p.first->sendGoal(p.second))
+        if (!p.second.points.empty())
+          goal_hdl->duration = std::max(goal_hdl->duration, p.second.points.back().time_from_start);
+      }
+
+      foreach (traj_pair_t& p, joint_group_traj)
+      {
+        if (speed_override_enabled_)
+          goal_hdl->sent_trajs[p.first] = p.second.points; // Sending moves the waypoints out of the trajectory
+        if (!p.first->sendGoal(p.second, boost::bind(controllerCb, _1, goal_hdl, MoveJointGroupWeakPtr(p.first))))
           throw PMException("Controller '" + p.first->getName() + "' did not accept trajectory, "
                             "canceling everything");
+        goal_hdl->ctrl_goal_ids[p.first] = p.first->getGoalId(); // Nothing else is sent to it meanwhile
+      }
+      if (speed_override_enabled_)
+        running_goals_.push_back(goal_hdl);
+      if (goal_hdl->completion_tolerance > 0.0)
+      {
+        goal_hdl->completion_joints = JointStateBuffer::Selection(motion_joints);
+        goal_hdl->completion_target = goal_hdl->motion->traj.back().positions;
+        boost::mutex::scoped_lock lock(settling_mutex_);
+        settling_goals_.push_back(goal_hdl);
+        has_settling_goals_.store(true, std::memory_order_release);
       }
+      timer.stop(LatencyStats::GOAL_SEND);
+      publishGoalStats(goal_hdl, PMR::SUCCEEDED);
     }
     catch (const PMException& e)
     {
-      goal_hdl->error_string = e.what();
-      goal_hdl->error_code = e.error_code();
+      publishGoalStats(goal_hdl, e.error_code());
+      {
+        boost::mutex::scoped_lock lock(goal_hdl->mutex);
+        if (goal_hdl->canceled)
+          return;
+        goal_hdl->error_string = e.what();
+        goal_hdl->error_code = e.error_code();
+      }
+      goal_hdl->cancel();
+      goal_hdl->cb(goal_hdl);
+    }
+  }
+
+  void PlayMotion::speedOverrideCb(const std_msgs::Float64ConstPtr& msg)
+  {
+    try
+    {
+      setSpeedOverride(msg->data);
+    }
+    catch (const PMException& e)
+    {
+      ROS_ERROR_STREAM(e.what());
+    }
+  }
+
+  void PlayMotion::setSpeedOverride(double speed)
+  {
+    if (!speed_override_enabled_)
+      throw PMException("The speed override is not enabled, set the speed_override/enabled parameter");
+    checkSpeedFactor(speed, "Speed override");
+
+    boost::mutex::scoped_lock lock(controllers_mutex_);
+    const double ratio = speed_override_ / speed;
+    speed_override_ = speed;
+    if (ratio == 1.0)
+      return;
+    ROS_INFO_STREAM("Speed override set to " << speed << ".");
+
+    for (std::list<boost::weak_ptr<Goal> >::iterator it = running_goals_.begin(); it != running_goals_.end();)
+    {
+      GoalHandle goal_hdl = it->lock();
+      if (goal_hdl)
+      {
+        boost::mutex::scoped_lock goal_lock(goal_hdl->mutex);
+        if (!goal_hdl->canceled && !goal_hdl->controllers.empty())
+        {
+          rescaleGoal(goal_hdl, ratio);
+          ++it;
+          continue;
+        }
+      }
+      it = running_goals_.erase(it);
+    }
+  }
+
+  void PlayMotion::checkSpeedFactor(double factor, const std::string& what)
+  {
+    // Also rejects NaN
+    if (!(factor >= MIN_SPEED_FACTOR && factor <= MAX_SPEED_FACTOR))
+      throw PMException(what + " must be between " + boost::lexical_cast<std::string>(MIN_SPEED_FACTOR) + " and " +
+                        boost::lexical_cast<std::string>(MAX_SPEED_FACTOR) + ", got " +
+                        boost::lexical_cast<std::string>(factor));
+  }
+
+  double PlayMotion::getSpeedOverride()
+  {
+    boost::mutex::scoped_lock lock(controllers_mutex_);
+    return speed_override_;
+  }
+
+  void PlayMotion::rescaleGoal(const GoalHandle& goal_hdl, double ratio)
+  {
+    // Trajectories with a requested start time may not have started yet
+    const ros::Time start = std::max(ros::Time::now(), goal_hdl->sent_time);
+    const ros::Duration elapsed = start - goal_hdl->sent_time;
+    ros::Duration remaining(0.0);
+
+    typedef std::pair<const MoveJointGroupPtr, Trajectory> traj_pair_t;
+    foreach (traj_pair_t& p, goal_hdl->sent_trajs)
+    {
+      // Controllers that are done, were handed over to another goal or changed are left alone
+      const MoveJointGroupPtr& ctrl = p.first;
+      if (std::find(goal_hdl->controllers.begin(), goal_hdl->controllers.end(), ctrl) == goal_hdl->controllers.end() ||
+          std::find(move_joint_groups_.begin(), move_joint_groups_.end(), ctrl) == move_joint_groups_.end())
+        continue;
+
+      // The controller replaces the trajectory being executed, blending from its current state into the new one
+      Trajectory& traj = p.second;
+      Trajectory::iterator first = traj.begin();
+      while (first != traj.end() && first->time_from_start <= elapsed)
+        ++first;
+      traj.erase(traj.begin(), first);
+      if (traj.empty())
+        continue; // Holding the last waypoint
+      foreach (TrajPoint& point, traj)
+        point.time_from_start -= elapsed;
+      scaleTrajectory(ratio, traj);
+      approach_planner_->retimeTrajectory(ctrl->getJointNames(), traj);
+      remaining = std::max(remaining, traj.back().time_from_start);
+
+      trajectory_msgs::JointTrajectory ctrl_traj;
+      ctrl_traj.header.stamp = start;
+      ctrl_traj.points = traj;
+      if (ctrl->sendGoal(ctrl_traj, boost::bind(controllerCb, _1, goal_hdl, MoveJointGroupWeakPtr(ctrl))))
+        goal_hdl->ctrl_goal_ids[ctrl] = ctrl->getGoalId();
+      else
+        ROS_ERROR_STREAM("Controller '" << ctrl->getName() << "' did not accept the rescaled trajectory.");
+    }
+
+    // Progress keeps counting from the original start
+    goal_hdl->sent_time = start;
+    goal_hdl->duration = (start - goal_hdl->start_time) + remaining;
+  }
+
+  bool PlayMotion::getProgress(const GoalHandle& goal_hdl, Progress& progress)
+  {
+    ControllerList ctrls;
+    {
+      boost::mutex::scoped_lock lock(goal_hdl->mutex);
+      if (goal_hdl->canceled || goal_hdl->start_time.isZero())
+        return false;
+      const ros::Duration elapsed = ros::Time::now() - goal_hdl->start_time;
+      const double duration = goal_hdl->duration.toSec();
+      progress.progress = duration > 0.0 ? std::min(std::max(elapsed.toSec() / duration, 0.0), 1.0) : 1.0;
+      progress.time_remaining = std::max(goal_hdl->duration - elapsed, ros::Duration(0.0));
+      ctrls = goal_hdl->controllers;
+    }
+
+    // Controllers that are done are no longer in the goal
+    progress.max_tracking_error = 0.0;
+    foreach (const MoveJointGroupPtr& ctrl, ctrls)
+      progress.max_tracking_error = std::max(progress.max_tracking_error, ctrl->getTrackingError());
+    return true;
+  }
+
+  void PlayMotion::prepare(const std::string& motion_name)
+  {
+    MotionInfoConstPtr motion = motion_library_->getMotion(motion_name);
+    if (approach_planner_->isPlanningDisabled())
+      throw PMException("Motion planning capability disabled, there is no approach to prepare", PMR::NO_PLAN_FOUND);
+
+    PreparedApproach prepared;
+    prepared.motion = motion;
+    predictStartPos(motion, prepared.start_pos);
+    const MotionInfoConstPtr downsampled = downsampleMotion(motion);
+    if (!approach_planner_->prepareApproach(motion->joints, prepared.start_pos, downsampled->traj, prepared.traj))
+      throw PMException("Approach motion planning failed", PMR::NO_PLAN_FOUND);
+
+    boost::mutex::scoped_lock lock(prepared_mutex_);
+    prepared_approaches_[motion_name] = prepared;
+  }
+
+  void PlayMotion::predictStartPos(const MotionInfoConstPtr& motion, std::vector<double>& start_pos)
+  {
+    JointStateBuffer::Selection selection(motion->joints);
+    if (!joint_states_.read(selection, start_pos))
+      throw PMException("Could not get current position of some motion joints");
+
+    // Joints used by the goals being played end up at the last waypoint of their motions
+    boost::mutex::scoped_lock lock(controllers_mutex_);
+    std::vector<std::string> reserved;
+    typedef std::pair<std::string, boost::weak_ptr<Goal> > reservation_pair_t;
+    foreach (const reservation_pair_t& p, reservations_)
+      reserved.push_back(p.first);
+
+    foreach (const std::string& controller_name, reserved)
+    {
+      GoalHandle owner = getReservation(controller_name);
+      if (!owner || owner->motion->traj.empty())
+        continue;
+      const JointNames& owner_joints = owner->motion->joints;
+      const TrajPoint&  owner_end    = owner->motion->traj.back();
+      for (std::size_t i = 0; i < motion->joints.size(); ++i)
+      {
+        JointNames::const_iterator it = std::find(owner_joints.begin(), owner_joints.end(), motion->joints[i]);
+        if (it != owner_joints.end())
+          start_pos[i] = owner_end.positions[it - owner_joints.begin()];
+      }
+    }
+  }
+
+  bool PlayMotion::takePreparedApproach(const MotionInfoConstPtr& motion, const std::vector<double>& curr_pos,
+                                        Trajectory& traj)
+  {
+    boost::mutex::scoped_lock lock(prepared_mutex_);
+    PreparedApproaches::iterator it = prepared_approaches_.find(motion->id);
+    if (it == prepared_approaches_.end())
+      return false;
+
+    // Approaches are prepared for a single use. They are also dropped if the motion was reloaded meanwhile
+    PreparedApproach prepared = it->second;
+    prepared_approaches_.erase(it);
+    if (prepared.motion != motion)
+      return false;
+    if (approach_planner_->needsApproach(curr_pos, prepared.start_pos))
+    {
+      ROS_DEBUG_STREAM("Not using the approach prepared for motion '" << motion->id << "', the robot is not at the "
+                       "predicted start state.");
       return false;
     }
+    traj.swap(prepared.traj);
     return true;
   }
+
+  bool PlayMotion::isAlreadyThere(const std::string& motion_name, double tolerance)
+  {
+    std::vector<double> max_deviation;
+    getStartDeviations(MotionNames(1, motion_name), max_deviation);
+    return max_deviation.front() <= tolerance;
+  }
+
+  void PlayMotion::getStartDeviations(const MotionNames& motion_names, std::vector<double>& max_deviation)
+  {
+    const double inf = std::numeric_limits<double>::infinity();
+    boost::mutex::scoped_lock lock(start_check_mutex_);
+
+    // Resolve the motions, adding the joints not checked so far. Existing indices stay valid, as joints are appended
+    std::vector<const StartCheck::Motion*> motions(motion_names.size(), 0);
+    JointNames joints = start_check_.joints.getJointNames();
+    for (std::size_t i = 0; i < motion_names.size(); ++i)
+    {
+      MotionInfoConstPtr motion;
+      try
+      {
+        motion = motion_library_->getMotion(motion_names[i]);
+      }
+      catch (const PMException& e)
+      {
+        ROS_DEBUG_STREAM(e.what());
+        continue;
+      }
+      if (motion->traj.empty())
+        continue;
+
+      StartCheck::Motion& entry = start_check_.motions[motion_names[i]];
+      if (entry.motion != motion)
+      {
+        entry.motion = motion;
+        entry.indices.clear();
+        foreach (const std::string& joint, motion->joints)
+        {
+          std::map<std::string, std::size_t>::const_iterator it = start_check_.joint_index.find(joint);
+          if (it == start_check_.joint_index.end())
+          {
+            it = start_check_.joint_index.insert(std::make_pair(joint, joints.size())).first;
+            joints.push_back(joint);
+          }
+          entry.indices.push_back(it->second);
+        }
+      }
+      motions[i] = &entry;
+    }
+    if (joints.size() != start_check_.joints.getJointNames().size())
+      start_check_.joints = JointStateBuffer::Selection(joints);
+
+    // Single snapshot for all the motions
+    std::vector<double> curr_pos;
+    joint_states_.readAvailable(start_check_.joints, curr_pos);
+
+    max_deviation.assign(motion_names.size(), inf);
+    for (std::size_t i = 0; i < motions.size(); ++i)
+    {
+      if (!motions[i])
+        continue;
+
+      const std::vector<double>& goal_pos = motions[i]->motion->traj.front().positions;
+      const std::vector<std::size_t>& indices = motions[i]->indices;
+      double deviation = 0.0;
+      for (std::size_t j = 0; j < indices.size(); ++j)
+      {
+        const double diff = std::fabs(goal_pos[j] - curr_pos[indices[j]]);
+        if (std::isnan(diff))
+        {
+          ROS_DEBUG_STREAM("Could not get current position of some joints of motion '" << motion_names[i] << "'.");
+          deviation = inf;
+          break;
+        }
+        deviation = std::max(deviation, diff);
+      }
+      max_deviation[i] = deviation;
+    }
+  }
 }
@@ -36,7 +36,12 @@
 /** \author Victor Lopez. */
 /** \author Bence Magyar. */
 #include "play_motion/play_motion_helpers.h"
+#include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <map>
+#include <set>
+#include <sstream>
 
 #include <ros/ros.h>
 #include <boost/foreach.hpp>
@@ -89,12 +94,128 @@ namespace play_motion
       xh::getArrayItem(joint_names, i, motion_joints[i]);
   }
 
+  MotionHandle::MotionHandle(const ros::NodeHandle& nh, const std::string& motion_id)
+    : nh_(getMotionsNodeHandle(nh)),
+      id_(motion_id)
+  {}
+
+  MotionHandle::MotionHandle(const std::string& motion_id)
+    : nh_(getMotionsNodeHandle(ros::NodeHandle("play_motion"))),
+      id_(motion_id)
+  {}
+
+  void MotionHandle::fetchMember(const std::string& member, XmlRpc::XmlRpcValue& value) const
+  {
+    if (id_.empty())
+      throw ros::Exception("Motion '' does not exist (namespace " + nh_.getNamespace() + ").");
+    xh::fetchParam(nh_, id_ + "/" + member, value);
+  }
+
+  const JointNames& MotionHandle::getJoints() const
+  {
+    if (!joints_)
+    {
+      xh::Array joint_names;
+      fetchMember("joints", joint_names);
+      boost::shared_ptr<JointNames> joints(new JointNames);
+      extractJoints(joint_names, *joints);
+      joints_ = joints;
+    }
+    return *joints_;
+  }
+
+  void MotionHandle::fetchMeta() const
+  {
+    if (meta_)
+      return;
+
+    boost::shared_ptr<MotionInfo> meta(new MotionInfo);
+    meta->id = id_;
+    xh::Struct param;
+    bool has_meta = false;
+    try
+    {
+      has_meta = !id_.empty() && nh_.getParamCached(id_ + "/meta", param);
+    }
+    catch (const ros::InvalidNameException&) {}
+    if (has_meta)
+    {
+      xh::getStructMember(param, "description", meta->description);
+      xh::getStructMember(param, "name", meta->name);
+      xh::getStructMember(param, "usage", meta->usage);
+    }
+    meta_ = meta;
+  }
+
+  const std::string& MotionHandle::getName() const
+  {
+    fetchMeta();
+    return meta_->name;
+  }
+
+  const std::string& MotionHandle::getUsage() const
+  {
+    fetchMeta();
+    return meta_->usage;
+  }
+
+  const std::string& MotionHandle::getDescription() const
+  {
+    fetchMeta();
+    return meta_->description;
+  }
+
+  void MotionHandle::fetchPoints() const
+  {
+    if (points_ || points_raw_)
+      return;
+
+    boost::shared_ptr<XmlRpc::XmlRpcValue> points(new XmlRpc::XmlRpcValue);
+    fetchMember("points", *points);
+    if (points->getType() != XmlRpc::XmlRpcValue::TypeArray || points->size() == 0)
+      throw ros::Exception("Motion '" + id_ + "' is malformed: it has no points.");
+    points_raw_ = points;
+  }
+
+  ros::Duration MotionHandle::getDuration() const
+  {
+    if (points_)
+      return points_->back().time_from_start;
+
+    // Only the time of the last waypoint is parsed
+    fetchPoints();
+    double tfs;
+    xh::getStructMember((*points_raw_)[points_raw_->size() - 1], "time_from_start", tfs);
+    return ros::Duration(tfs);
+  }
+
+  const Trajectory& MotionHandle::getPoints() const
+  {
+    if (!points_)
+    {
+      fetchPoints();
+      boost::shared_ptr<Trajectory> traj(new Trajectory);
+      extractTrajectory(*points_raw_, *traj);
+      points_ = traj;
+      points_raw_.reset();
+    }
+    return *points_;
+  }
+
+  void MotionHandle::getMotion(MotionInfo& motion_info) const
+  {
+    motion_info.id = id_;
+    motion_info.joints = getJoints();
+    motion_info.traj = getPoints();
+    motion_info.name = getName();
+    motion_info.usage = getUsage();
+    motion_info.description = getDescription();
+  }
+
   void getMotionJoints(const ros::NodeHandle &nh, const std::string& motion_id,
                        JointNames& motion_joints)
   {
-    MotionInfo info;
-    getMotion(nh, motion_id, info);
-    motion_joints = info.joints;
+    motion_joints = MotionHandle(nh, motion_id).getJoints();
   }
 
   void getMotionJoints(const std::string& motion_id, JointNames& motion_joints)
@@ -106,9 +227,7 @@ namespace play_motion
   void getMotionPoints(const ros::NodeHandle &nh, const std::string& motion_id,
                        Trajectory& motion_points)
   {
-    MotionInfo info;
-    getMotion(nh, motion_id, info);
-    motion_points = info.traj;
+    motion_points = MotionHandle(nh, motion_id).getPoints();
   }
 
   void getMotionPoints(const std::string& motion_id, Trajectory& motion_points)
@@ -119,13 +238,25 @@ namespace play_motion
 
   void getMotionIds(const ros::NodeHandle &nh, MotionNames& motion_ids)
   {
-    xh::Struct motions;
-
-    xh::fetchParam(nh, "motions/", motions);
-    for (xh::Struct::iterator it = motions.begin(); it != motions.end(); ++it)
+    // Motion identifiers are the first component of the parameter names below the motions namespace
+    std::vector<std::string> param_names;
+    if (!nh.getParamNames(param_names))
+      throw xh::XmlrpcHelperException("could not fetch parameter names.");
+
+    const std::string prefix = getMotionsNodeHandle(nh).getNamespace() + "/";
+    std::set<std::string> ids;
+    foreach (const std::string& param_name, param_names)
     {
-      motion_ids.push_back(it->first);
+      if (param_name.compare(0, prefix.size(), prefix) != 0)
+        continue;
+      const std::string id = param_name.substr(prefix.size(), param_name.find('/', prefix.size()) - prefix.size());
+      if (!id.empty())
+        ids.insert(id);
     }
+    if (ids.empty())
+      throw xh::XmlrpcHelperException("could not load parameter 'motions/'. (namespace: " + nh.getNamespace() + ")");
+
+    motion_ids.insert(motion_ids.end(), ids.begin(), ids.end());
   }
 
   void getMotionIds(MotionNames& motion_ids)
@@ -177,30 +308,238 @@ namespace play_motion
     }
   }
 
+  void populateVelocities(std::size_t   num_points,
+                          std::size_t   num_joints,
+                          const double* times,
+                          const double* positions,
+                                double* velocities)
+  {
+    for (std::size_t i = 1; i + 1 < num_points; ++i)
+    {
+      // Segment durations are shared by all joints
+      const double  t_prev   = times[i] - times[i - 1];
+      const double  t_next   = times[i + 1] - times[i];
+      const double* pos_prev = positions + (i - 1) * num_joints;
+      const double* pos_curr = pos_prev + num_joints;
+      const double* pos_next = pos_curr + num_joints;
+      double*       vel_out  = velocities + i * num_joints;
+
+      for (std::size_t j = 0; j < num_joints; ++j)
+      {
+        const double d_prev = pos_curr[j] - pos_prev[j];
+        const double d_next = pos_next[j] - pos_curr[j];
+
+        // Zero velocity is enforced unless the joint keeps moving in the same direction. Same special cases as the
+        // point-wise version, written as a select so that the loop can be vectorized
+        const bool   monotonic = (d_prev > 0.0 && d_next > 0.0) || (d_prev < 0.0 && d_next < 0.0);
+        const double vel       = 0.5 * (d_prev / t_prev + d_next / t_next);
+        vel_out[j] = monotonic ? vel : 0.0;
+      }
+    }
+  }
+
   void populateVelocities(const Trajectory& traj_in, Trajectory& traj_out)
   {
     if (traj_in.empty()) {return;}
+    if (&traj_in != &traj_out) {traj_out = traj_in;}
 
-    const int num_waypoints = traj_in.size();
-    const int num_joints    = traj_in.front().positions.size();
+    const std::size_t num_waypoints = traj_out.size();
+    const std::size_t num_joints    = traj_out.front().positions.size();
 
     // Initialize first and last points with zero velocity, if unspecified or not properly sized
     TrajPoint& point_first = traj_out.front();
     TrajPoint& point_last  = traj_out.back();
 
-    if (int(point_first.velocities.size()) != num_joints) {point_first.velocities.resize(num_joints, 0.0);}
-    if (int(point_last.velocities.size())  != num_joints) {point_last.velocities.resize(num_joints, 0.0);}
+    if (point_first.velocities.size() != num_joints) {point_first.velocities.resize(num_joints, 0.0);}
+    if (point_last.velocities.size()  != num_joints) {point_last.velocities.resize(num_joints, 0.0);}
+
+    if (num_waypoints < 3) {return;}
 
-    // Populate velocities for remaining points (all but first and last)
-    for (int i = 1; i < num_waypoints - 1; ++i) {populateVelocities(traj_in[i - 1], traj_in[i + 1], traj_out[i]);}
+    // Pack times and positions into contiguous arrays
+    std::vector<double> times(num_waypoints);
+    std::vector<double> positions(num_waypoints * num_joints);
+    std::vector<double> velocities(num_waypoints * num_joints);
+    for (std::size_t i = 0; i < num_waypoints; ++i)
+    {
+      const TrajPoint& point = traj_out[i];
+      if (point.positions.size() != num_joints)
+        throw ros::Exception("The positions array of a point of the trajectory does not have the same number of joints as the trajectory joint_names say.");
+      times[i] = point.time_from_start.toSec();
+      std::copy(point.positions.begin(), point.positions.end(), positions.begin() + i * num_joints);
+    }
+
+    populateVelocities(num_waypoints, num_joints, &times[0], &positions[0], &velocities[0]);
+
+    // Populate velocities for remaining points (all but first and last), unless they have a valid specification
+    for (std::size_t i = 1; i < num_waypoints - 1; ++i)
+    {
+      std::vector<double>& vel_out = traj_out[i].velocities;
+      if (vel_out.size() == num_joints) {continue;}
+      vel_out.assign(velocities.begin() + i * num_joints, velocities.begin() + (i + 1) * num_joints);
+    }
   }
 
-  ros::Duration getMotionDuration(const ros::NodeHandle &nh, const std::string &motion_id)
+  void validateTrajectory(const Trajectory& traj, std::size_t num_joints)
+  {
+    for (std::size_t i = 0; i < traj.size(); ++i)
+    {
+      const TrajPoint& point = traj[i];
+      std::ostringstream where;
+      where << "Waypoint " << i << " of the trajectory";
+
+      if (point.positions.size() != num_joints)
+        throw ros::Exception(where.str() + " does not have as many positions as joints.");
+      if (!point.velocities.empty() && point.velocities.size() != num_joints)
+        throw ros::Exception(where.str() + " does not have as many velocities as joints.");
+      if (!point.accelerations.empty() && point.accelerations.size() != num_joints)
+        throw ros::Exception(where.str() + " does not have as many accelerations as joints.");
+
+      for (std::size_t j = 0; j < num_joints; ++j)
+      {
+        if (!std::isfinite(point.positions[j]) ||
+            (!point.velocities.empty() && !std::isfinite(point.velocities[j])) ||
+            (!point.accelerations.empty() && !std::isfinite(point.accelerations[j])))
+          throw ros::Exception(where.str() + " has non-finite values.");
+      }
+
+      const double time = point.time_from_start.toSec();
+      if (!std::isfinite(time) || time < 0.0)
+        throw ros::Exception(where.str() + " has an invalid time from start.");
+      if (i > 0 && time <= traj[i - 1].time_from_start.toSec())
+        throw ros::Exception(where.str() + " does not come after the previous one.");
+    }
+  }
+
+  void downsampleTrajectory(const Trajectory& traj_in, double tolerance, Trajectory& traj_out)
+  {
+    // The kept waypoints keep the velocities computed from their original neighbours, so that the controllers
+    // interpolate the same cubic segments the deviation is measured against
+    Trajectory traj;
+    populateVelocities(traj_in, traj);
+    if (traj.size() < 3)
+    {
+      traj_out.swap(traj);
+      return;
+    }
+
+    // Recursively split the trajectory at the waypoint that deviates the most from the cubic segment between the
+    // segment endpoints. An explicit stack avoids deep recursion on motions with many waypoints
+    std::vector<bool> keep(traj.size(), false);
+    keep.front() = keep.back() = true;
+    std::vector<std::pair<std::size_t, std::size_t> > segments(1, std::make_pair(0, traj.size() - 1));
+    while (!segments.empty())
+    {
+      const std::size_t first = segments.back().first;
+      const std::size_t last  = segments.back().second;
+      segments.pop_back();
+      if (last - first < 2)
+        continue;
+
+      const TrajPoint& p_first = traj[first];
+      const TrajPoint& p_last  = traj[last];
+      const double t_first = p_first.time_from_start.toSec();
+      const double T       = p_last.time_from_start.toSec() - t_first;
+
+      // Controllers interpolate segments with acceleration specification with quintic polynomials instead, so their
+      // waypoints are all kept
+      std::size_t split = first;
+      if (!traj_in[first].accelerations.empty() || !traj_in[last].accelerations.empty())
+        split = first + 1;
+      else
+      {
+        double max_dev = tolerance;
+        for (std::size_t i = first + 1; i < last; ++i)
+        {
+          const TrajPoint& point = traj[i];
+          if (!traj_in[i].velocities.empty() || !traj_in[i].accelerations.empty())
+          {
+            split = i; // Always kept
+            break;
+          }
+          const double t = point.time_from_start.toSec() - t_first;
+          for (std::size_t j = 0; j < point.positions.size(); ++j)
+          {
+            // Cubic Hermite interpolation, as in upsampleTrajectory()
+            const double d  = p_last.positions[j] - p_first.positions[j];
+            const double c2 = (3.0 * d - (2.0 * p_first.velocities[j] + p_last.velocities[j]) * T) / (T * T);
+            const double c3 = (-2.0 * d + (p_first.velocities[j] + p_last.velocities[j]) * T) / (T * T * T);
+            const double interp = ((c3 * t + c2) * t + p_first.velocities[j]) * t + p_first.positions[j];
+            const double dev = std::abs(point.positions[j] - interp);
+            if (dev > max_dev)
+            {
+              max_dev = dev;
+              split = i;
+            }
+          }
+        }
+      }
+
+      if (split == first)
+        continue; // All intermediate waypoints are within tolerance
+      keep[split] = true;
+      segments.push_back(std::make_pair(first, split));
+      segments.push_back(std::make_pair(split, last));
+    }
+
+    Trajectory traj_kept;
+    traj_kept.reserve(std::count(keep.begin(), keep.end(), true));
+    for (std::size_t i = 0; i < traj.size(); ++i)
+    {
+      if (keep[i])
+        traj_kept.push_back(traj[i]);
+    }
+    traj_out.swap(traj_kept);
+  }
+
+  void upsampleTrajectory(const Trajectory& traj_in, double max_period, Trajectory& traj_out)
   {
+    if (traj_in.size() < 2 || max_period <= 0.0)
+    {
+      traj_out = traj_in;
+      return;
+    }
+
     Trajectory traj;
-    getMotionPoints(nh, motion_id, traj);
+    traj.push_back(traj_in.front());
+    for (std::size_t i = 1; i < traj_in.size(); ++i)
+    {
+      const TrajPoint& p0 = traj_in[i - 1];
+      const TrajPoint& p1 = traj_in[i];
+      const std::size_t num_joints = p0.positions.size();
+      if (p0.velocities.size() != num_joints || p1.velocities.size() != num_joints)
+        throw ros::Exception("Can't upsample a trajectory without velocity specification.");
+
+      const double t0 = p0.time_from_start.toSec();
+      const double T  = p1.time_from_start.toSec() - t0;
+      // Controllers interpolate segments with acceleration specification with quintic polynomials instead
+      const int num_steps = p0.accelerations.empty() && p1.accelerations.empty() ?
+                            static_cast<int>(std::ceil(T / max_period)) : 1;
+      for (int k = 1; k < num_steps; ++k)
+      {
+        // Cubic Hermite interpolation
+        const double t = T * k / num_steps;
+        TrajPoint point;
+        point.positions.resize(num_joints);
+        point.velocities.resize(num_joints);
+        for (std::size_t j = 0; j < num_joints; ++j)
+        {
+          const double d  = p1.positions[j] - p0.positions[j];
+          const double c2 = (3.0 * d - (2.0 * p0.velocities[j] + p1.velocities[j]) * T) / (T * T);
+          const double c3 = (-2.0 * d + (p0.velocities[j] + p1.velocities[j]) * T) / (T * T * T);
+          point.positions[j]  = ((c3 * t + c2) * t + p0.velocities[j]) * t + p0.positions[j];
+          point.velocities[j] = (3.0 * c3 * t + 2.0 * c2) * t + p0.velocities[j];
+        }
+        point.time_from_start = ros::Duration(t0 + t);
+        traj.push_back(point);
+      }
+      traj.push_back(p1);
+    }
+    traj_out.swap(traj);
+  }
 
-    return traj.back().time_from_start;
+  ros::Duration getMotionDuration(const ros::NodeHandle &nh, const std::string &motion_id)
+  {
+    return MotionHandle(nh, motion_id).getDuration();
   }
 
   ros::Duration getMotionDuration(const std::string &motion_id)
@@ -238,16 +577,28 @@ namespace play_motion
     if (source_joints.size() != source_point.positions.size())
       throw ros::Exception("sourceJoint and sourcePoint positions sizes do not match");
 
+    // Joints are usually listed in the same order, otherwise source joints are looked up by name
+    const bool same_joints = target_joints == source_joints;
+    std::map<std::string, int> source_index;
+    if (!same_joints)
+    {
+      for (int sIndex = 0; sIndex < source_joints.size(); ++sIndex)
+        source_index.insert(std::make_pair(source_joints[sIndex], sIndex));
+    }
+
     for (int tIndex = 0; tIndex < target_joints.size(); ++tIndex)
     {
-      JointNames::const_iterator it = std::find(source_joints.begin(), source_joints.end(),
-                                                target_joints[tIndex]);
-      /// If a joint used in the target is not used in the available in the
-      /// source can't guarantee that the points are equivalent
-      if (it == source_joints.end())
-        return false;
+      int sIndex = tIndex;
+      if (!same_joints)
+      {
+        std::map<std::string, int>::const_iterator it = source_index.find(target_joints[tIndex]);
+        /// If a joint used in the target is not used in the available in the
+        /// source can't guarantee that the points are equivalent
+        if (it == source_index.end())
+          return false;
+        sIndex = it->second;
+      }
 
-      int sIndex = it - source_joints.begin();
       if (std::fabs(target_point.positions[tIndex] - source_point.positions[sIndex]) > tolerance)
         return false;
     }
@@ -263,10 +614,17 @@ namespace play_motion
                                "(namespace " + getMotionsNodeHandle(nh).getNamespace() + ").";
       throw ros::Exception(what);
     }
-    motion_info.id = motion_id;
     xh::Struct param;
     xh::fetchParam(getMotionsNodeHandle(nh), motion_id, param);
+    parseMotion(motion_id, param, motion_info);
+  }
 
+  void parseMotion(const std::string &motion_id, XmlRpc::XmlRpcValue &param,
+                   MotionInfo &motion_info)
+  {
+    xh::checkStructMember(param, "points");
+    xh::checkStructMember(param, "joints");
+    motion_info.id = motion_id;
     extractTrajectory(param["points"], motion_info.traj);
     extractJoints(param["joints"], motion_info.joints);
     if (param.hasMember("meta"))
@@ -0,0 +1,317 @@
+/*
+ * Software License Agreement (Modified BSD License)
+ *
+ *  Copyright (c) 2013, PAL Robotics, S.L.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of PAL Robotics, S.L. nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "play_motion/play_motion_router.h"
+
+#include <algorithm>
+
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+
+#include "play_motion/motion_library.h"
+#include "play_motion/play_motion.h"
+
+#define foreach BOOST_FOREACH
+
+namespace play_motion
+{
+  PlayMotionRouter::PlayMotionRouter(const ros::NodeHandle& nh)
+    : nh_(nh),
+      sync_delay_(0.5),
+      al_server_(nh_, "play_motion", false)
+  {
+    ros::NodeHandle private_nh("~");
+
+    // Action server of each instance, and the joints of the controllers it owns
+    XmlRpc::XmlRpcValue shards;
+    if (!private_nh.getParam("shards", shards) || shards.getType() != XmlRpc::XmlRpcValue::TypeStruct ||
+        shards.size() == 0)
+      throw ros::Exception("No play_motion instances specified in " + private_nh.resolveName("shards"));
+    for (XmlRpc::XmlRpcValue::iterator it = shards.begin(); it != shards.end(); ++it)
+    {
+      Shard shard;
+      shard.name = it->first;
+      std::string action;
+      const std::string ns = "shards/" + shard.name + "/";
+      if (!private_nh.getParam(ns + "action", action) || !private_nh.getParam(ns + "joints", shard.joints) ||
+          shard.joints.empty())
+        throw ros::Exception("Instance '" + shard.name + "' needs an action and a list of joints");
+      foreach (const Shard& other, shards_)
+      {
+        foreach (const std::string& joint, shard.joints)
+        {
+          if (std::find(other.joints.begin(), other.joints.end(), joint) != other.joints.end())
+            throw ros::Exception("Joint '" + joint + "' is owned by both instance '" + other.name + "' and '" +
+                                 shard.name + "'");
+        }
+      }
+      shard.client.reset(new AlClient(nh_, action));
+      shards_.push_back(shard);
+      ROS_INFO_STREAM("Routing goals on " << shard.joints.size() << " joints to instance '" << shard.name << "'.");
+    }
+
+    double sync_delay = sync_delay_.toSec();
+    private_nh.getParam("sync_delay", sync_delay);
+    sync_delay_ = ros::Duration(std::max(sync_delay, 0.0));
+
+    // Motions are routed by their joints, read from the library shared with the instances
+    std::string library_ns;
+    private_nh.getParam("motion_library/namespace", library_ns);
+    motion_library_.reset(new MotionLibrary(library_ns.empty() ? private_nh : ros::NodeHandle(library_ns)));
+    motion_library_->load();
+
+    // The library is kept in sync with the one of the instances on request, or periodically
+    double watch_period = 0.0;
+    private_nh.getParam("motion_library/watch_period", watch_period);
+    if (watch_period > 0.0)
+      motion_library_->startWatching(ros::WallDuration(watch_period));
+    reload_motions_srv_ = private_nh.advertiseService("reload_motions", &PlayMotionRouter::reloadMotions, this);
+
+    al_server_.registerGoalCallback(boost::bind(&PlayMotionRouter::alGoalCb, this, _1));
+    al_server_.registerCancelCallback(boost::bind(&PlayMotionRouter::alCancelCb, this, _1));
+    al_server_.start();
+  }
+
+  void PlayMotionRouter::alGoalCb(AlServer::GoalHandle gh)
+  {
+    AlServer::GoalConstPtr goal = gh.getGoal();
+    Result r;
+    std::vector<JointNames> shard_joints(shards_.size()); // Goal joints owned by each instance
+    try
+    {
+      foreach (const std::string& joint, getGoalJoints(*goal))
+      {
+        std::size_t i = 0;
+        while (i < shards_.size() && std::find(shards_[i].joints.begin(), shards_[i].joints.end(), joint) ==
+                                     shards_[i].joints.end())
+          ++i;
+        if (i == shards_.size())
+          throw PMException("No play_motion instance owns joint '" + joint + "'", PMR::MISSING_CONTROLLER);
+        shard_joints[i].push_back(joint);
+      }
+
+      // Goals sent to a disconnected instance would never finish
+      for (std::size_t i = 0; i < shards_.size(); ++i)
+      {
+        if (!shard_joints[i].empty() && !shards_[i].client->isServerConnected())
+          throw PMException("play_motion instance '" + shards_[i].name + "' is not connected",
+                            PMR::MISSING_CONTROLLER);
+      }
+    }
+    catch (const PMException& e)
+    {
+      r.error_code = e.error_code();
+      r.error_string = e.what();
+      ROS_ERROR_STREAM(r.error_string);
+      gh.setRejected(r);
+      return;
+    }
+
+    RoutePtr route(new Route());
+    route->gh = gh;
+    for (std::size_t i = 0; i < shards_.size(); ++i)
+    {
+      if (!shard_joints[i].empty())
+        route->shards.push_back(i);
+    }
+    route->feedback.resize(route->shards.size());
+    route->pending = route->shards.size();
+
+    // Parts of a split goal start in sync, once they all had time to be prepared
+    Goal part_goal = *goal;
+    const bool split = route->shards.size() > 1;
+    if (split && part_goal.start_time.isZero())
+      part_goal.start_time = ros::Time::now() + sync_delay_;
+
+    gh.setAccepted();
+    boost::mutex::scoped_lock lock(routes_mutex_);
+    routes_[gh.getGoalID().id] = route;
+    for (std::size_t part = 0; part < route->shards.size(); ++part)
+    {
+      const Shard& shard = shards_[route->shards[part]];
+      if (split)
+        part_goal.joints = shard_joints[route->shards[part]];
+      ROS_DEBUG_STREAM("Sending part of the goal on " << shard_joints[route->shards[part]].size() << " joints to "
+                       "instance '" << shard.name << "'.");
+      route->parts.push_back(shard.client->sendGoal(part_goal,
+                                                    boost::bind(&PlayMotionRouter::transitionCb, this, route, part, _1),
+                                                    boost::bind(&PlayMotionRouter::feedbackCb, this, route, part, _2)));
+    }
+  }
+
+  void PlayMotionRouter::alCancelCb(AlServer::GoalHandle gh)
+  {
+    std::vector<AlClient::GoalHandle> canceled;
+    {
+      boost::mutex::scoped_lock lock(routes_mutex_);
+      std::map<std::string, RoutePtr>::iterator it = routes_.find(gh.getGoalID().id);
+      if (it != routes_.end())
+      {
+        it->second->finished = true;
+        foreach (AlClient::GoalHandle& part_gh, it->second->parts)
+        {
+          if (part_gh.getCommState() != actionlib::CommState::DONE)
+            canceled.push_back(part_gh);
+        }
+        it->second->parts.clear(); // The part callbacks keep the route alive while it tracks the parts
+        routes_.erase(it);
+      }
+      else
+        ROS_ERROR("Cancel request could not be fulfilled. Goal not running?.");
+    }
+
+    // Canceling calls the transition callback right away
+    foreach (AlClient::GoalHandle& part_gh, canceled)
+      part_gh.cancel();
+    gh.setCanceled();
+  }
+
+  void PlayMotionRouter::transitionCb(const RoutePtr& route, std::size_t part, AlClient::GoalHandle part_gh)
+  {
+    if (part_gh.getCommState() != actionlib::CommState::DONE)
+      return;
+
+    std::vector<AlClient::GoalHandle> canceled;
+    {
+      boost::mutex::scoped_lock lock(routes_mutex_);
+      if (route->finished)
+        return;
+
+      Result r;
+      AlClient::GoalHandle::ResultConstPtr result = part_gh.getResult();
+      if (result)
+        r = *result;
+      if (r.error_code == 0)
+      {
+        r.error_code = PMR::OTHER_ERROR;
+        r.error_string = "Instance '" + shards_[route->shards[part]].name + "' finished its part of the goal in state " +
+                         part_gh.getTerminalState().toString() + " without a result";
+      }
+
+      // The goal fails as soon as some part fails, and succeeds once all of them do
+      if (r.error_code != PMR::SUCCEEDED || --route->pending == 0)
+        finish(route, r, canceled);
+    }
+
+    foreach (AlClient::GoalHandle& gh, canceled)
+      gh.cancel();
+  }
+
+  void PlayMotionRouter::feedbackCb(const RoutePtr& route, std::size_t part, const FeedbackConstPtr& feedback)
+  {
+    boost::mutex::scoped_lock lock(routes_mutex_);
+    if (route->finished)
+      return;
+    route->feedback[part] = *feedback;
+
+    // The goal is as far as its slowest part
+    Feedback aggregated;
+    aggregated.progress = 1.0;
+    foreach (const Feedback& f, route->feedback)
+    {
+      aggregated.progress = std::min(aggregated.progress, f.progress);
+      aggregated.time_remaining = std::max(aggregated.time_remaining, f.time_remaining);
+      aggregated.max_tracking_error = std::max(aggregated.max_tracking_error, f.max_tracking_error);
+    }
+    route->gh.publishFeedback(aggregated);
+  }
+
+  bool PlayMotionRouter::reloadMotions(play_motion_msgs::ReloadMotions::Request&  req,
+                                       play_motion_msgs::ReloadMotions::Response& resp)
+  {
+    MotionLibrary::ReloadReport report;
+    resp.success = motion_library_->reload(report);
+    resp.added   = report.added;
+    resp.changed = report.changed;
+    resp.removed = report.removed;
+    resp.message = resp.success ? "Motions reloaded." : "Could not fetch motions from the parameter server.";
+    return true;
+  }
+
+  void PlayMotionRouter::finish(const RoutePtr& route, const Result& result,
+                                std::vector<AlClient::GoalHandle>& canceled)
+  {
+    if (route->finished)
+      return;
+    route->finished = true;
+    routes_.erase(route->gh.getGoalID().id);
+
+    // The rest of parts are stopped on failure. The part callbacks keep the route alive while it tracks the parts
+    foreach (AlClient::GoalHandle& part_gh, route->parts)
+    {
+      if (result.error_code != PMR::SUCCEEDED && part_gh.getCommState() != actionlib::CommState::DONE)
+        canceled.push_back(part_gh);
+    }
+    route->parts.clear();
+
+    if (result.error_code == PMR::SUCCEEDED)
+    {
+      ROS_INFO("Motion played successfully.");
+      route->gh.setSucceeded(result);
+      return;
+    }
+    if (result.error_code == PMR::PREEMPTED)
+    {
+      ROS_INFO("Motion preempted by a higher priority goal.");
+      route->gh.setCanceled(result, result.error_string);
+    }
+    else
+    {
+      ROS_WARN("Motion ended with an error code %d and description '%s'", result.error_code,
+               result.error_string.c_str());
+      route->gh.setAborted(result);
+    }
+  }
+
+  JointNames PlayMotionRouter::getGoalJoints(const Goal& goal) const
+  {
+    if (!goal.joints.empty())
+      return goal.joints;
+
+    MotionNames motions = goal.sequence;
+    if (motions.empty())
+      motions.push_back(goal.motion_name);
+
+    JointNames joints;
+    foreach (const std::string& motion_name, motions)
+    {
+      foreach (const std::string& joint, motion_library_->getMotion(motion_name)->joints)
+      {
+        if (std::find(joints.begin(), joints.end(), joint) == joints.end())
+          joints.push_back(joint);
+      }
+    }
+    return joints;
+  }
+}
@@ -36,24 +36,70 @@
 
 #include "play_motion/play_motion_server.h"
 
+#include <algorithm>
+
+#include <boost/algorithm/string/join.hpp>
 #include <boost/foreach.hpp>
 
+#include "play_motion/approach_planner.h"
+#include "play_motion/function_callback.h"
+#include "play_motion/motion_library.h"
+#include "play_motion/move_joint_group.h"
 #include "play_motion/play_motion.h"
-#include "play_motion/play_motion_helpers.h"
-#include "play_motion/xmlrpc_helpers.h"
 
 #include <diagnostic_msgs/DiagnosticArray.h>
 #include <diagnostic_updater/DiagnosticStatusWrapper.h>
 
 #define foreach BOOST_FOREACH
 
+namespace
+{
+  /// \return Identifier of the set of controllers used by a goal.
+  std::string controllerSetId(const play_motion::PlayMotion::GoalHandle& goal_hdl)
+  {
+    std::vector<std::string> names;
+    {
+      boost::mutex::scoped_lock lock(goal_hdl->mutex);
+      foreach (const boost::shared_ptr<play_motion::MoveJointGroup>& ctrl, goal_hdl->controllers)
+        names.push_back(ctrl->getName());
+    }
+    std::sort(names.begin(), names.end());
+
+    std::string id;
+    foreach (const std::string& name, names)
+      id += name + " ";
+    return id;
+  }
+
+  /// \return Name of the action server. Instances sharing the controllers of a robot need different names
+  std::string getActionName()
+  {
+    std::string name = "play_motion";
+    ros::NodeHandle("~").getParam("action_name", name);
+    return name;
+  }
+} // unnamed namespace
+
 namespace play_motion
 {
   PlayMotionServer::PlayMotionServer(const ros::NodeHandle& nh, const PlayMotionPtr& pm) :
     nh_(nh),
     pm_(pm),
-    al_server_(nh_, "play_motion", false)
+    al_server_(nh_, getActionName(), false)
   {
+    // Started before the action server, so that accepted goals always find them
+    int executor_threads = 4;
+    ros::NodeHandle("~").getParam("executor_threads", executor_threads);
+    for (int i = 0; i < std::max(executor_threads, 1); ++i)
+    {
+      PipelinePtr pipeline(new Pipeline);
+      pipeline->cb_queue.reset(new ros::CallbackQueue());
+      pipeline->spinner.reset(new ros::AsyncSpinner(1, pipeline->cb_queue.get()));
+      pipeline->spinner->start();
+      pipeline->pending = 0;
+      pipelines_.push_back(pipeline);
+    }
+
     al_server_.registerGoalCallback(boost::bind(&PlayMotionServer::alGoalCb, this, _1));
     al_server_.registerCancelCallback(boost::bind(&PlayMotionServer::alCancelCb, this, _1));
     al_server_.start();
@@ -61,14 +107,44 @@ namespace play_motion
     list_motions_srv_ = ros::NodeHandle("~").advertiseService("list_motions",
                                                               &PlayMotionServer::listMotions,
                                                               this);
+    is_already_there_srv_ = ros::NodeHandle("~").advertiseService("is_already_there",
+                                                                  &PlayMotionServer::isAlreadyThere,
+                                                                  this);
+    is_already_there_batch_srv_ = ros::NodeHandle("~").advertiseService("is_already_there_batch",
+                                                                        &PlayMotionServer::isAlreadyThereBatch,
+                                                                        this);
+
+    ros::NodeHandle reload_nh("~");
+    reload_cb_queue_.reset(new ros::CallbackQueue());
+    reload_nh.setCallbackQueue(reload_cb_queue_.get());
+    reload_spinner_.reset(new ros::AsyncSpinner(1, reload_cb_queue_.get()));
+    reload_spinner_->start();
+    reload_motions_srv_ = reload_nh.advertiseService("reload_motions", &PlayMotionServer::reloadMotions, this);
+
+    ros::NodeHandle prepare_nh("~");
+    prepare_cb_queue_.reset(new ros::CallbackQueue());
+    prepare_nh.setCallbackQueue(prepare_cb_queue_.get());
+    prepare_spinner_.reset(new ros::AsyncSpinner(1, prepare_cb_queue_.get()));
+    prepare_spinner_->start();
+    prepare_motion_srv_ = prepare_nh.advertiseService("prepare_motion", &PlayMotionServer::prepareMotion, this);
 
     diagnostic_pub_ = nh_.advertise<diagnostic_msgs::DiagnosticArray>("/diagnostics", 1);
     diagnostic_timer_ = nh_.createTimer(ros::Duration(1.0), &PlayMotionServer::publishDiagnostics,
                                         this);
+
+    // Controller feedback is aggregated per goal, and published at a lower rate
+    double feedback_rate = 10.0;
+    ros::NodeHandle("~").getParam("feedback/rate", feedback_rate);
+    if (feedback_rate > 0.0)
+      feedback_timer_ = nh_.createTimer(ros::Duration(1.0 / feedback_rate), &PlayMotionServer::publishFeedback, this);
   }
 
   PlayMotionServer::~PlayMotionServer()
-  {}
+  {
+    boost::mutex::scoped_lock lock(pipelines_mutex_);
+    foreach (const PipelinePtr& pipeline, pipelines_)
+      pipeline->spinner->stop();
+  }
 
   bool PlayMotionServer::findGoalId(AlServer::GoalHandle gh, PlayMotion::GoalHandle& goal_hdl)
   {
@@ -82,6 +158,19 @@ namespace play_motion
 
   void PlayMotionServer::playMotionCb(const PlayMotion::GoalHandle& goal_hdl)
   {
+    AlServer::GoalHandle gh;
+    {
+      boost::mutex::scoped_lock lock(al_goals_mutex_);
+      std::map<PlayMotion::GoalHandle, AlServer::GoalHandle>::iterator it = al_goals_.find(goal_hdl);
+      if (it == al_goals_.end())
+      {
+        ROS_DEBUG("Motion finished, but its goal is no longer tracked (was it canceled?).");
+        return;
+      }
+      gh = it->second;
+      al_goals_.erase(it);
+    }
+
     PMR r;
     r.error_code = goal_hdl->error_code;
     r.error_string = goal_hdl->error_string;
@@ -89,7 +178,12 @@ namespace play_motion
     if (r.error_code == PMR::SUCCEEDED)
     {
       ROS_INFO("Motion played successfully.");
-      al_goals_[goal_hdl].setSucceeded(r);
+      gh.setSucceeded(r);
+    }
+    else if (r.error_code == PMR::PREEMPTED)
+    {
+      ROS_INFO("Motion preempted by a higher priority goal.");
+      gh.setCanceled(r, r.error_string);
     }
     else
     {
@@ -97,87 +191,273 @@ namespace play_motion
         ROS_ERROR("Motion ended with INVALID ERROR code %d and description '%s'", r.error_code, r.error_string.c_str());
       else
         ROS_WARN("Motion ended with an error code %d and description '%s'", r.error_code, r.error_string.c_str());
-      al_goals_[goal_hdl].setAborted(r);
+      gh.setAborted(r);
     }
-    al_goals_.erase(goal_hdl);
   }
 
   void PlayMotionServer::alCancelCb(AlServer::GoalHandle gh)
   {
     PlayMotion::GoalHandle goal_hdl;
-    if (findGoalId(gh, goal_hdl))
+    bool found;
+    {
+      boost::mutex::scoped_lock lock(al_goals_mutex_);
+      found = findGoalId(gh, goal_hdl);
+      if (found)
+        al_goals_.erase(goal_hdl);
+    }
+
+    if (found)
       goal_hdl->cancel(); //should not be needed
     else
       ROS_ERROR("Cancel request could not be fulfilled. Goal not running?.");
 
-    al_goals_.erase(goal_hdl);
     gh.setCanceled();
   }
 
   void PlayMotionServer::alGoalCb(AlServer::GoalHandle gh)
   {
     AlServer::GoalConstPtr goal = gh.getGoal(); //XXX: can this fail? should we check it?
-    ROS_INFO_STREAM("Received request to play motion '" << goal->motion_name << "'.");
+    std::string motion_desc = "motion '" + goal->motion_name + "'";
+    if (!goal->sequence.empty())
+    {
+      motion_desc = "sequence of motions '";
+      for (std::size_t i = 0; i < goal->sequence.size(); ++i)
+        motion_desc += (i > 0 ? "', '" : "") + goal->sequence[i];
+      motion_desc += "'";
+    }
+    ROS_INFO_STREAM("Received request to play " << motion_desc << ".");
+
+    try
+    {
+      // Zero plays the motion at its nominal speed
+      if (goal->time_scaling != 0.0)
+        PlayMotion::checkSpeedFactor(goal->time_scaling, "Time scaling");
+    }
+    catch (const PMException& e)
+    {
+      PMR r;
+      r.error_code = e.error_code();
+      r.error_string = e.what();
+      ROS_ERROR_STREAM(r.error_string);
+      gh.setRejected(r);
+      return;
+    }
+
     PlayMotion::GoalHandle goal_hdl;
-    if (!pm_->run(goal->motion_name,
-                  goal->skip_planning,
-                  goal_hdl,
-                  boost::bind(&PlayMotionServer::playMotionCb, this, _1)))
+    const boost::function<void(const PlayMotion::GoalHandle&)> cb = boost::bind(&PlayMotionServer::playMotionCb,
+                                                                             this, _1);
+    bool accepted = false;
+    if (!goal->joints.empty())
+      accepted = pm_->acceptPartial(goal->motion_name, goal->sequence, goal->sequence_time_scaling, goal->joints,
+                                    goal->skip_planning, goal->priority, goal_hdl, cb);
+    else if (goal->sequence.empty())
+      accepted = pm_->accept(goal->motion_name, goal->skip_planning, goal->priority, goal_hdl, cb);
+    else
+      accepted = pm_->acceptSequence(goal->sequence, goal->sequence_time_scaling, goal->skip_planning,
+                                     goal->priority, goal_hdl, cb);
+    if (!accepted)
     {
       PMR r;
       r.error_code = goal_hdl->error_code;
       r.error_string = goal_hdl->error_string;
       if (!r.error_string.empty())
         ROS_ERROR_STREAM(r.error_string);
-      ROS_ERROR_STREAM("Motion '" << goal->motion_name << "' could not be played.");
+      ROS_ERROR_STREAM("The " << motion_desc << " could not be played.");
       gh.setRejected(r);
       return;
     }
+    goal_hdl->setEarlyCompletion(goal->completion_tolerance, goal->cancel_on_completion);
+    goal_hdl->setTimeScaling(goal->time_scaling);
+    goal_hdl->setStartTime(goal->start_time);
     gh.setAccepted();
-    al_goals_[goal_hdl] = gh;
+    {
+      boost::mutex::scoped_lock lock(al_goals_mutex_);
+      al_goals_[goal_hdl] = gh;
+    }
+
+    // Planning and dispatching happens in the executor threads
+    const std::string controller_set = controllerSetId(goal_hdl);
+    getPipeline(controller_set)->cb_queue->addCallback(ros::CallbackInterfacePtr(
+        new FunctionCallback(boost::bind(&PlayMotionServer::executeGoal, this, goal_hdl, controller_set))));
+  }
+
+  PlayMotionServer::PipelinePtr PlayMotionServer::getPipeline(const std::string& controller_set)
+  {
+    boost::mutex::scoped_lock lock(pipelines_mutex_);
+    ControllerSet& set = controller_sets_[controller_set];
+    if (!set.pipeline)
+    {
+      set.pending = 0;
+      set.pipeline = pipelines_.front();
+      foreach (const PipelinePtr& pipeline, pipelines_)
+      {
+        if (pipeline->pending < set.pipeline->pending)
+          set.pipeline = pipeline;
+      }
+      ROS_DEBUG_STREAM("Executing goals for controllers " << controller_set << "on a pipeline with "
+                       << set.pipeline->pending << " pending goals.");
+    }
+    ++set.pending;
+    ++set.pipeline->pending;
+    return set.pipeline;
+  }
+
+  void PlayMotionServer::executeGoal(const PlayMotion::GoalHandle& goal_hdl, const std::string& controller_set)
+  {
+    pm_->execute(goal_hdl);
+
+    // Sets without pending goals are reassigned on their next goal
+    boost::mutex::scoped_lock lock(pipelines_mutex_);
+    std::map<std::string, ControllerSet>::iterator it = controller_sets_.find(controller_set);
+    --it->second.pipeline->pending;
+    if (--it->second.pending == 0)
+      controller_sets_.erase(it);
   }
 
   bool PlayMotionServer::listMotions(play_motion_msgs::ListMotions::Request&  req,
                                      play_motion_msgs::ListMotions::Response& resp)
+  {
+    std::vector<MotionLibrary::MotionSummary> motions;
+    pm_->getMotionLibrary()->getMotionSummaries(req.name_prefix, req.joints, motions);
+
+    resp.motions.resize(motions.size());
+    for (std::size_t i = 0; i < motions.size(); ++i)
+    {
+      resp.motions[i].name     = motions[i].id;
+      resp.motions[i].joints   = motions[i].joints;
+      resp.motions[i].duration = motions[i].duration;
+    }
+    return true;
+  }
+
+  bool PlayMotionServer::isAlreadyThere(play_motion_msgs::IsAlreadyThere::Request&  req,
+                                        play_motion_msgs::IsAlreadyThere::Response& resp)
+  {
+    resp.already_there = pm_->isAlreadyThere(req.motion_name, req.tolerance);
+    return true;
+  }
+
+  bool PlayMotionServer::isAlreadyThereBatch(play_motion_msgs::IsAlreadyThereBatch::Request&  req,
+                                             play_motion_msgs::IsAlreadyThereBatch::Response& resp)
+  {
+    pm_->getStartDeviations(req.motion_names, resp.max_deviation);
+    resp.already_there.resize(resp.max_deviation.size());
+    for (std::size_t i = 0; i < resp.max_deviation.size(); ++i)
+      resp.already_there[i] = resp.max_deviation[i] <= req.tolerance;
+    return true;
+  }
+
+  bool PlayMotionServer::reloadMotions(play_motion_msgs::ReloadMotions::Request&  req,
+                                       play_motion_msgs::ReloadMotions::Response& resp)
+  {
+    MotionLibrary::ReloadReport report;
+    resp.success = pm_->getMotionLibrary()->reload(report);
+    resp.added   = report.added;
+    resp.changed = report.changed;
+    resp.removed = report.removed;
+
+    std::ostringstream msg;
+    if (resp.success)
+      msg << report.added.size() << " motions added, " << report.changed.size() << " changed, "
+          << report.removed.size() << " removed.";
+    else
+      msg << "Could not fetch motions from the parameter server.";
+    resp.message = msg.str();
+    return true;
+  }
+
+  bool PlayMotionServer::prepareMotion(play_motion_msgs::PrepareMotion::Request&  req,
+                                       play_motion_msgs::PrepareMotion::Response& resp)
   {
     try
     {
-      MotionNames motions;
-      ros::NodeHandle pnh("~");
-      getMotionIds(pnh, motions);
-      foreach (const std::string& motion, motions)
-      {
-        play_motion_msgs::MotionInfo info;
-        info.name = motion;
-        getMotionJoints(pnh, motion, info.joints);
-        getMotionDuration(pnh, motion);
-        resp.motions.push_back(info);
-      }
+      pm_->prepare(req.motion_name);
+      resp.success = true;
+      resp.message = "Approach of motion '" + req.motion_name + "' prepared.";
     }
-    catch (const xh::XmlrpcHelperException& e)
+    catch (const PMException& e)
     {
-      ROS_ERROR_STREAM(e.what());
-      return false;
+      resp.success = false;
+      resp.message = e.what();
+      ROS_WARN_STREAM("Could not prepare motion '" << req.motion_name << "': " << e.what());
     }
     return true;
   }
 
+  void PlayMotionServer::publishFeedback(const ros::TimerEvent &)
+  {
+    std::map<PlayMotion::GoalHandle, AlServer::GoalHandle> goals;
+    {
+      boost::mutex::scoped_lock lock(al_goals_mutex_);
+      goals = al_goals_;
+    }
+
+    typedef std::pair<const PlayMotion::GoalHandle, AlServer::GoalHandle> goal_pair_t;
+    foreach (goal_pair_t& p, goals)
+    {
+      PlayMotion::Progress progress;
+      if (!pm_->getProgress(p.first, progress))
+        continue;
+      play_motion_msgs::PlayMotionFeedback feedback;
+      feedback.progress = progress.progress;
+      feedback.time_remaining = progress.time_remaining.toSec();
+      feedback.max_tracking_error = progress.max_tracking_error;
+      p.second.publishFeedback(feedback);
+    }
+  }
+
   void PlayMotionServer::publishDiagnostics(const ros::TimerEvent &) const
   {
   diagnostic_msgs::DiagnosticArray array;
   diagnostic_updater::DiagnosticStatusWrapper status;
   status.name = "Functionality: Play Motion";
-  for (std::map<PlayMotion::GoalHandle, AlServer::GoalHandle>::const_iterator it = al_goals_.begin();
-       it != al_goals_.end(); ++it)
+  // The goals lock is released before querying pm_, whose locks are held by controller updates aborting goals
+  std::vector<std::string> motion_names;
   {
-    const AlServer::GoalHandle &hdl = it->second;
-    status.add("Executing motion", hdl.getGoal()->motion_name);
+    boost::mutex::scoped_lock lock(al_goals_mutex_);
+    for (std::map<PlayMotion::GoalHandle, AlServer::GoalHandle>::const_iterator it = al_goals_.begin();
+         it != al_goals_.end(); ++it)
+    {
+      const AlServer::GoalConstPtr goal = it->second.getGoal();
+      // Sequence goals have no motion name of their own
+      motion_names.push_back(goal->sequence.empty() ? goal->motion_name
+                                                    : boost::algorithm::join(goal->sequence, ", "));
+    }
   }
-  if (al_goals_.empty())
+  foreach (const std::string& motion_name, motion_names)
+    status.add("Executing motion", motion_name);
+  if (motion_names.empty())
     status.mergeSummary(diagnostic_msgs::DiagnosticStatus::OK, "Not executing any motion");
   else
     status.mergeSummary(diagnostic_msgs::DiagnosticStatus::OK, "Executing motions");
 
+  const ApproachPlanCache::Stats cache_stats = pm_->getApproachPlanner()->getPlanCacheStats();
+  status.add("Approach plan cache hits", cache_stats.hits);
+  status.add("Approach plan cache misses", cache_stats.misses);
+  status.add("Approach plan cache rejected plans", cache_stats.rejected);
+  status.add("Approach plan cache size", cache_stats.size);
+  const unsigned long lookups = cache_stats.hits + cache_stats.misses;
+  if (lookups > 0)
+    status.addf("Approach plan cache hit rate", "%.1f %%", 100.0 * cache_stats.hits / lookups);
+  status.add("Controller reconnects", pm_->getControllerReconnects());
+
+  // Time from goal request until its trajectories are sent, over the latest goals
+  std::vector<LatencyStats::Percentiles> stages;
+  LatencyStats::Percentiles total;
+  const LatencyStats& latency_stats = pm_->getLatencyStats();
+  status.add("Goals sent", latency_stats.getCount());
+  if (latency_stats.getPercentiles(stages, total))
+  {
+    for (int stage = 0; stage < LatencyStats::NUM_STAGES; ++stage)
+    {
+      const LatencyStats::Percentiles& p = stages[stage];
+      status.addf(std::string("Latency ") + LatencyStats::getStageName(static_cast<LatencyStats::Stage>(stage)),
+                  "p50 %.1f ms, p95 %.1f ms, p99 %.1f ms", 1e3 * p.p50, 1e3 * p.p95, 1e3 * p.p99);
+    }
+    status.addf("Latency total", "p50 %.1f ms, p95 %.1f ms, p99 %.1f ms",
+                1e3 * total.p50, 1e3 * total.p95, 1e3 * total.p99);
+  }
+
   array.status.push_back(status);
   diagnostic_pub_.publish(array);
   }
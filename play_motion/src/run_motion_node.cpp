@@ -88,7 +88,7 @@ int main(int argc, char** argv)
 
   goal.motion_name = argv[1];
   goal.skip_planning = false;
-  goal.priority = 0;
+  goal.priority = 0; // Preempts nothing, can be preempted by any goal of higher priority
 
   ROS_INFO_STREAM("Sending goal with motion: " << argv[1]);
   client.sendGoal(goal);
@@ -0,0 +1,110 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2013, PAL Robotics S.L.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//   * Neither the name of PAL Robotics S.L. nor the names of its
+//     contributors may be used to endorse or promote products derived from
+//     this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//////////////////////////////////////////////////////////////////////////////
+
+#include <gtest/gtest.h>
+
+#include "play_motion/approach_plan_cache.h"
+
+using play_motion::ApproachPlanCache;
+
+namespace
+{
+  trajectory_msgs::JointTrajectory makePlan(double value)
+  {
+    trajectory_msgs::JointTrajectory traj;
+    traj.joint_names.push_back("joint1");
+    traj.points.resize(1);
+    traj.points[0].positions.push_back(value);
+    return traj;
+  }
+}
+
+TEST(ApproachPlanCacheTest, quantisedLookup)
+{
+  ApproachPlanCache cache(4, 0.1);
+  const std::vector<double> start(2, 0.0);
+  const std::vector<double> goal(2, 1.0);
+  trajectory_msgs::JointTrajectory traj;
+
+  EXPECT_FALSE(cache.get("group", start, goal, traj));
+  cache.put("group", start, goal, makePlan(1.0));
+
+  // Start states within the resolution map to the same plan...
+  EXPECT_TRUE(cache.get("group", std::vector<double>(2, 0.04), goal, traj));
+  EXPECT_EQ(1.0, traj.points[0].positions[0]);
+
+  // ...but not farther ones, nor other groups or goals
+  EXPECT_FALSE(cache.get("group", std::vector<double>(2, 0.06), goal, traj));
+  EXPECT_FALSE(cache.get("other_group", start, goal, traj));
+  EXPECT_FALSE(cache.get("group", start, std::vector<double>(2, 2.0), traj));
+
+  const ApproachPlanCache::Stats stats = cache.getStats();
+  EXPECT_EQ(1u, stats.hits);
+  EXPECT_EQ(4u, stats.misses);
+  EXPECT_EQ(1u, stats.size);
+}
+
+TEST(ApproachPlanCacheTest, leastRecentlyUsedEviction)
+{
+  ApproachPlanCache cache(2, 0.1);
+  const std::vector<double> goal(1, 1.0);
+  trajectory_msgs::JointTrajectory traj;
+
+  cache.put("group", std::vector<double>(1, 0.0), goal, makePlan(0.0));
+  cache.put("group", std::vector<double>(1, 0.5), goal, makePlan(0.5));
+  EXPECT_TRUE(cache.get("group", std::vector<double>(1, 0.0), goal, traj)); // Now the most recently used
+
+  cache.put("group", std::vector<double>(1, 0.9), goal, makePlan(0.9));
+  EXPECT_TRUE(cache.get("group", std::vector<double>(1, 0.0), goal, traj));
+  EXPECT_FALSE(cache.get("group", std::vector<double>(1, 0.5), goal, traj));
+  EXPECT_TRUE(cache.get("group", std::vector<double>(1, 0.9), goal, traj));
+  EXPECT_EQ(2u, cache.getStats().size);
+}
+
+TEST(ApproachPlanCacheTest, rejectAndDisable)
+{
+  ApproachPlanCache cache(2, 0.1);
+  const std::vector<double> start(1, 0.0);
+  const std::vector<double> goal(1, 1.0);
+  trajectory_msgs::JointTrajectory traj;
+
+  cache.put("group", start, goal, makePlan(1.0));
+  cache.reject("group", start, goal);
+  EXPECT_FALSE(cache.get("group", start, goal, traj));
+  EXPECT_EQ(1u, cache.getStats().rejected);
+
+  ApproachPlanCache disabled(0, 0.1);
+  disabled.put("group", start, goal, makePlan(1.0));
+  EXPECT_FALSE(disabled.get("group", start, goal, traj));
+  EXPECT_EQ(0u, disabled.getStats().size);
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,190 @@
+/*
+ * Software License Agreement (Modified BSD License)
+ *
+ *  Copyright (c) 2013, PAL Robotics, S.L.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of PAL Robotics, S.L. nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cmath>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "play_motion/joint_limits.h"
+
+using namespace play_motion;
+
+namespace
+{
+  JointLimits makeLimits(double max_velocity, double max_acceleration)
+  {
+    JointLimits limits;
+    limits.has_velocity_limits = max_velocity > 0.0;
+    limits.max_velocity = max_velocity;
+    limits.has_acceleration_limits = max_acceleration > 0.0;
+    limits.max_acceleration = max_acceleration;
+    return limits;
+  }
+
+  TrajPoint makePoint(double position, double time)
+  {
+    TrajPoint point;
+    point.positions.push_back(position);
+    point.time_from_start = ros::Duration(time);
+    return point;
+  }
+}
+
+TEST(JointLimitsTest, trapezoidalApproach)
+{
+  const std::vector<double> start(1, 0.0);
+  const std::vector<double> goal(1, 2.0);
+  const std::vector<JointLimits> limits(1, makeLimits(1.0, 1.0));
+  std::vector<TrajPoint> points;
+
+  // Accelerate for 1s up to the max velocity, cruise for 1s and decelerate for 1s
+  EXPECT_NEAR(3.0, getMinTimeApproach(start, goal, limits, 0.0, points), 1e-9);
+  ASSERT_EQ(2u, points.size());
+  EXPECT_NEAR(1.0, points[0].time_from_start.toSec(), 1e-9);
+  EXPECT_NEAR(0.5, points[0].positions[0], 1e-9);
+  EXPECT_NEAR(1.0, points[0].velocities[0], 1e-9);
+  EXPECT_NEAR(2.0, points[1].time_from_start.toSec(), 1e-9);
+  EXPECT_NEAR(1.5, points[1].positions[0], 1e-9);
+  EXPECT_NEAR(1.0, points[1].velocities[0], 1e-9);
+}
+
+TEST(JointLimitsTest, triangularApproach)
+{
+  const std::vector<double> start(1, 0.0);
+  const std::vector<double> goal(1, 0.5);
+  const std::vector<JointLimits> limits(1, makeLimits(1.0, 1.0));
+  std::vector<TrajPoint> points;
+
+  // The velocity limit is never reached
+  EXPECT_NEAR(2.0 * std::sqrt(0.5), getMinTimeApproach(start, goal, limits, 0.0, points), 1e-9);
+  ASSERT_EQ(1u, points.size());
+  EXPECT_NEAR(0.25, points[0].positions[0], 1e-9);
+  EXPECT_GT(1.0, points[0].velocities[0]);
+}
+
+TEST(JointLimitsTest, synchronizedJoints)
+{
+  std::vector<double> start(2, 0.0);
+  std::vector<double> goal(2, 2.0);
+  std::vector<JointLimits> limits;
+  limits.push_back(makeLimits(1.0, 1.0));   // Slow joint
+  limits.push_back(makeLimits(10.0, 10.0)); // Fast joint
+  goal[1] = 1.0;
+  std::vector<TrajPoint> points;
+
+  // The slow joint dictates the duration, the fast one moves at half its speed
+  EXPECT_NEAR(3.0, getMinTimeApproach(start, goal, limits, 0.0, points), 1e-9);
+  ASSERT_EQ(2u, points.size());
+  EXPECT_NEAR(1.0, points[0].velocities[0], 1e-9);
+  EXPECT_NEAR(0.5, points[0].velocities[1], 1e-9);
+}
+
+TEST(JointLimitsTest, velocityLimitsOnly)
+{
+  const std::vector<double> start(1, 0.0);
+  const std::vector<double> goal(1, 2.0);
+  const std::vector<JointLimits> limits(1, makeLimits(1.0, 0.0));
+  std::vector<TrajPoint> points;
+
+  // Single cubic segment, peaking at the velocity limit
+  EXPECT_NEAR(3.0, getMinTimeApproach(start, goal, limits, 0.0, points), 1e-9);
+  EXPECT_TRUE(points.empty());
+
+  // No limits, no motion
+  EXPECT_EQ(0.0, getMinTimeApproach(start, goal, std::vector<JointLimits>(1), 0.0, points));
+  EXPECT_EQ(0.0, getMinTimeApproach(start, start, limits, 0.0, points));
+}
+
+TEST(JointLimitsTest, minDuration)
+{
+  const std::vector<double> start(1, 0.0);
+  const std::vector<double> goal(1, 2.0);
+  const std::vector<JointLimits> limits(1, makeLimits(1.0, 1.0));
+  std::vector<TrajPoint> points;
+
+  // The profile is stretched to last twice as long
+  EXPECT_NEAR(6.0, getMinTimeApproach(start, goal, limits, 6.0, points), 1e-9);
+  ASSERT_EQ(2u, points.size());
+  EXPECT_NEAR(2.0, points[0].time_from_start.toSec(), 1e-9);
+  EXPECT_NEAR(0.5, points[0].positions[0], 1e-9);
+  EXPECT_NEAR(0.5, points[0].velocities[0], 1e-9);
+  EXPECT_NEAR(4.0, points[1].time_from_start.toSec(), 1e-9);
+}
+
+TEST(JointLimitsTest, enforceVelocityLimits)
+{
+  Trajectory traj;
+  traj.push_back(makePoint(0.0, 0.0));
+  traj.push_back(makePoint(1.0, 1.0));  // Within limits
+  traj.push_back(makePoint(3.0, 1.5));  // Too fast, needs 2s
+  traj.push_back(makePoint(3.5, 2.0));
+  traj[3].velocities.push_back(5.0);
+
+  enforceVelocityLimits(std::vector<JointLimits>(1, makeLimits(1.0, 0.0)), traj);
+  EXPECT_NEAR(0.0, traj[0].time_from_start.toSec(), 1e-9);
+  EXPECT_NEAR(1.0, traj[1].time_from_start.toSec(), 1e-9);
+  EXPECT_NEAR(3.0, traj[2].time_from_start.toSec(), 1e-9);
+  EXPECT_NEAR(3.5, traj[3].time_from_start.toSec(), 1e-9); // Delayed, but keeps its segment duration
+  EXPECT_NEAR(1.0, traj[3].velocities[0], 1e-9);
+}
+
+TEST(JointLimitsTest, scaleTrajectory)
+{
+  Trajectory traj;
+  traj.push_back(makePoint(0.0, 0.0));
+  traj.push_back(makePoint(1.0, 1.0));
+  traj[1].velocities.push_back(2.0);
+  traj[1].accelerations.push_back(4.0);
+
+  scaleTrajectory(2.0, traj);
+  EXPECT_NEAR(0.0, traj[0].time_from_start.toSec(), 1e-9);
+  EXPECT_NEAR(2.0, traj[1].time_from_start.toSec(), 1e-9);
+  EXPECT_NEAR(1.0, traj[1].positions[0], 1e-9);
+  EXPECT_NEAR(1.0, traj[1].velocities[0], 1e-9);
+  EXPECT_NEAR(1.0, traj[1].accelerations[0], 1e-9);
+
+  // Faster playback can make segments exceed the velocity limits
+  scaleTrajectory(0.25, traj);
+  EXPECT_NEAR(0.5, traj[1].time_from_start.toSec(), 1e-9);
+  enforceVelocityLimits(std::vector<JointLimits>(1, makeLimits(1.0, 0.0)), traj);
+  EXPECT_NEAR(1.0, traj[1].time_from_start.toSec(), 1e-9);
+  EXPECT_NEAR(1.0, traj[1].velocities[0], 1e-9);
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,178 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2013, PAL Robotics S.L.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//   * Neither the name of PAL Robotics S.L. nor the names of its
+//     contributors may be used to endorse or promote products derived from
+//     this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//////////////////////////////////////////////////////////////////////////////
+
+#include <cmath>
+#include <gtest/gtest.h>
+
+#include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
+#include <sensor_msgs/JointState.h>
+
+#include "play_motion/joint_state_buffer.h"
+
+using play_motion::JointNames;
+using play_motion::JointStateBuffer;
+
+namespace
+{
+  sensor_msgs::JointState makeState(const JointNames& names, double value)
+  {
+    sensor_msgs::JointState msg;
+    msg.name = names;
+    msg.position.assign(names.size(), value);
+    msg.velocity.assign(names.size(), -value);
+    return msg;
+  }
+
+  void writeStates(JointStateBuffer& buffer, const JointNames& names, int updates)
+  {
+    for (int i = 1; i <= updates; ++i)
+      buffer.update(makeState(names, i));
+  }
+}
+
+TEST(JointStateBufferTest, readSelection)
+{
+  JointStateBuffer buffer;
+  JointNames names;
+  names.push_back("joint1");
+  names.push_back("joint2");
+  names.push_back("joint3");
+
+  JointNames selected_names;
+  selected_names.push_back("joint3");
+  selected_names.push_back("joint1");
+  JointStateBuffer::Selection selection(selected_names);
+
+  std::vector<double> pos, vel;
+  EXPECT_FALSE(buffer.read(selection, pos)); // Nothing received yet
+
+  sensor_msgs::JointState msg = makeState(names, 0.0);
+  msg.position[0] = 1.0;
+  msg.position[2] = 3.0;
+  buffer.update(msg);
+  ASSERT_TRUE(buffer.read(selection, pos, vel));
+  ASSERT_EQ(2u, pos.size());
+  EXPECT_EQ(3.0, pos[0]);
+  EXPECT_EQ(1.0, pos[1]);
+
+  // Messages without velocities
+  msg.velocity.clear();
+  buffer.update(msg);
+  ASSERT_TRUE(buffer.read(selection, pos, vel));
+  ASSERT_EQ(2u, vel.size());
+  EXPECT_EQ(0.0, vel[0]);
+  EXPECT_EQ(0.0, vel[1]);
+
+  // Malformed messages are ignored
+  msg.position.pop_back();
+  buffer.update(msg);
+  ASSERT_TRUE(buffer.read(selection, pos));
+  EXPECT_EQ(3.0, pos[0]);
+}
+
+TEST(JointStateBufferTest, layoutChange)
+{
+  JointStateBuffer buffer;
+  JointNames names;
+  names.push_back("joint1");
+  names.push_back("joint2");
+  buffer.update(makeState(names, 1.0));
+
+  JointStateBuffer::Selection selection(JointNames(1, "joint2"));
+  std::vector<double> pos;
+  ASSERT_TRUE(buffer.read(selection, pos));
+  EXPECT_EQ(1.0, pos[0]);
+
+  // Same joints, different order
+  std::swap(names[0], names[1]);
+  sensor_msgs::JointState msg = makeState(names, 0.0);
+  msg.position[0] = 2.0;
+  buffer.update(msg);
+  ASSERT_TRUE(buffer.read(selection, pos));
+  EXPECT_EQ(2.0, pos[0]);
+
+  // Selected joint no longer present
+  buffer.update(makeState(JointNames(1, "joint1"), 3.0));
+  EXPECT_FALSE(buffer.read(selection, pos));
+}
+
+TEST(JointStateBufferTest, readAvailable)
+{
+  JointStateBuffer buffer;
+  JointNames selected_names;
+  selected_names.push_back("joint2");
+  selected_names.push_back("joint1");
+  JointStateBuffer::Selection selection(selected_names);
+
+  std::vector<double> pos;
+  buffer.readAvailable(selection, pos); // Nothing received yet
+  ASSERT_EQ(2u, pos.size());
+  EXPECT_TRUE(std::isnan(pos[0]));
+  EXPECT_TRUE(std::isnan(pos[1]));
+
+  buffer.update(makeState(JointNames(1, "joint1"), 1.0));
+  buffer.readAvailable(selection, pos);
+  ASSERT_EQ(2u, pos.size());
+  EXPECT_TRUE(std::isnan(pos[0]));
+  EXPECT_EQ(1.0, pos[1]);
+}
+
+TEST(JointStateBufferTest, consistentSnapshots)
+{
+  JointStateBuffer buffer;
+  JointNames names;
+  for (int i = 0; i < 40; ++i)
+    names.push_back("joint" + boost::lexical_cast<std::string>(i));
+  buffer.update(makeState(names, 0.0));
+
+  const int updates = 100000;
+  boost::thread writer(boost::bind(writeStates, boost::ref(buffer), names, updates));
+
+  // All values read at once must come from the same message
+  JointStateBuffer::Selection selection(names);
+  std::vector<double> pos, vel;
+  double last = 0.0;
+  while (last < updates)
+  {
+    ASSERT_TRUE(buffer.read(selection, pos, vel));
+    for (std::size_t i = 0; i < names.size(); ++i)
+    {
+      ASSERT_EQ(pos[0], pos[i]);
+      ASSERT_EQ(-pos[0], vel[i]);
+    }
+    ASSERT_GE(pos[0], last);
+    last = pos[0];
+  }
+  writer.join();
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
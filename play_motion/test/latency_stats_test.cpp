@@ -0,0 +1,94 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2013, PAL Robotics S.L.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//   * Neither the name of PAL Robotics S.L. nor the names of its
+//     contributors may be used to endorse or promote products derived from
+//     this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//////////////////////////////////////////////////////////////////////////////
+
+#include <gtest/gtest.h>
+
+#include "play_motion/latency_stats.h"
+
+using play_motion::LatencyStats;
+
+namespace
+{
+  LatencyStats::Timing makeTiming(double planning_time)
+  {
+    LatencyStats::Timing timing;
+    timing.durations[LatencyStats::MOTION_FETCH] = 0.001;
+    timing.durations[LatencyStats::APPROACH_PLANNING] = planning_time;
+    return timing;
+  }
+}
+
+TEST(LatencyStatsTest, percentiles)
+{
+  LatencyStats stats(100);
+  std::vector<LatencyStats::Percentiles> stages;
+  LatencyStats::Percentiles total;
+  EXPECT_FALSE(stats.getPercentiles(stages, total));
+
+  // Planning takes 1..100 ms, in no particular order
+  for (int i = 0; i < 100; ++i)
+    stats.add(makeTiming(((i * 37) % 100 + 1) * 0.001));
+  EXPECT_EQ(100u, stats.getCount());
+
+  ASSERT_TRUE(stats.getPercentiles(stages, total));
+  ASSERT_EQ(static_cast<std::size_t>(LatencyStats::NUM_STAGES), stages.size());
+  EXPECT_NEAR(0.050, stages[LatencyStats::APPROACH_PLANNING].p50, 1e-9);
+  EXPECT_NEAR(0.095, stages[LatencyStats::APPROACH_PLANNING].p95, 1e-9);
+  EXPECT_NEAR(0.099, stages[LatencyStats::APPROACH_PLANNING].p99, 1e-9);
+  EXPECT_NEAR(0.001, stages[LatencyStats::MOTION_FETCH].p99, 1e-9);
+  EXPECT_EQ(0.0, stages[LatencyStats::GOAL_SEND].p99);
+  EXPECT_NEAR(0.051, total.p50, 1e-9);
+}
+
+TEST(LatencyStatsTest, rollingWindow)
+{
+  LatencyStats stats(10);
+  for (int i = 0; i < 10; ++i)
+    stats.add(makeTiming(1.0));
+
+  // Only the latest goals count
+  for (int i = 0; i < 10; ++i)
+    stats.add(makeTiming(0.01));
+  EXPECT_EQ(20u, stats.getCount());
+
+  std::vector<LatencyStats::Percentiles> stages;
+  LatencyStats::Percentiles total;
+  ASSERT_TRUE(stats.getPercentiles(stages, total));
+  EXPECT_NEAR(0.01, stages[LatencyStats::APPROACH_PLANNING].p99, 1e-9);
+}
+
+TEST(LatencyStatsTest, stageNames)
+{
+  for (int stage = 0; stage < LatencyStats::NUM_STAGES; ++stage)
+    EXPECT_NE(std::string("unknown"), LatencyStats::getStageName(static_cast<LatencyStats::Stage>(stage)));
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
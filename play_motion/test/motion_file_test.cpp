@@ -0,0 +1,178 @@
+/*
+ * Software License Agreement (Modified BSD License)
+ *
+ *  Copyright (c) 2013, PAL Robotics, S.L.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of PAL Robotics, S.L. nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <limits>
+#include <string>
+
+#include <unistd.h>
+
+#include <boost/cstdint.hpp>
+#include <gtest/gtest.h>
+#include <ros/ros.h>
+
+#include "play_motion/motion_file.h"
+
+using namespace play_motion;
+
+namespace
+{
+  class Writer
+  {
+  public:
+    template <class T>
+    void write(T value) {data_.append(reinterpret_cast<const char*>(&value), sizeof(T));}
+
+    void writeString(const std::string& s)
+    {
+      write<boost::uint32_t>(s.size());
+      data_.append(s);
+    }
+
+    void pad() {data_.resize((data_.size() + 7) / 8 * 8, '\0');}
+    std::size_t size() const {return data_.size();}
+
+    void save(const std::string& path) const
+    {
+      std::ofstream f(path.c_str(), std::ios::binary);
+      f.write(data_.data(), data_.size());
+    }
+
+  private:
+    std::string data_;
+  };
+
+  /// Ways of corrupting the file written by writeFile().
+  enum Corruption
+  {
+    NONE,
+    TRUNCATED,        ///< Last waypoint value missing
+    HUGE_JOINT_COUNT, ///< More joints than fit in the file
+    HUGE_POINT_COUNT, ///< Waypoints block size overflowing
+    NAN_DURATION,
+    NAN_TIME          ///< Time from start of a waypoint
+  };
+
+  /// Motion with two joints and two waypoints, only the second one with velocities.
+  std::string writeFile(Corruption corruption = NONE)
+  {
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+
+    Writer w;
+    w.write('P'); w.write('M'); w.write('L'); w.write('I'); w.write('B'); w.write('0'); w.write('0'); w.write('1');
+    w.write<boost::uint32_t>(1);
+    w.write<boost::uint32_t>(0);
+    w.writeString("wave");
+    w.writeString("Wave");
+    w.writeString("greetings");
+    w.writeString("");
+    w.write<boost::uint32_t>(corruption == HUGE_JOINT_COUNT ? 0xffffffff : 2);
+    w.writeString("joint1");
+    w.writeString("joint2");
+    w.write<boost::uint32_t>(corruption == HUGE_POINT_COUNT ? 0xffffffff : 2);
+    w.write<boost::uint32_t>(MotionFile::HAS_VELOCITIES);
+    w.write(corruption == NAN_DURATION ? nan : 1.5);
+    const std::size_t offset = (w.size() + sizeof(boost::uint64_t) + 7) / 8 * 8;
+    w.write<boost::uint64_t>(offset);
+    w.pad();
+
+    const double values[] = {0.0, 1.0, 2.0, nan, nan,
+                             corruption == NAN_TIME ? nan : 1.5, 3.0, 4.0, 0.1, 0.2};
+    const std::size_t num_values = sizeof(values) / sizeof(values[0]) - (corruption == TRUNCATED ? 1 : 0);
+    for (std::size_t i = 0; i < num_values; ++i)
+      w.write(values[i]);
+
+    char path[] = "/tmp/motion_file_testXXXXXX";
+    ::close(::mkstemp(path));
+    w.save(path);
+    return path;
+  }
+}
+
+TEST(MotionFileTest, readMotion)
+{
+  const std::string path = writeFile();
+  const MotionFile file(path);
+  std::remove(path.c_str()); // The mapping stays valid
+
+  ASSERT_EQ(1u, file.getRecords().size());
+  const MotionFile::Record& record = file.getRecords().front();
+  EXPECT_EQ("wave", record.id);
+  EXPECT_EQ("greetings", record.usage);
+  ASSERT_EQ(2u, record.joints.size());
+  EXPECT_EQ("joint2", record.joints[1]);
+  EXPECT_EQ(2u, record.num_points);
+  EXPECT_EQ(1.5, record.duration.toSec());
+
+  MotionInfo motion;
+  file.getMotion(0, motion);
+  EXPECT_EQ("Wave", motion.name);
+  EXPECT_EQ(record.joints, motion.joints);
+  ASSERT_EQ(2u, motion.traj.size());
+  EXPECT_EQ(2.0, motion.traj[0].positions[1]);
+  EXPECT_TRUE(motion.traj[0].velocities.empty());
+  EXPECT_TRUE(motion.traj[0].accelerations.empty());
+  EXPECT_EQ(1.5, motion.traj[1].time_from_start.toSec());
+  ASSERT_EQ(2u, motion.traj[1].velocities.size());
+  EXPECT_EQ(0.2, motion.traj[1].velocities[1]);
+}
+
+TEST(MotionFileTest, invalidFiles)
+{
+  EXPECT_THROW(MotionFile("/nonexistent/motions.pmlib"), ros::Exception);
+
+  const Corruption corruptions[] = {TRUNCATED, HUGE_JOINT_COUNT, HUGE_POINT_COUNT, NAN_DURATION};
+  for (std::size_t i = 0; i < sizeof(corruptions) / sizeof(corruptions[0]); ++i)
+  {
+    const std::string path = writeFile(corruptions[i]);
+    EXPECT_THROW(MotionFile file(path), ros::Exception);
+    std::remove(path.c_str());
+  }
+
+  // Waypoints are only read on request
+  const std::string path = writeFile(NAN_TIME);
+  const MotionFile file(path);
+  std::remove(path.c_str());
+  MotionInfo motion;
+  EXPECT_THROW(file.getMotion(0, motion), ros::Exception);
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
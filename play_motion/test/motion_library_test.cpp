@@ -0,0 +1,101 @@
+/*
+ * Software License Agreement (Modified BSD License)
+ *
+ *  Copyright (c) 2013, PAL Robotics, S.L.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of PAL Robotics, S.L. nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <XmlRpcValue.h>
+
+#include "play_motion/motion_library.h"
+#include "play_motion/play_motion.h"
+
+using namespace play_motion;
+
+namespace
+{
+  /// Single joint motion, with a waypoint at each of the given times.
+  XmlRpc::XmlRpcValue makeMotionParam(const std::vector<double>& times)
+  {
+    XmlRpc::XmlRpcValue param;
+    param["joints"].setSize(1);
+    param["joints"][0] = std::string("joint1");
+    XmlRpc::XmlRpcValue& points = param["points"];
+    points.setSize(times.size());
+    for (std::size_t i = 0; i < times.size(); ++i)
+    {
+      points[i]["time_from_start"] = times[i];
+      points[i]["positions"].setSize(1);
+      points[i]["positions"][0] = 0.1 * i;
+    }
+    return param;
+  }
+}
+
+TEST(MotionLibraryTest, rejectDuplicatedTimes)
+{
+  std::vector<double> times;
+  times.push_back(0.0);
+  times.push_back(1.0);
+  XmlRpc::XmlRpcValue motions;
+  motions["valid"] = makeMotionParam(times);
+  times.push_back(1.0);
+  motions["duplicated_time"] = makeMotionParam(times);
+
+  MotionLibrary library;
+  MotionLibrary::ReloadReport report;
+  library.update(motions, report);
+
+  // Motions that could never be sent to the controllers are not listed, and fail on request
+  MotionNames motion_ids;
+  library.getMotionIds(motion_ids);
+  ASSERT_EQ(1u, motion_ids.size());
+  EXPECT_EQ("valid", motion_ids[0]);
+  EXPECT_NO_THROW(library.getMotion("valid"));
+  try
+  {
+    library.getMotion("duplicated_time");
+    ADD_FAILURE() << "Motion with duplicated waypoint times was loaded";
+  }
+  catch (const PMException& e)
+  {
+    EXPECT_EQ(PMR::OTHER_ERROR, e.error_code());
+  }
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,158 @@
+/*
+ * Software License Agreement (Modified BSD License)
+ *
+ *  Copyright (c) 2013, PAL Robotics, S.L.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of PAL Robotics, S.L. nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "play_motion/packed_trajectory.h"
+
+using namespace play_motion;
+
+namespace
+{
+  Trajectory makeTrajectory()
+  {
+    Trajectory traj(2);
+    traj[0].positions.push_back(1.0);
+    traj[0].positions.push_back(2.0);
+    traj[0].time_from_start = ros::Duration(0.5);
+    traj[1].positions.push_back(3.0);
+    traj[1].positions.push_back(4.0);
+    traj[1].velocities.push_back(0.1);
+    traj[1].velocities.push_back(0.2);
+    traj[1].time_from_start = ros::Duration(1.5);
+    return traj;
+  }
+}
+
+TEST(PackedTrajectoryTest, packUnpack)
+{
+  const Trajectory traj = makeTrajectory();
+  const PackedTrajectory packed(traj);
+  ASSERT_EQ(2u, packed.size());
+  EXPECT_EQ(2u, packed.getNumJoints());
+  EXPECT_EQ(3.0, packed.getPositions(1)[0]);
+  EXPECT_TRUE(0 == packed.getVelocities(0));
+  ASSERT_TRUE(0 != packed.getVelocities(1));
+  EXPECT_EQ(0.2, packed.getVelocities(1)[1]);
+  EXPECT_TRUE(0 == packed.getAccelerations(1));
+
+  Trajectory unpacked;
+  packed.unpack(unpacked);
+  ASSERT_EQ(traj.size(), unpacked.size());
+  for (std::size_t i = 0; i < traj.size(); ++i)
+  {
+    EXPECT_EQ(traj[i].positions, unpacked[i].positions);
+    EXPECT_EQ(traj[i].velocities, unpacked[i].velocities);
+    EXPECT_TRUE(unpacked[i].accelerations.empty());
+    EXPECT_EQ(traj[i].time_from_start.toSec(), unpacked[i].time_from_start.toSec());
+  }
+}
+
+TEST(PackedTrajectoryTest, extract)
+{
+  const PackedTrajectory packed(makeTrajectory());
+
+  // Controller with the second motion joint, and a joint not in the motion
+  std::vector<int> indices;
+  indices.push_back(1);
+  indices.push_back(-1);
+  const std::vector<double> hold_positions(2, 9.0);
+
+  trajectory_msgs::JointTrajectory traj;
+  packed.extract(indices, hold_positions, traj);
+  ASSERT_EQ(2u, traj.points.size());
+  ASSERT_EQ(2u, traj.points[0].positions.size());
+  EXPECT_EQ(2.0, traj.points[0].positions[0]);
+  EXPECT_EQ(9.0, traj.points[0].positions[1]);
+  EXPECT_TRUE(traj.points[0].velocities.empty());
+  EXPECT_EQ(4.0, traj.points[1].positions[0]);
+  EXPECT_EQ(9.0, traj.points[1].positions[1]);
+  ASSERT_EQ(2u, traj.points[1].velocities.size());
+  EXPECT_EQ(0.2, traj.points[1].velocities[0]);
+  EXPECT_EQ(0.0, traj.points[1].velocities[1]);
+  EXPECT_EQ(1.5, traj.points[1].time_from_start.toSec());
+}
+
+TEST(PackedTrajectoryTest, extractJoints)
+{
+  // Velocities not matching the positions in size are treated as missing, both when packing and when not
+  Trajectory unpacked = makeTrajectory();
+  unpacked[0].velocities.push_back(0.1);
+  const PackedTrajectory packed(unpacked);
+  std::vector<int> indices;
+  indices.push_back(1);
+  indices.push_back(-1);
+  const std::vector<double> hold_positions(2, 9.0);
+
+  // Same output as extracting from the packed trajectory
+  trajectory_msgs::JointTrajectory traj, traj_packed;
+  extractJoints(unpacked, indices, hold_positions, traj);
+  packed.extract(indices, hold_positions, traj_packed);
+  ASSERT_EQ(traj_packed.points.size(), traj.points.size());
+  for (std::size_t i = 0; i < traj.points.size(); ++i)
+  {
+    EXPECT_EQ(traj_packed.points[i].positions, traj.points[i].positions);
+    EXPECT_EQ(traj_packed.points[i].velocities, traj.points[i].velocities);
+    EXPECT_EQ(traj_packed.points[i].accelerations, traj.points[i].accelerations);
+    EXPECT_EQ(traj_packed.points[i].time_from_start.toSec(), traj.points[i].time_from_start.toSec());
+  }
+  EXPECT_TRUE(traj.points[0].velocities.empty());
+}
+
+TEST(PackedTrajectoryTest, append)
+{
+  const PackedTrajectory packed(makeTrajectory());
+  const std::vector<int> indices(1, 0);
+
+  trajectory_msgs::JointTrajectory traj;
+  packed.extract(indices, std::vector<double>(1, 0.0), traj);
+  packed.append(indices, std::vector<double>(1, 0.0), ros::Duration(2.0), traj);
+  ASSERT_EQ(4u, traj.points.size());
+  EXPECT_EQ(traj.points[0].positions, traj.points[2].positions);
+  EXPECT_EQ(traj.points[1].velocities, traj.points[3].velocities);
+  EXPECT_EQ(3.5, traj.points[3].time_from_start.toSec());
+
+  play_motion::TrajPoint point;
+  packed.getPoint(1, point);
+  EXPECT_EQ(makeTrajectory()[1].positions, point.positions);
+  EXPECT_EQ(makeTrajectory()[1].velocities, point.velocities);
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
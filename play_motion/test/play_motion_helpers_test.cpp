@@ -27,6 +27,10 @@
 
 /// \author Víctor Lopez
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
 #include <gtest/gtest.h>
 
 #include <ros/ros.h>
@@ -107,6 +111,15 @@ TEST(PlayMotionHelpersTest, isAlreadyThere)
                sourceJoints, sourceTraj[0]));
 
 
+  /// Same position with joints in a different order
+  play_motion::JointNames reversedJoints(sourceJoints.rbegin(), sourceJoints.rend());
+  play_motion::TrajPoint reversedPoint = sourceTraj[0];
+  std::reverse(reversedPoint.positions.begin(), reversedPoint.positions.end());
+  EXPECT_TRUE(play_motion::isAlreadyThere(reversedJoints, reversedPoint,
+              sourceJoints, sourceTraj[0]));
+  EXPECT_FALSE(play_motion::isAlreadyThere(reversedJoints, reversedPoint,
+               sourceJoints, sourceTraj[1]));
+
   differentJoints.clear();
   EXPECT_THROW(play_motion::isAlreadyThere(differentJoints, sourceTraj[0],
                sourceJoints, sourceTraj[0]), ros::Exception);
@@ -132,6 +145,191 @@ TEST(PlayMotionHelpersTest, getMotionKo)
   EXPECT_THROW(play_motion::getMotion(nh, "~bad_name", info), ros::Exception);
 }
 
+TEST(PlayMotionHelpersTest, motionHandle)
+{
+  ros::NodeHandle nh("play_motion");
+  play_motion::MotionHandle bow(nh, "bow");
+  EXPECT_EQ("bow", bow.getId());
+  EXPECT_EQ(18, bow.getJoints().size());
+  EXPECT_EQ("Bow", bow.getName());
+  EXPECT_EQ("greet", bow.getUsage());
+  EXPECT_NEAR(6.5, bow.getDuration().toSec(), 0.01);
+  EXPECT_EQ(2, bow.getPoints().size());
+  EXPECT_NEAR(6.5, bow.getDuration().toSec(), 0.01);
+
+  // Same result as parsing the whole motion at once
+  play_motion::MotionInfo lazy_info, info;
+  bow.getMotion(lazy_info);
+  play_motion::getMotion(nh, "bow", info);
+  EXPECT_EQ(info.joints, lazy_info.joints);
+  EXPECT_EQ(info.description, lazy_info.description);
+  ASSERT_EQ(info.traj.size(), lazy_info.traj.size());
+  EXPECT_EQ(info.traj.back().positions, lazy_info.traj.back().positions);
+
+  // Parts can be accessed in any order
+  play_motion::MotionHandle three_point(nh, "three_point_motion");
+  EXPECT_EQ(3, three_point.getPoints().size());
+  EXPECT_EQ(18, three_point.getJoints().size());
+
+  // Nonexistent motions only throw when accessed
+  play_motion::MotionHandle bad(nh, "bad_name");
+  EXPECT_THROW(bad.getJoints(), ros::Exception);
+  EXPECT_THROW(bad.getDuration(), ros::Exception);
+  EXPECT_THROW(bad.getPoints(), ros::Exception);
+  EXPECT_THROW(play_motion::MotionHandle(nh, "").getJoints(), ros::Exception);
+  EXPECT_THROW(play_motion::MotionHandle(nh, "~bad_name").getJoints(), ros::Exception);
+}
+
+namespace
+{
+  play_motion::TrajPoint makePoint(double position, double time)
+  {
+    play_motion::TrajPoint point;
+    point.positions.push_back(position);
+    point.time_from_start = ros::Duration(time);
+    return point;
+  }
+
+  /// Position of the first joint of a trajectory at time \p t, as interpolated by the controllers.
+  double interpolateCubic(const play_motion::Trajectory& traj, double t)
+  {
+    std::size_t i = 1;
+    while (i + 1 < traj.size() && traj[i].time_from_start.toSec() < t)
+      ++i;
+    const play_motion::TrajPoint& p0 = traj[i - 1];
+    const play_motion::TrajPoint& p1 = traj[i];
+    const double T  = p1.time_from_start.toSec() - p0.time_from_start.toSec();
+    const double d  = p1.positions[0] - p0.positions[0];
+    const double c2 = (3.0 * d - (2.0 * p0.velocities[0] + p1.velocities[0]) * T) / (T * T);
+    const double c3 = (-2.0 * d + (p0.velocities[0] + p1.velocities[0]) * T) / (T * T * T);
+    const double dt = t - p0.time_from_start.toSec();
+    return ((c3 * dt + c2) * dt + p0.velocities[0]) * dt + p0.positions[0];
+  }
+
+  /// Matches the waypoints at a given time from start.
+  struct hasTime
+  {
+    hasTime(double t) : t(t) {}
+    bool operator()(const play_motion::TrajPoint& point) const
+    {
+      return std::abs(point.time_from_start.toSec() - t) < 1e-9;
+    }
+    double t;
+  };
+}
+
+TEST(PlayMotionHelpersTest, validateTrajectory)
+{
+  play_motion::Trajectory traj;
+  traj.push_back(makePoint(0.0, 0.0));
+  traj.push_back(makePoint(1.0, 1.0));
+  EXPECT_NO_THROW(play_motion::validateTrajectory(traj, 1));
+
+  /// Wrong dimensions
+  EXPECT_THROW(play_motion::validateTrajectory(traj, 2), ros::Exception);
+  play_motion::Trajectory bad_traj = traj;
+  bad_traj[1].velocities.resize(2, 0.0);
+  EXPECT_THROW(play_motion::validateTrajectory(bad_traj, 1), ros::Exception);
+
+  /// Non-finite values
+  bad_traj = traj;
+  bad_traj[1].positions[0] = std::numeric_limits<double>::quiet_NaN();
+  EXPECT_THROW(play_motion::validateTrajectory(bad_traj, 1), ros::Exception);
+
+  /// Times not strictly increasing
+  bad_traj = traj;
+  bad_traj[1].time_from_start = bad_traj[0].time_from_start;
+  EXPECT_THROW(play_motion::validateTrajectory(bad_traj, 1), ros::Exception);
+}
+
+TEST(PlayMotionHelpersTest, downsampleTrajectory)
+{
+  /// Ramp up and back down, sampled every 0.1s
+  play_motion::Trajectory traj;
+  for (int i = 0; i <= 20; ++i)
+    traj.push_back(makePoint(i <= 10 ? 0.1 * i : 2.0 - 0.1 * i, 0.1 * i));
+
+  /// Removed waypoints lie on the cubic segments the controllers interpolate between the kept ones
+  const double tolerance = 1e-6;
+  play_motion::Trajectory traj_out;
+  play_motion::downsampleTrajectory(traj, tolerance, traj_out);
+  EXPECT_GT(traj.size(), traj_out.size());
+  EXPECT_NEAR(0.0, traj_out.front().positions[0], 1e-9);
+  EXPECT_NEAR(0.0, traj_out.back().positions[0], 1e-9);
+  for (std::size_t i = 0; i < traj_out.size(); ++i)
+    ASSERT_EQ(1u, traj_out[i].velocities.size());
+  for (std::size_t i = 0; i < traj.size(); ++i)
+  {
+    const double t = traj[i].time_from_start.toSec();
+    EXPECT_NEAR(traj[i].positions[0], interpolateCubic(traj_out, t), tolerance);
+  }
+
+  /// Waypoints with velocities are kept
+  traj[5].velocities.push_back(1.0);
+  play_motion::downsampleTrajectory(traj, tolerance, traj);
+  EXPECT_NE(traj.end(), std::find_if(traj.begin(), traj.end(), hasTime(0.5)));
+}
+
+TEST(PlayMotionHelpersTest, upsampleTrajectory)
+{
+  play_motion::Trajectory traj;
+  traj.push_back(makePoint(0.0, 0.0));
+  traj.push_back(makePoint(1.0, 1.0));
+
+  /// Velocities are required
+  play_motion::Trajectory traj_out;
+  EXPECT_THROW(play_motion::upsampleTrajectory(traj, 0.25, traj_out), ros::Exception);
+
+  /// Added waypoints lie on the cubic from rest to rest
+  play_motion::populateVelocities(traj, traj);
+  play_motion::upsampleTrajectory(traj, 0.25, traj_out);
+  ASSERT_EQ(5u, traj_out.size());
+  EXPECT_NEAR(0.5, traj_out[2].positions[0], 1e-9);
+  EXPECT_NEAR(1.5, traj_out[2].velocities[0], 1e-9);
+  EXPECT_NEAR(0.75, traj_out[3].time_from_start.toSec(), 1e-9);
+  EXPECT_NEAR(1.0, traj_out[4].positions[0], 1e-9);
+}
+
+TEST(PlayMotionHelpersTest, populateVelocities)
+{
+  /// Two joints covering holds, reversals and monotonic segments, with non-uniform sampling
+  const double pos[][2] = {{0.0, 1.0}, {0.5, 1.0}, {0.5, 0.5}, {1.0, 0.7}, {2.0, 0.7}, {1.5, 0.9}, {1.0, 1.0}};
+  const int num_points = sizeof(pos) / sizeof(pos[0]);
+  play_motion::Trajectory traj;
+  for (int i = 0; i < num_points; ++i)
+  {
+    play_motion::TrajPoint point;
+    point.positions.assign(pos[i], pos[i] + 2);
+    point.time_from_start = ros::Duration(0.3 * i + 0.01 * i * i);
+    traj.push_back(point);
+  }
+  traj[3].velocities.assign(2, 9.0); // Valid specifications are kept
+
+  /// Reference computed point by point
+  play_motion::Trajectory traj_ref = traj;
+  traj_ref.front().velocities.assign(2, 0.0);
+  traj_ref.back().velocities.assign(2, 0.0);
+  for (int i = 1; i < num_points - 1; ++i)
+    play_motion::populateVelocities(traj[i - 1], traj[i + 1], traj_ref[i]);
+
+  play_motion::Trajectory traj_out;
+  play_motion::populateVelocities(traj, traj_out);
+  ASSERT_EQ(traj_ref.size(), traj_out.size());
+  for (int i = 0; i < num_points; ++i)
+  {
+    ASSERT_EQ(2u, traj_out[i].velocities.size());
+    EXPECT_EQ(traj_ref[i].velocities[0], traj_out[i].velocities[0]);
+    EXPECT_EQ(traj_ref[i].velocities[1], traj_out[i].velocities[1]);
+  }
+  EXPECT_EQ(0.0, traj_out[2].velocities[0]); // Hold
+  EXPECT_EQ(0.0, traj_out[4].velocities[0]); // Reversal
+  EXPECT_EQ(9.0, traj_out[3].velocities[0]);
+
+  /// In place
+  play_motion::populateVelocities(traj, traj);
+  EXPECT_EQ(traj_ref[1].velocities[0], traj[1].velocities[0]);
+}
+
 int main(int argc, char** argv)
 {
   testing::InitGoogleTest(&argc, argv);
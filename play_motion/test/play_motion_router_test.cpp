@@ -0,0 +1,217 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2013, PAL Robotics S.L.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//   * Neither the name of PAL Robotics S.L. nor the names of its
+//     contributors may be used to endorse or promote products derived from
+//     this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//////////////////////////////////////////////////////////////////////////////
+
+
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <ros/ros.h>
+#include <actionlib/client/simple_action_client.h>
+#include <sensor_msgs/JointState.h>
+
+#include "play_motion_msgs/PlayMotionAction.h"
+
+typedef actionlib::SimpleClientGoalState GS;
+typedef play_motion_msgs::PlayMotionResult PMR;
+typedef play_motion_msgs::PlayMotionGoal ActionGoal;
+
+class PlayMotionRouterTestClient
+{
+  typedef actionlib::SimpleActionClient<play_motion_msgs::PlayMotionAction> ActionClient;
+
+public:
+  PlayMotionRouterTestClient()
+    : ac_("/play_motion")
+  {
+    js_sub_ = nh_.subscribe("/joint_states", 10, &PlayMotionRouterTestClient::jsCb, this);
+    ac_.waitForServer();
+  }
+
+  void playGoal(const ActionGoal& goal)
+  {
+    sendGoal(goal);
+    waitForResult();
+  }
+
+  void sendGoal(const ActionGoal& goal)
+  {
+    ac_.sendGoal(goal);
+  }
+
+  void waitForResult()
+  {
+    ac_.waitForResult();
+    state_ = ac_.getState().state_;
+    error_code_ = ac_.getResult()->error_code;
+  }
+
+  void playMotion(const std::string& motion_name)
+  {
+    ActionGoal goal;
+    goal.motion_name = motion_name;
+    goal.skip_planning = true;
+    playGoal(goal);
+  }
+
+  double getJointPos(const std::string& joint_name)
+  {
+    for (std::size_t i = 0; i < js_.name.size(); ++i)
+    {
+      if (js_.name[i] == joint_name)
+        return js_.position[i];
+    }
+    return std::numeric_limits<double>::quiet_NaN();
+  }
+
+  void shouldFinishWith(int code, int gstate)
+  {
+    EXPECT_EQ(code, error_code_);
+    EXPECT_EQ(gstate, state_);
+  }
+
+  void shouldSucceed()
+  {
+    shouldFinishWith(PMR::SUCCEEDED, GS::SUCCEEDED);
+  }
+
+private:
+  void jsCb(const sensor_msgs::JointStatePtr& js) { js_ = *js; }
+
+  ros::NodeHandle          nh_;
+  ActionClient             ac_;
+  ros::Subscriber          js_sub_;
+  sensor_msgs::JointState  js_;
+  int                      state_;
+  int                      error_code_;
+};
+
+TEST(PlayMotionRouterTest, splitGoal)
+{
+  PlayMotionRouterTestClient pmtc;
+  pmtc.playMotion("home");
+  pmtc.shouldSucceed();
+
+  /// Each joint is played by a different instance
+  pmtc.playMotion("pose1");
+  pmtc.shouldSucceed();
+  EXPECT_NEAR(pmtc.getJointPos("joint1"), 1.8, 0.01);
+  EXPECT_NEAR(pmtc.getJointPos("joint2"), 1.8, 0.01);
+}
+
+TEST(PlayMotionRouterTest, partialGoal)
+{
+  PlayMotionRouterTestClient pmtc;
+  pmtc.playMotion("home");
+  pmtc.shouldSucceed();
+
+  /// Goals on the joints of a single instance are forwarded to it
+  ActionGoal goal;
+  goal.motion_name = "pose1";
+  goal.skip_planning = true;
+  goal.joints.push_back("joint2");
+  pmtc.playGoal(goal);
+  pmtc.shouldSucceed();
+  EXPECT_NEAR(pmtc.getJointPos("joint1"), 0.0, 0.01);
+  EXPECT_NEAR(pmtc.getJointPos("joint2"), 1.8, 0.01);
+
+  /// Joints not owned by any instance are rejected by the router
+  goal.joints.push_back("joint3");
+  pmtc.playGoal(goal);
+  pmtc.shouldFinishWith(PMR::MISSING_CONTROLLER, GS::REJECTED);
+
+  /// Joints owned by an instance, but not used by the motion, are rejected by the instance
+  goal.motion_name = "joint1_pose";
+  goal.joints.assign(1, "joint2");
+  pmtc.playGoal(goal);
+  pmtc.shouldFinishWith(PMR::OTHER_ERROR, GS::ABORTED);
+}
+
+TEST(PlayMotionRouterTest, splitGoalStartTime)
+{
+  PlayMotionRouterTestClient pmtc;
+  pmtc.playMotion("home");
+  pmtc.shouldSucceed();
+
+  /// The parts of a split goal wait for its start time
+  ActionGoal goal;
+  goal.motion_name = "pose1";
+  goal.skip_planning = true;
+  goal.start_time = ros::Time::now() + ros::Duration(2.0);
+  pmtc.sendGoal(goal);
+  (goal.start_time - ros::Duration(0.5) - ros::Time::now()).sleep();
+  EXPECT_NEAR(pmtc.getJointPos("joint1"), 0.0, 0.01);
+  EXPECT_NEAR(pmtc.getJointPos("joint2"), 0.0, 0.01);
+
+  pmtc.waitForResult();
+  pmtc.shouldSucceed();
+  EXPECT_GE(ros::Time::now().toSec(), goal.start_time.toSec());
+  EXPECT_NEAR(pmtc.getJointPos("joint1"), 1.8, 0.01);
+  EXPECT_NEAR(pmtc.getJointPos("joint2"), 1.8, 0.01);
+}
+
+TEST(PlayMotionRouterTest, splitGoalMissedStartTime)
+{
+  PlayMotionRouterTestClient pmtc;
+  pmtc.playMotion("home");
+  pmtc.shouldSucceed();
+
+  /// Parts that are not ready by the start time fail the goal, instead of starting out of sync with the rest
+  ActionGoal goal;
+  goal.motion_name = "pose1";
+  goal.skip_planning = true;
+  goal.start_time = ros::Time::now();
+  pmtc.playGoal(goal);
+  pmtc.shouldFinishWith(PMR::START_TIME_MISSED, GS::ABORTED);
+
+  ros::Duration(1.0).sleep();
+  EXPECT_NEAR(pmtc.getJointPos("joint1"), 0.0, 0.01);
+  EXPECT_NEAR(pmtc.getJointPos("joint2"), 0.0, 0.01);
+}
+
+TEST(PlayMotionRouterTest, badMotionName)
+{
+  PlayMotionRouterTestClient pmtc;
+  pmtc.playMotion("inexistant_motion");
+  pmtc.shouldFinishWith(PMR::MOTION_NOT_FOUND, GS::REJECTED);
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  ros::init(argc, argv, "play_motion_router_test");
+
+  ros::AsyncSpinner spinner(1);
+  spinner.start();
+  ros::Duration(2.0).sleep(); // wait a bit for the controllers to start
+  int ret = RUN_ALL_TESTS();
+  spinner.stop();
+  ros::shutdown();
+  return ret;
+}
@@ -0,0 +1,134 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2013, PAL Robotics S.L.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//   * Neither the name of PAL Robotics S.L. nor the names of its
+//     contributors may be used to endorse or promote products derived from
+//     this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//////////////////////////////////////////////////////////////////////////////
+
+/// \author Paul Mathieu
+
+#include <boost/thread.hpp>
+#include <ros/ros.h>
+#include <ros/time.h>
+#include <std_msgs/Float64.h>
+
+#include "play_motion_test_client.h"
+
+TEST(PlayMotionTest, replaceStreamedGoal)
+{
+  PlayMotionTestClient pmtc1;
+  PlayMotionTestClient pmtc2;
+  pmtc1.playMotion("home", true);
+  pmtc1.shouldSucceed();
+
+  /// Goal replaced while its trajectory is streamed in windows
+  boost::thread t(boost::bind(&PlayMotionTestClient::playMotion, &pmtc1, "wave", true, 0));
+  ros::Duration(1.2).sleep();
+  pmtc2.playMotion("pose1", true, 1);
+  pmtc2.shouldSucceed();
+  t.join();
+  pmtc1.shouldFinishWith(PMR::PREEMPTED, GS::PREEMPTED);
+
+  /// No window of the replaced goal reaches the controllers afterwards
+  ros::Duration(1.0).sleep();
+  EXPECT_NEAR(pmtc2.getJointPos("joint1"), 1.8, 0.01);
+}
+
+TEST(PlayMotionTest, cancelStreamedGoal)
+{
+  PlayMotionTestClient pmtc;
+  pmtc.playMotion("home", true);
+  pmtc.shouldSucceed();
+
+  boost::thread t(boost::bind(&PlayMotionTestClient::playMotion, &pmtc, "wave", true, 0));
+  ros::Duration(1.2).sleep();
+  pmtc.cancelGoal();
+  t.join();
+  pmtc.shouldBeCanceled();
+
+  /// The joints stay where the goal was canceled, instead of following the windows left to stream
+  ros::Duration(0.5).sleep();
+  const double canceled_pos = pmtc.getJointPos("joint1");
+  ros::Duration(1.0).sleep();
+  EXPECT_NEAR(pmtc.getJointPos("joint1"), canceled_pos, 0.01);
+
+  pmtc.playMotion("home", true);
+  pmtc.shouldSucceed();
+}
+
+TEST(PlayMotionTest, speedOverride)
+{
+  PlayMotionTestClient pmtc;
+  play_motion_msgs::PlayMotionGoal goal;
+  goal.motion_name = "swing";
+  goal.skip_planning = true;
+  goal.time_scaling = 2.0;
+
+  /// The speed override compensates the goal time scaling
+  ros::NodeHandle nh;
+  ros::Publisher speed_pub = nh.advertise<std_msgs::Float64>("/play_motion/speed_override", 1, true);
+  std_msgs::Float64 speed;
+  speed.data = 2.0;
+  speed_pub.publish(speed);
+  while (speed_pub.getNumSubscribers() == 0)
+    ros::Duration(0.1).sleep();
+  ros::Duration(0.5).sleep();
+
+  pmtc.playMotion("home", true);
+  pmtc.shouldSucceed();
+  ros::Time start = ros::Time::now();
+  pmtc.playGoal(goal);
+  pmtc.shouldSucceed();
+  EXPECT_GT(1.9, (ros::Time::now() - start).toSec());
+
+  /// Out of range speed overrides are ignored, instead of bringing the node down
+  speed.data = 1e-12;
+  speed_pub.publish(speed);
+  ros::Duration(0.5).sleep();
+  goal.time_scaling = 0.0;
+  pmtc.playMotion("home", true);
+  pmtc.shouldSucceed();
+  start = ros::Time::now();
+  pmtc.playGoal(goal);
+  pmtc.shouldSucceed();
+  EXPECT_GT(1.9, (ros::Time::now() - start).toSec());
+
+  speed.data = 1.0;
+  speed_pub.publish(speed);
+  ros::Duration(0.5).sleep();
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  ros::init(argc, argv, "play_motion_streaming_test");
+
+  ros::AsyncSpinner spinner(1);
+  spinner.start();
+  ros::Duration(2.0).sleep(); // wait a bit for the controllers to start
+  int ret = RUN_ALL_TESTS();
+  spinner.stop();
+  ros::shutdown();
+  return ret;
+}
+
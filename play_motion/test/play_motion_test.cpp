@@ -27,89 +27,31 @@
 
 /// \author Paul Mathieu
 
-#include <gtest/gtest.h>
-
 #include <boost/thread.hpp>
 #include <ros/ros.h>
 #include <ros/time.h>
-#include <actionlib/client/simple_action_client.h>
-#include <sensor_msgs/JointState.h>
-
-#include "play_motion_msgs/PlayMotionAction.h"
+#include <controller_manager_msgs/SwitchController.h>
 
-typedef actionlib::SimpleClientGoalState GS;
-typedef play_motion_msgs::PlayMotionResult PMR;
+#include "play_motion_test_client.h"
 
-class PlayMotionTestClient
+namespace
 {
-  typedef actionlib::SimpleActionClient<play_motion_msgs::PlayMotionAction> ActionClient;
-  typedef boost::shared_ptr<ActionClient> ActionClientPtr;
-  typedef play_motion_msgs::PlayMotionGoal ActionGoal;
-  typedef actionlib::SimpleClientGoalState ActionGoalState;
-  typedef boost::shared_ptr<ActionGoalState> ActionGoalStatePtr;
-
-public:
-  PlayMotionTestClient()
+  /// Stop and restart a controller a few times, leaving it running.
+  void toggleController(const std::string& name, unsigned int times)
   {
-    ac_.reset(new ActionClient("/play_motion"));
-    js_sub_ = nh_.subscribe("/joint_states", 10, &PlayMotionTestClient::jsCb, this);
-    ac_->waitForServer();
-  }
-
-  int playMotion(const std::string& motion_name, bool skip_planning)
-  {
-    ActionGoal goal;
-    goal.motion_name = motion_name;
-    goal.skip_planning = skip_planning;
-
-    ROS_INFO_STREAM("Sending goal " << motion_name);
-
-    gs_.reset(new ActionGoalState(ac_->sendGoalAndWait(goal)));
-    ROS_INFO_STREAM("Done goal " << motion_name);
-    ret_ = ac_->getResult()->error_code;
-    return ret_;
-  }
-
-  double getJointPos(const std::string& joint_name)
-  {
-    unsigned int i;
-    for (i = 0; i < js_.name.size(); ++i)
+    ros::NodeHandle nh;
+    ros::ServiceClient switch_client =
+        nh.serviceClient<controller_manager_msgs::SwitchController>("/controller_manager/switch_controller");
+    for (unsigned int i = 0; i < 2 * times; ++i)
     {
-      if (js_.name[i] == joint_name)
-        return js_.position[i];
+      controller_manager_msgs::SwitchController srv;
+      (i % 2 ? srv.request.start_controllers : srv.request.stop_controllers).push_back(name);
+      srv.request.strictness = controller_manager_msgs::SwitchController::Request::STRICT;
+      EXPECT_TRUE(switch_client.call(srv));
+      ros::Duration(1.2).sleep(); // Longer than the controller updater poll period
     }
-
-    return std::numeric_limits<double>::quiet_NaN();
   }
-
-  void shouldFinishWith(int code, int gstate)
-  {
-    EXPECT_EQ(code, ret_);
-    EXPECT_EQ(gstate, gs_->state_);
-  }
-
-  void shouldFailWithCode(int code)
-  {
-    shouldFinishWith(code, GS::REJECTED);
-  }
-
-  void shouldSucceed()
-  {
-    shouldFinishWith(PMR::SUCCEEDED, GS::SUCCEEDED);
-  }
-
-
-protected:
-  void jsCb(const sensor_msgs::JointStatePtr& js) { js_ = *js; }
-
-private:
-  int ret_;
-  ActionGoalStatePtr gs_;
-  ros::NodeHandle nh_;
-  ActionClientPtr ac_;
-  sensor_msgs::JointState js_;
-  ros::Subscriber js_sub_;
-};
+}
 
 TEST(PlayMotionTest, basicReachPose)
 {
@@ -127,7 +69,7 @@ TEST(PlayMotionTest, rejectSecondGoal)
   PlayMotionTestClient pmtc1;
   PlayMotionTestClient pmtc2;
 
-  boost::thread t(boost::bind(&PlayMotionTestClient::playMotion, &pmtc1, "home", true));
+  boost::thread t(boost::bind(&PlayMotionTestClient::playMotion, &pmtc1, "home", true, 0));
   ros::Duration(0.3).sleep();
 
   pmtc2.playMotion("home", true);
@@ -137,6 +79,120 @@ TEST(PlayMotionTest, rejectSecondGoal)
   pmtc1.shouldSucceed();
 }
 
+TEST(PlayMotionTest, concurrentDisjointGoals)
+{
+  PlayMotionTestClient pmtc1;
+  PlayMotionTestClient pmtc2;
+  PlayMotionTestClient pmtc3;
+  pmtc1.playMotion("home", true);
+  pmtc1.shouldSucceed();
+
+  /// Goals on disjoint controllers are played at the same time
+  boost::thread t1(boost::bind(&PlayMotionTestClient::playMotion, &pmtc1, "joint1_pose", true, 0));
+  ros::Duration(0.3).sleep();
+  boost::thread t2(boost::bind(&PlayMotionTestClient::playMotion, &pmtc2, "joint2_pose", true, 0));
+  ros::Duration(0.3).sleep();
+
+  /// A goal overlapping with them is rejected
+  pmtc3.playMotion("pose1", true);
+  pmtc3.shouldFailWithCode(PMR::CONTROLLER_BUSY);
+
+  t1.join();
+  t2.join();
+  pmtc1.shouldSucceed();
+  pmtc2.shouldSucceed();
+  EXPECT_NEAR(pmtc1.getJointPos("joint1"), 1.0, 0.01);
+  EXPECT_NEAR(pmtc2.getJointPos("joint2"), 1.0, 0.01);
+}
+
+TEST(PlayMotionTest, switchControllerWhileAccepting)
+{
+  ASSERT_TRUE(ros::service::waitForService("/controller_manager/switch_controller", ros::Duration(5.0)));
+  PlayMotionTestClient pmtc;
+  pmtc.playMotion("home", true);
+  pmtc.shouldSucceed();
+
+  /// Controller updates, which abort the goals of the removed controllers, race with goals being accepted. Goals
+  /// may fail meanwhile, but the server must keep serving them
+  boost::thread t(boost::bind(toggleController, "rrbot_controller_joint2", 3));
+  const ros::Time end = ros::Time::now() + ros::Duration(7.2);
+  unsigned int i = 0;
+  while (ros::Time::now() < end)
+  {
+    pmtc.playMotion(i++ % 2 ? "swing" : "home", true);
+    ros::Duration(0.05).sleep();
+  }
+  t.join();
+
+  ros::Duration(1.5).sleep();
+  pmtc.playMotion("home", true);
+  pmtc.shouldSucceed();
+}
+
+TEST(PlayMotionTest, preemptLowerPriorityGoal)
+{
+  PlayMotionTestClient pmtc1;
+  PlayMotionTestClient pmtc2;
+
+  boost::thread t(boost::bind(&PlayMotionTestClient::playMotion, &pmtc1, "pose1", true, 0));
+  ros::Duration(0.3).sleep();
+
+  pmtc2.playMotion("home", true, 1);
+  pmtc2.shouldSucceed();
+
+  t.join();
+  pmtc1.shouldFinishWith(PMR::PREEMPTED, GS::PREEMPTED);
+
+  double final_pos = pmtc2.getJointPos("joint1");
+  EXPECT_NEAR(final_pos, 0.0, 0.01);
+}
+
+TEST(PlayMotionTest, feedback)
+{
+  PlayMotionTestClient pmtc;
+  pmtc.playMotion("home", true);
+  pmtc.shouldSucceed();
+
+  /// The non-planned approach to pose1 takes a few seconds
+  pmtc.playMotion("pose1", true);
+  pmtc.shouldSucceed();
+
+  const std::vector<play_motion_msgs::PlayMotionFeedback> feedback = pmtc.getFeedback();
+  ASSERT_GT(feedback.size(), 2u);
+  double prev_progress = 0.0;
+  for (std::size_t i = 0; i < feedback.size(); ++i)
+  {
+    EXPECT_LE(prev_progress, feedback[i].progress);
+    EXPECT_GE(1.0, feedback[i].progress);
+    EXPECT_LE(0.0, feedback[i].time_remaining);
+    EXPECT_LE(0.0, feedback[i].max_tracking_error);
+    prev_progress = feedback[i].progress;
+  }
+  EXPECT_GT(feedback.front().time_remaining, feedback.back().time_remaining);
+}
+
+TEST(PlayMotionTest, earlyCompletion)
+{
+  PlayMotionTestClient pmtc;
+  pmtc.playMotion("home", true);
+  pmtc.shouldSucceed();
+
+  play_motion_msgs::PlayMotionGoal goal;
+  goal.motion_name = "pose1";
+  goal.skip_planning = true;
+  goal.completion_tolerance = 0.05;
+  goal.cancel_on_completion = true;
+  pmtc.playGoal(goal);
+  pmtc.shouldSucceed();
+  EXPECT_NEAR(pmtc.getJointPos("joint1"), 1.8, 0.05);
+
+  // Controllers are free for the next goal right away
+  goal.motion_name = "home";
+  goal.cancel_on_completion = false;
+  pmtc.playGoal(goal);
+  pmtc.shouldSucceed();
+}
+
 TEST(PlayMotionTest, badMotionName)
 {
   PlayMotionTestClient pmtc;
@@ -154,6 +210,58 @@ TEST(PlayMotionTest, malformedPose)
   pmtc.shouldFailWithCode(PMR::OTHER_ERROR);
 }
 
+TEST(PlayMotionTest, playSequence)
+{
+  PlayMotionTestClient pmtc;
+
+  std::vector<std::string> sequence;
+  sequence.push_back("pose1");
+  sequence.push_back("home");
+  pmtc.playSequence(sequence, std::vector<double>(), true);
+  pmtc.shouldSucceed();
+  EXPECT_NEAR(pmtc.getJointPos("joint1"), 0.0, 0.01);
+
+  /// Slowed down steps
+  std::vector<double> time_scaling(2, 2.0);
+  pmtc.playSequence(sequence, time_scaling, true);
+  pmtc.shouldSucceed();
+
+  /// Time scaling not matching the steps
+  time_scaling.pop_back();
+  pmtc.playSequence(sequence, time_scaling, true);
+  pmtc.shouldFailWithCode(PMR::OTHER_ERROR);
+
+  /// Missing step
+  sequence.push_back("inexistant_motion");
+  pmtc.playSequence(sequence, std::vector<double>(), true);
+  pmtc.shouldFailWithCode(PMR::MOTION_NOT_FOUND);
+}
+
+TEST(PlayMotionTest, timeScaling)
+{
+  PlayMotionTestClient pmtc;
+  play_motion_msgs::PlayMotionGoal goal;
+  goal.motion_name = "swing";
+  goal.skip_planning = true;
+
+  pmtc.playMotion("home", true);
+  pmtc.shouldSucceed();
+  goal.time_scaling = 2.0;
+  ros::Time start = ros::Time::now();
+  pmtc.playGoal(goal);
+  pmtc.shouldSucceed();
+  EXPECT_LE(2.0, (ros::Time::now() - start).toSec());
+  EXPECT_NEAR(pmtc.getJointPos("joint1"), 0.5, 0.01);
+
+  /// Negative and huge time scaling are rejected
+  goal.time_scaling = -1.0;
+  pmtc.playGoal(goal);
+  pmtc.shouldFailWithCode(PMR::OTHER_ERROR);
+  goal.time_scaling = 1e12;
+  pmtc.playGoal(goal);
+  pmtc.shouldFailWithCode(PMR::OTHER_ERROR);
+}
+
 int main(int argc, char** argv)
 {
   testing::InitGoogleTest(&argc, argv);
@@ -0,0 +1,173 @@
+///////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2013, PAL Robotics S.L.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//   * Neither the name of PAL Robotics S.L. nor the names of its
+//     contributors may be used to endorse or promote products derived from
+//     this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//////////////////////////////////////////////////////////////////////////////
+
+/// \author Paul Mathieu
+
+#ifndef PLAY_MOTION_TEST_CLIENT_H
+#define PLAY_MOTION_TEST_CLIENT_H
+
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <boost/bind.hpp>
+#include <boost/thread/mutex.hpp>
+#include <ros/ros.h>
+#include <actionlib/client/simple_action_client.h>
+#include <sensor_msgs/JointState.h>
+
+#include "play_motion_msgs/PlayMotionAction.h"
+
+typedef actionlib::SimpleClientGoalState GS;
+typedef play_motion_msgs::PlayMotionResult PMR;
+
+class PlayMotionTestClient
+{
+  typedef actionlib::SimpleActionClient<play_motion_msgs::PlayMotionAction> ActionClient;
+  typedef boost::shared_ptr<ActionClient> ActionClientPtr;
+  typedef play_motion_msgs::PlayMotionGoal ActionGoal;
+  typedef play_motion_msgs::PlayMotionFeedback ActionFeedback;
+  typedef actionlib::SimpleClientGoalState ActionGoalState;
+  typedef boost::shared_ptr<ActionGoalState> ActionGoalStatePtr;
+
+public:
+  PlayMotionTestClient()
+  {
+    ac_.reset(new ActionClient("/play_motion"));
+    js_sub_ = nh_.subscribe("/joint_states", 10, &PlayMotionTestClient::jsCb, this);
+    ac_->waitForServer();
+  }
+
+  int playMotion(const std::string& motion_name, bool skip_planning, int priority = 0)
+  {
+    ActionGoal goal;
+    goal.motion_name = motion_name;
+    goal.skip_planning = skip_planning;
+    goal.priority = priority;
+    return playGoal(goal);
+  }
+
+  int playGoal(const ActionGoal& goal)
+  {
+    ROS_INFO_STREAM("Sending goal " << goal.motion_name);
+
+    feedback_.clear();
+    ac_->sendGoal(goal, ActionClient::SimpleDoneCallback(), ActionClient::SimpleActiveCallback(),
+                  boost::bind(&PlayMotionTestClient::feedbackCb, this, _1));
+    ac_->waitForResult();
+    gs_.reset(new ActionGoalState(ac_->getState()));
+    ROS_INFO_STREAM("Done goal " << goal.motion_name);
+    ret_ = ac_->getResult()->error_code;
+    return ret_;
+  }
+
+  int playSequence(const std::vector<std::string>& sequence, const std::vector<double>& time_scaling,
+                   bool skip_planning)
+  {
+    ActionGoal goal;
+    goal.sequence = sequence;
+    goal.sequence_time_scaling = time_scaling;
+    goal.skip_planning = skip_planning;
+
+    ROS_INFO_STREAM("Sending sequence goal of " << sequence.size() << " motions");
+
+    gs_.reset(new ActionGoalState(ac_->sendGoalAndWait(goal)));
+    ROS_INFO_STREAM("Done sequence goal");
+    ret_ = ac_->getResult()->error_code;
+    return ret_;
+  }
+
+  double getJointPos(const std::string& joint_name)
+  {
+    unsigned int i;
+    for (i = 0; i < js_.name.size(); ++i)
+    {
+      if (js_.name[i] == joint_name)
+        return js_.position[i];
+    }
+
+    return std::numeric_limits<double>::quiet_NaN();
+  }
+
+  void shouldFinishWith(int code, int gstate)
+  {
+    EXPECT_EQ(code, ret_);
+    EXPECT_EQ(gstate, gs_->state_);
+  }
+
+  void shouldFailWithCode(int code)
+  {
+    shouldFinishWith(code, GS::REJECTED);
+  }
+
+  void shouldSucceed()
+  {
+    shouldFinishWith(PMR::SUCCEEDED, GS::SUCCEEDED);
+  }
+
+  void shouldBeCanceled()
+  {
+    EXPECT_EQ(GS::PREEMPTED, gs_->state_);
+  }
+
+  /// Cancel the goal being played by another thread.
+  void cancelGoal()
+  {
+    ac_->cancelGoal();
+  }
+
+  /// Feedback received during the last playMotion() call.
+  std::vector<ActionFeedback> getFeedback()
+  {
+    boost::mutex::scoped_lock lock(feedback_mutex_);
+    return feedback_;
+  }
+
+
+protected:
+  void jsCb(const sensor_msgs::JointStatePtr& js) { js_ = *js; }
+
+  void feedbackCb(const play_motion_msgs::PlayMotionFeedbackConstPtr& feedback)
+  {
+    boost::mutex::scoped_lock lock(feedback_mutex_);
+    feedback_.push_back(*feedback);
+  }
+
+private:
+  int ret_;
+  ActionGoalStatePtr gs_;
+  ros::NodeHandle nh_;
+  ActionClientPtr ac_;
+  sensor_msgs::JointState js_;
+  ros::Subscriber js_sub_;
+  std::vector<ActionFeedback> feedback_;
+  boost::mutex feedback_mutex_;
+};
+
+#endif